@@ -0,0 +1,383 @@
+#include "backend.h"
+#include "database.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QRegExp>
+#include <QSqlError>
+#include <QSqlQuery>
+
+QSharedPointer<Backend> Backend::create(const QString &name)
+{
+    const QString key = name.toLower();
+    if (key.isEmpty() || "mysql" == key) {
+        return QSharedPointer<Backend>(new MySqlBackend);
+    }
+    else if ("sqlite" == key) {
+        return QSharedPointer<Backend>(new SqliteBackend);
+    }
+    return QSharedPointer<Backend>();
+}
+
+void Backend::setupSession(QSqlDatabase &) const
+{
+}
+
+bool Backend::createDatabase(const DatabaseOptions &) const
+{
+    return true;
+}
+
+bool Backend::prepareSchema(QSqlDatabase &, const DatabaseOptions &) const
+{
+    // Schema is created by hand from create_database.sql
+    return true;
+}
+
+bool Backend::transactionPerSequence() const
+{
+    return false;
+}
+
+QStringList Backend::bulkLoadSessionStatements(bool) const
+{
+    return QStringList();
+}
+
+void Backend::finishBulkLoad(QSqlDatabase &) const
+{
+}
+
+QList<IndexDefinition> Backend::secondaryIndexes()
+{
+    static const IndexDefinition Indexes[] = {
+        { "genes", "genes_sequence", "id_sequences", true },
+        { "genes", "genes_organism", "id_organisms", false },
+        { "isoforms", "isoforms_gene", "id_genes", false },
+        { "isoforms", "isoforms_sequence", "id_sequences", true },
+        { "real_exons", "real_exons_gene", "id_genes", false },
+        { "real_exons", "real_exons_sequence", "id_sequences", true },
+        { "exons", "exons_isoform", "id_isoforms", false },
+        { "exons", "exons_gene", "id_genes", false },
+        { "exons", "exons_sequence", "id_sequences", true },
+        { "introns", "introns_isoform", "id_isoforms", false },
+        { "introns", "introns_gene", "id_genes", false },
+        { "introns", "introns_sequence", "id_sequences", true }
+    };
+    QList<IndexDefinition> result;
+    for (const IndexDefinition & index : Indexes) {
+        result << index;
+    }
+    return result;
+}
+
+QString Backend::dropIndexStatement(const IndexDefinition &index) const
+{
+    return QString("DROP INDEX IF EXISTS %1").arg(index.name);
+}
+
+QStringList Backend::createIndexStatements(const QList<IndexDefinition> &indexes) const
+{
+    QStringList result;
+    Q_FOREACH(const IndexDefinition & index, indexes) {
+        result << QString("CREATE INDEX IF NOT EXISTS %1 ON %2(%3)")
+                  .arg(index.name).arg(index.table).arg(index.columns);
+    }
+    return result;
+}
+
+bool Backend::defersIndexes() const
+{
+    return false;
+}
+
+bool Backend::parallelIndexBuild() const
+{
+    return true;
+}
+
+bool Backend::blobsInTextColumns() const
+{
+    return false;
+}
+
+QStringList Backend::partitionedTables()
+{
+    return QStringList() << "sequences" << "genes" << "isoforms"
+                         << "real_exons" << "exons" << "introns";
+}
+
+QStringList Backend::organismPartitions(QSqlDatabase &) const
+{
+    return QStringList();
+}
+
+QString Backend::partitionName(qint32 organismId)
+{
+    return QString("p%1").arg(organismId);
+}
+
+QStringList Backend::addPartitionStatements(qint32) const
+{
+    return QStringList();
+}
+
+QStringList Backend::truncatePartitionStatements(qint32) const
+{
+    return QStringList();
+}
+
+bool Backend::execAll(QSqlDatabase &db, const QStringList &statements)
+{
+    QSqlQuery query("", db);
+    Q_FOREACH(const QString & sql, statements) {
+        if (!query.exec(sql)) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+            return false;
+        }
+    }
+    return true;
+}
+
+
+QString MySqlBackend::name() const
+{
+    return "mysql";
+}
+
+QString MySqlBackend::driverName() const
+{
+    return "QMYSQL";
+}
+
+void MySqlBackend::configure(QSqlDatabase &db, const DatabaseOptions &options) const
+{
+    db.setHostName(options.host);
+    db.setUserName(options.userName);
+    db.setPassword(options.password);
+    db.setDatabaseName(options.dbName);
+    db.setConnectOptions("CLIENT_COMPRESS=1");
+}
+
+bool MySqlBackend::createDatabase(const DatabaseOptions &options) const
+{
+    // Server level connection, the database may not exist yet
+    const QString connectionName = QString("introns_db_fill_pid%1_create_%2")
+            .arg(qApp->applicationPid()).arg(options.dbName);
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(driverName(), connectionName);
+        DatabaseOptions serverOptions = options;
+        serverOptions.dbName.clear();
+        configure(db, serverOptions);
+        if (db.open()) {
+            ok = execAll(db, QStringList()
+                         << QString("CREATE DATABASE IF NOT EXISTS `%1`").arg(options.dbName));
+            db.close();
+        }
+        else {
+            qWarning() << db.lastError();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
+bool MySqlBackend::prepareSchema(QSqlDatabase &db, const DatabaseOptions &options) const
+{
+    if (options.schemaScript.isEmpty() || db.tables().contains("sequences")) {
+        return true;
+    }
+    QFile file(options.schemaScript);
+    if (!file.open(QIODevice::ReadOnly|QIODevice::Text)) {
+        qWarning() << "Can't read schema script " << options.schemaScript;
+        return false;
+    }
+    // Same substitutions as generate_iterative_creations.py:
+    // '%' is the database name, '?' is the first id
+    QString script = QString::fromUtf8(file.readAll());
+    QRegExp comment("/\\*.*\\*/");
+    comment.setMinimal(true);
+    script.remove(comment);
+    script.replace('%', options.dbName);
+    script.replace('?', QString::number(options.idOffset));
+    QStringList statements;
+    Q_FOREACH(const QString & statement, script.split(';', QString::SkipEmptyParts)) {
+        if (!statement.trimmed().isEmpty()) {
+            statements << statement.trimmed();
+        }
+    }
+    qDebug() << "Creating MySQL schema in " << options.dbName
+             << " with ids from " << options.idOffset;
+    return execAll(db, statements);
+}
+
+QString MySqlBackend::dropIndexStatement(const IndexDefinition &index) const
+{
+    return QString("ALTER TABLE %1 DROP INDEX %2").arg(index.table).arg(index.name);
+}
+
+QStringList MySqlBackend::createIndexStatements(const QList<IndexDefinition> &indexes) const
+{
+    // One ALTER per table, so InnoDB reads the table once for all its indexes
+    QStringList clauses;
+    Q_FOREACH(const IndexDefinition & index, indexes) {
+        clauses << QString("ADD INDEX %1(%2)").arg(index.name).arg(index.columns);
+    }
+    if (clauses.isEmpty()) {
+        return QStringList();
+    }
+    return QStringList() << QString("ALTER TABLE %1 %2")
+                            .arg(indexes.first().table).arg(clauses.join(", "));
+}
+
+QStringList MySqlBackend::organismPartitions(QSqlDatabase &db) const
+{
+    QStringList result;
+    QSqlQuery query("", db);
+    if (!query.exec("SELECT partition_name FROM information_schema.partitions"
+                    " WHERE table_schema=DATABASE() AND table_name='exons'"
+                    " AND partition_method='LIST'")) {
+        qWarning() << query.lastError();
+        return result;
+    }
+    while (query.next()) {
+        result << query.value(0).toString();
+    }
+    return result;
+}
+
+QStringList MySqlBackend::addPartitionStatements(qint32 organismId) const
+{
+    QStringList result;
+    Q_FOREACH(const QString & table, partitionedTables()) {
+        result << QString("ALTER TABLE %1 ADD PARTITION (PARTITION %2 VALUES IN (%3))")
+                  .arg(table).arg(partitionName(organismId)).arg(organismId);
+    }
+    return result;
+}
+
+QStringList MySqlBackend::truncatePartitionStatements(qint32 organismId) const
+{
+    QStringList result;
+    Q_FOREACH(const QString & table, partitionedTables()) {
+        result << QString("ALTER TABLE %1 TRUNCATE PARTITION %2")
+                  .arg(table).arg(partitionName(organismId));
+    }
+    return result;
+}
+
+QStringList MySqlBackend::bulkLoadSessionStatements(bool loading) const
+{
+    // Uniqueness is already guaranteed by dimension caches and the schema
+    // has no foreign keys to verify
+    const QString value = loading ? "0" : "1";
+    return QStringList()
+            << "SET SESSION unique_checks=" + value
+            << "SET SESSION foreign_key_checks=" + value;
+}
+
+
+QString SqliteBackend::name() const
+{
+    return "sqlite";
+}
+
+QString SqliteBackend::driverName() const
+{
+    return "QSQLITE";
+}
+
+void SqliteBackend::configure(QSqlDatabase &db, const DatabaseOptions &options) const
+{
+    // All workers share one file, so wait for the write lock instead of failing
+    db.setDatabaseName(options.dbName);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=600000");
+}
+
+void SqliteBackend::setupSession(QSqlDatabase &db) const
+{
+    execAll(db, QStringList()
+            << "PRAGMA journal_mode=WAL"
+            << "PRAGMA synchronous=OFF"
+            << "PRAGMA cache_size=-262144"  // in KiB, i.e. 256 MiB per connection
+            << "PRAGMA temp_store=MEMORY"
+            );
+}
+
+bool SqliteBackend::prepareSchema(QSqlDatabase &db, const DatabaseOptions &) const
+{
+    if (db.tables().contains("sequences")) {
+        return true;
+    }
+    qDebug() << "Creating SQLite schema in " << db.databaseName();
+    if (!db.transaction()) {
+        qWarning() << db.lastError();
+        return false;
+    }
+    const QStringList statements = schemaStatements();
+    const bool ok = !statements.isEmpty() && execAll(db, statements);
+    if (ok) {
+        db.commit();
+    }
+    else {
+        db.rollback();
+    }
+    return ok;
+}
+
+bool SqliteBackend::transactionPerSequence() const
+{
+    // Autocommit costs one WAL frame sync per row; one sequence is a natural batch
+    return true;
+}
+
+bool SqliteBackend::defersIndexes() const
+{
+    return true;
+}
+
+bool SqliteBackend::parallelIndexBuild() const
+{
+    // Single writer per database file
+    return false;
+}
+
+bool SqliteBackend::blobsInTextColumns() const
+{
+    // Column type is only an affinity, BLOB values are kept as they are
+    return true;
+}
+
+void SqliteBackend::finishBulkLoad(QSqlDatabase &db) const
+{
+    execAll(db, QStringList()
+            << "PRAGMA synchronous=NORMAL"
+            << "PRAGMA wal_checkpoint(TRUNCATE)"
+            << "ANALYZE"
+            );
+}
+
+QStringList SqliteBackend::schemaStatements() const
+{
+    // create_database_sqlite.sql, compiled in from schema.qrc
+    QFile file(":/create_database_sqlite.sql");
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Can't read built-in SQLite schema " << file.fileName();
+        return QStringList();
+    }
+    QString sql = QString::fromUtf8(file.readAll());
+    QRegExp comment("/\\*.*\\*/");
+    comment.setMinimal(true);
+    sql.remove(comment);
+    QStringList result;
+    Q_FOREACH(const QString & statement, sql.split(';')) {
+        if (!statement.trimmed().isEmpty()) {
+            result << statement.trimmed();
+        }
+    }
+    return result;
+}
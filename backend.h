@@ -0,0 +1,120 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <QList>
+#include <QSharedPointer>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+struct DatabaseOptions;
+
+// Secondary index of a big table. Such indexes can be dropped before
+// bulk load and built once all the files are loaded.
+struct IndexDefinition {
+    QString table;
+    QString name;
+    QString columns;
+    bool usedByLoader;  // needed to replace sequences in reload mode
+};
+
+// Storage backend: everything that differs between SQL servers
+// (driver, connection options, session tuning, schema bootstrap)
+// lives here, so Database itself speaks plain SQL only.
+class Backend
+{
+public:
+    static QSharedPointer<Backend> create(const QString & name);
+    virtual ~Backend() {}
+
+    virtual QString name() const = 0;
+    virtual QString driverName() const = 0;
+
+    // Set connection parameters before QSqlDatabase::open()
+    virtual void configure(QSqlDatabase & db, const DatabaseOptions & options) const = 0;
+
+    // Called once for every freshly opened connection
+    virtual void setupSession(QSqlDatabase & db) const;
+
+    // Create the database itself if the server has none with this name
+    virtual bool createDatabase(const DatabaseOptions & options) const;
+
+    // Create tables if the database is empty
+    virtual bool prepareSchema(QSqlDatabase & db, const DatabaseOptions & options) const;
+
+    // Wrap each sequence into explicit transaction
+    virtual bool transactionPerSequence() const;
+
+    // Relax (loading) or restore session checks of a writer connection
+    virtual QStringList bulkLoadSessionStatements(bool loading) const;
+
+    // Called once after all the files are loaded
+    virtual void finishBulkLoad(QSqlDatabase & db) const;
+
+    static QList<IndexDefinition> secondaryIndexes();
+    virtual QString dropIndexStatement(const IndexDefinition & index) const;
+    // All the indexes belong to the same table
+    virtual QStringList createIndexStatements(const QList<IndexDefinition> & indexes) const;
+    // Build secondary indexes after bulk load even without --defer-indexes
+    virtual bool defersIndexes() const;
+    // Tables can be indexed concurrently by separate connections
+    virtual bool parallelIndexBuild() const;
+
+    // Binary values can be stored in TEXT columns as they are
+    virtual bool blobsInTextColumns() const;
+
+    // Big tables partitioned by id_organisms, one partition per organism,
+    // see create_database_partitioned.sql
+    static QStringList partitionedTables();
+    // Partition names of the partitioned tables, empty if not partitioned
+    virtual QStringList organismPartitions(QSqlDatabase & db) const;
+    static QString partitionName(qint32 organismId);
+    virtual QStringList addPartitionStatements(qint32 organismId) const;
+    virtual QStringList truncatePartitionStatements(qint32 organismId) const;
+
+protected:
+    static bool execAll(QSqlDatabase & db, const QStringList & statements);
+};
+
+
+class MySqlBackend
+        : public Backend
+{
+public:
+    QString name() const override;
+    QString driverName() const override;
+    void configure(QSqlDatabase & db, const DatabaseOptions & options) const override;
+    QStringList bulkLoadSessionStatements(bool loading) const override;
+    bool createDatabase(const DatabaseOptions & options) const override;
+    bool prepareSchema(QSqlDatabase & db, const DatabaseOptions & options) const override;
+    QString dropIndexStatement(const IndexDefinition & index) const override;
+    QStringList createIndexStatements(const QList<IndexDefinition> & indexes) const override;
+    QStringList organismPartitions(QSqlDatabase & db) const override;
+    QStringList addPartitionStatements(qint32 organismId) const override;
+    QStringList truncatePartitionStatements(qint32 organismId) const override;
+};
+
+
+// Single file database for workstations and CI runs.
+// Tuned for bulk writes: WAL journal, no fsync during load, large page cache,
+// big tables indexes are created only when load is finished.
+class SqliteBackend
+        : public Backend
+{
+public:
+    QString name() const override;
+    QString driverName() const override;
+    void configure(QSqlDatabase & db, const DatabaseOptions & options) const override;
+    void setupSession(QSqlDatabase & db) const override;
+    bool prepareSchema(QSqlDatabase & db, const DatabaseOptions & options) const override;
+    bool transactionPerSequence() const override;
+    void finishBulkLoad(QSqlDatabase & db) const override;
+    bool defersIndexes() const override;
+    bool parallelIndexBuild() const override;
+    bool blobsInTextColumns() const override;
+
+private:
+    QStringList schemaStatements() const;
+};
+
+#endif // BACKEND_H
@@ -0,0 +1,245 @@
+#include "connectionpool.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+
+QMutex ConnectionPool::_poolsMutex;
+QMap<QString, QSharedPointer<ConnectionPool> > ConnectionPool::_pools;
+QAtomicInt ConnectionPool::_connectionsCreated;
+
+namespace {
+
+class Sleeper
+        : public QThread
+{
+public:
+    static void msleep(unsigned long msecs) { QThread::msleep(msecs); }
+};
+
+}
+
+QSharedPointer<ConnectionPool> ConnectionPool::forOptions(const DatabaseOptions &options)
+{
+    const QString key = options.targetKey();
+    QMutexLocker lock(&_poolsMutex);
+    if (!_pools.contains(key)) {
+        QSharedPointer<Backend> backend = Backend::create(options.backend);
+        if (!backend) {
+            qWarning() << "Unknown database backend " << options.backend;
+            return QSharedPointer<ConnectionPool>();
+        }
+        _pools[key] = QSharedPointer<ConnectionPool>(new ConnectionPool(options, backend));
+    }
+    return _pools[key];
+}
+
+void ConnectionPool::closeAll()
+{
+    QMutexLocker lock(&_poolsMutex);
+    Q_FOREACH(QSharedPointer<ConnectionPool> pool, _pools) {
+        pool->closeIdle();
+    }
+}
+
+QString ConnectionPool::totalReport()
+{
+    QMutexLocker lock(&_poolsMutex);
+    QStringList result;
+    Q_FOREACH(QSharedPointer<ConnectionPool> pool, _pools) {
+        result << pool->report();
+    }
+    return result.join("\n");
+}
+
+ConnectionPool::ConnectionPool(const DatabaseOptions &options, QSharedPointer<Backend> backend)
+    : _options(options)
+    , _backend(backend)
+    , _maxSize(qMax(1, options.poolSize))
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    closeIdle();
+}
+
+QSharedPointer<Backend> ConnectionPool::backend() const
+{
+    return _backend;
+}
+
+PooledConnection * ConnectionPool::acquire()
+{
+    QElapsedTimer timer;
+    timer.start();
+    PooledConnection * connection = nullptr;
+
+    const Qt::HANDLE thread = QThread::currentThreadId();
+    bool foreign = false;
+    QMutexLocker lock(&_mutex);
+    Q_FOREVER {
+        for (int i=_idle.size()-1; i>=0 && !connection; --i) {
+            if (_idle[i]->thread == thread) {
+                connection = _idle.takeAt(i);
+            }
+        }
+        if (connection) {
+            break;
+        }
+        if (_all.size() < _maxSize) {
+            connection = new PooledConnection;
+            _all.append(connection);
+            foreign = true;
+            break;
+        }
+        if (!_idle.isEmpty()) {
+            // Created by another thread, e.g. main thread at startup
+            connection = _idle.takeLast();
+            foreign = true;
+            break;
+        }
+        _released.wait(&_mutex);
+    }
+    lock.unlock();
+
+    if (foreign) {
+        create(connection);
+    }
+
+    // Health check and reconnect outside the pool lock
+    bool ok = healthy(connection);
+    const bool lost = !ok && connection->db.isOpen();
+    if (lost) {
+        qWarning() << "Connection " << connection->db.connectionName() << " lost, reconnecting";
+    }
+    for (int attempt = 0; !ok && attempt < ReconnectAttempts; ++attempt) {
+        if (attempt > 0) {
+            Sleeper::msleep(ReconnectBaseMsecs << (attempt - 1));
+        }
+        close(connection);
+        ok = open(connection);
+    }
+
+    const qint64 elapsed = timer.nsecsElapsed();
+    lock.relock();
+    _stats.checkouts ++;
+    _stats.waitNsecs += elapsed;
+    _stats.maxWaitNsecs = qMax(_stats.maxWaitNsecs, elapsed);
+    if (lost) {
+        _stats.reconnects ++;
+    }
+    if (!ok) {
+        _stats.failures ++;
+        _idle.append(connection);
+        _released.wakeOne();
+        return nullptr;
+    }
+    return connection;
+}
+
+void ConnectionPool::release(PooledConnection *connection)
+{
+    if (!connection) {
+        return;
+    }
+    QMutexLocker lock(&_mutex);
+    _idle.append(connection);
+    _released.wakeOne();
+}
+
+void ConnectionPool::create(PooledConnection *connection)
+{
+    if (connection->statements) {
+        close(connection);
+        const QString name = connection->db.connectionName();
+        connection->db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
+    }
+    connection->db = QSqlDatabase::addDatabase(
+                _backend->driverName(),
+                QString("introns_db_fill_pid%1_conn%2")
+                .arg(qApp->applicationPid())
+                .arg(_connectionsCreated.fetchAndAddOrdered(1) + 1)
+                );
+    _backend->configure(connection->db, _options);
+    connection->statements = QSharedPointer<StatementCache>(new StatementCache(&connection->db));
+    connection->thread = QThread::currentThreadId();
+}
+
+bool ConnectionPool::open(PooledConnection *connection)
+{
+    if (!connection->db.open()) {
+        qWarning() << connection->db.lastError();
+        return false;
+    }
+    _backend->setupSession(connection->db);
+    QSqlQuery query("", connection->db);
+    Q_FOREACH(const QString & sql, _options.sessionStatements) {
+        if (!query.exec(sql)) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastQuery();
+        }
+    }
+    QMutexLocker lock(&_mutex);
+    if (0 == _stats.opened++) {
+        qDebug() << "Connected to " << _backend->name() << " database " << connection->db.databaseName();
+    }
+    return true;
+}
+
+bool ConnectionPool::healthy(PooledConnection *connection) const
+{
+    if (!connection->db.isOpen()) {
+        return false;
+    }
+    QSqlQuery query("", connection->db);
+    return query.exec("SELECT 1");
+}
+
+void ConnectionPool::close(PooledConnection *connection)
+{
+    // Prepared statements do not survive reconnection
+    connection->statements->clear();
+    if (connection->db.isOpen()) {
+        connection->db.close();
+    }
+}
+
+void ConnectionPool::closeIdle()
+{
+    QMutexLocker lock(&_mutex);
+    Q_FOREACH(PooledConnection * connection, _idle) {
+        close(connection);
+        const QString name = connection->db.connectionName();
+        _all.removeOne(connection);
+        delete connection;
+        QSqlDatabase::removeDatabase(name);
+    }
+    _idle.clear();
+}
+
+ConnectionPool::Stats ConnectionPool::stats() const
+{
+    QMutexLocker lock(&_mutex);
+    return _stats;
+}
+
+QString ConnectionPool::report() const
+{
+    const Stats s = stats();
+    return QString("Connection pool %1/%2: %3 checkouts, latency avg %4 ms / max %5 ms, "
+                   "%6 opened, %7 reconnects, %8 failures")
+            .arg(_backend->name())
+            .arg(_options.dbName)
+            .arg(s.checkouts)
+            .arg(s.checkouts ? double(s.waitNsecs) / s.checkouts / 1000000 : 0.0, 0, 'f', 2)
+            .arg(s.maxWaitNsecs / 1000000)
+            .arg(s.opened)
+            .arg(s.reconnects)
+            .arg(s.failures);
+}
@@ -0,0 +1,88 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include "backend.h"
+#include "database.h"
+#include "statementcache.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QSqlDatabase>
+#include <QString>
+#include <QWaitCondition>
+
+// Open connection together with its prepared statements.
+// Used by one thread at a time, between acquire() and release().
+struct PooledConnection {
+    QSqlDatabase db;
+    QSharedPointer<StatementCache> statements;
+    Qt::HANDLE thread = nullptr;  // that added db, the only one allowed to use it
+};
+
+// Fixed size pool of connections to one database. Connections stay open
+// between files, are checked with a trivial query on every checkout and
+// reopened with exponential backoff when the server has dropped them.
+// Qt connections belong to the thread that created them: a thread gets
+// back its own idle connection, another one's is created anew for it.
+class ConnectionPool
+{
+public:
+    struct Stats {
+        quint64 checkouts = 0;
+        qint64 waitNsecs = 0;  // checkout latency including health checks
+        qint64 maxWaitNsecs = 0;
+        quint64 opened = 0;
+        quint64 reconnects = 0;
+        quint64 failures = 0;
+    };
+
+    // Pool shared by all the Database objects with the same target
+    static QSharedPointer<ConnectionPool> forOptions(const DatabaseOptions & options);
+
+    // Close every connection of every pool, called once at exit
+    static void closeAll();
+    static QString totalReport();
+
+    ConnectionPool(const DatabaseOptions & options, QSharedPointer<Backend> backend);
+    ~ConnectionPool();
+
+    QSharedPointer<Backend> backend() const;
+
+    // Blocks while all the connections are in use. Returns nullptr if
+    // connection can't be opened.
+    PooledConnection * acquire();
+    void release(PooledConnection * connection);
+
+    Stats stats() const;
+    QString report() const;
+
+private:
+    Q_DISABLE_COPY(ConnectionPool)
+
+    enum { ReconnectAttempts = 5, ReconnectBaseMsecs = 200 };
+
+    void create(PooledConnection * connection);
+    bool open(PooledConnection * connection);
+    bool healthy(PooledConnection * connection) const;
+    void close(PooledConnection * connection);
+    void closeIdle();
+
+    static QMutex _poolsMutex;
+    static QMap<QString, QSharedPointer<ConnectionPool> > _pools;
+    static QAtomicInt _connectionsCreated;
+
+    const DatabaseOptions _options;
+    const QSharedPointer<Backend> _backend;
+    const int _maxSize;
+
+    mutable QMutex _mutex;
+    QWaitCondition _released;
+    QList<PooledConnection*> _idle;
+    QList<PooledConnection*> _all;
+    Stats _stats;
+};
+
+#endif // CONNECTIONPOOL_H
@@ -4,6 +4,7 @@ DROP TABLE IF EXISTS exons;
 DROP TABLE IF EXISTS real_exons;
 DROP TABLE IF EXISTS isoforms;
 DROP TABLE IF EXISTS orphaned_cdses;
+DROP TABLE IF EXISTS input_manifest;
 DROP TABLE IF EXISTS genes;
 DROP TABLE IF EXISTS sequences;
 DROP TABLE IF EXISTS organisms;
@@ -143,6 +144,16 @@ CREATE TABLE sequences(
 );
 
 
+CREATE TABLE input_manifest(
+    file_name VARCHAR(700) NOT NULL PRIMARY KEY,
+    file_size BIGINT NOT NULL,
+    file_modified BIGINT NOT NULL,
+    content_hash CHAR(40) NOT NULL,
+    sequences_count INT NOT NULL DEFAULT 0,
+    last_gbk_date DATE
+);
+
+
 CREATE TABLE orphaned_cdses(
     id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
     source_file_name VARCHAR(50),
@@ -169,7 +180,8 @@ CREATE TABLE genes(
     endd INT,
     start_code INT,
     end_code INT,
-    max_introns_count INT DEFAULT 0
+    max_introns_count INT DEFAULT 0,
+    fingerprint CHAR(40)
 );
 
 
@@ -270,6 +282,25 @@ create TABLE introns(
     origin LONGTEXT
 );
 
+/* INDEXES used by lookups, sequence replacement in reload mode and
+   downstream queries. Names must match Backend::secondaryIndexes() */
+
+CREATE INDEX organisms_name ON organisms(name);
+CREATE INDEX chromosomes_organism_name ON chromosomes(id_organisms, name);
+CREATE INDEX sequences_organism_refseq ON sequences(id_organisms, refseq_id);
+CREATE INDEX genes_sequence ON genes(id_sequences);
+CREATE INDEX genes_organism ON genes(id_organisms);
+CREATE INDEX isoforms_gene ON isoforms(id_genes);
+CREATE INDEX isoforms_sequence ON isoforms(id_sequences);
+CREATE INDEX real_exons_gene ON real_exons(id_genes);
+CREATE INDEX real_exons_sequence ON real_exons(id_sequences);
+CREATE INDEX exons_isoform ON exons(id_isoforms);
+CREATE INDEX exons_gene ON exons(id_genes);
+CREATE INDEX exons_sequence ON exons(id_sequences);
+CREATE INDEX introns_isoform ON introns(id_isoforms);
+CREATE INDEX introns_gene ON introns(id_genes);
+CREATE INDEX introns_sequence ON introns(id_sequences);
+
 ALTER TABLE  introns AUTO_INCREMENT = 1;
 ALTER TABLE  exons AUTO_INCREMENT = 1;
 ALTER TABLE  real_exons AUTO_INCREMENT = 1;
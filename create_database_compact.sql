@@ -0,0 +1,344 @@
+/* Variant of create_database.sql with right-sized exons and introns rows:
+   small integer types for phases, indexes and intron types, ASCII codons,
+   dinucleotides and origins, boolean columns packed into one flags byte.
+   id_genes is not repeated in exons and introns, it is isoforms.id_genes.
+   introns_db_fill detects this schema by exons.flags column. */
+
+USE test
+DROP VIEW IF EXISTS introns_full;
+DROP VIEW IF EXISTS exons_full;
+DROP TABLE IF EXISTS introns;
+DROP TABLE IF EXISTS exons;
+DROP TABLE IF EXISTS real_exons;
+DROP TABLE IF EXISTS isoforms;
+DROP TABLE IF EXISTS orphaned_cdses;
+DROP TABLE IF EXISTS input_manifest;
+DROP TABLE IF EXISTS genes;
+DROP TABLE IF EXISTS sequences;
+DROP TABLE IF EXISTS organisms;
+DROP TABLE IF EXISTS chromosomes;
+DROP TABLE IF EXISTS intron_types;
+DROP TABLE IF EXISTS tax_groups2;
+DROP TABLE IF EXISTS tax_groups1;
+DROP TABLE IF EXISTS tax_kingdoms;
+DROP TABLE IF EXISTS orthologous_groups;
+
+
+/* STATIC TABLE intron_types */
+CREATE TABLE intron_types(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    representation VARCHAR(5) NOT NULL UNIQUE
+);
+
+/* GROUP 0 */
+INSERT INTO intron_types(representation) VALUES ('00#00');
+INSERT INTO intron_types(representation) VALUES ('00#01');
+INSERT INTO intron_types(representation) VALUES ('00#02');
+
+INSERT INTO intron_types(representation) VALUES ('01#10');
+INSERT INTO intron_types(representation) VALUES ('01#11');
+INSERT INTO intron_types(representation) VALUES ('01#12');
+
+INSERT INTO intron_types(representation) VALUES ('02#20');
+INSERT INTO intron_types(representation) VALUES ('02#21');
+INSERT INTO intron_types(representation) VALUES ('02#22');
+
+/* GROUP 1 */
+INSERT INTO intron_types(representation) VALUES ('10#00');
+INSERT INTO intron_types(representation) VALUES ('10#01');
+INSERT INTO intron_types(representation) VALUES ('10#02');
+
+INSERT INTO intron_types(representation) VALUES ('11#10');
+INSERT INTO intron_types(representation) VALUES ('11#11');
+INSERT INTO intron_types(representation) VALUES ('11#12');
+
+INSERT INTO intron_types(representation) VALUES ('12#20');
+INSERT INTO intron_types(representation) VALUES ('12#21');
+INSERT INTO intron_types(representation) VALUES ('12#22');
+
+/* GROUP 2 */
+INSERT INTO intron_types(representation) VALUES ('20#00');
+INSERT INTO intron_types(representation) VALUES ('20#01');
+INSERT INTO intron_types(representation) VALUES ('20#02');
+
+INSERT INTO intron_types(representation) VALUES ('21#10');
+INSERT INTO intron_types(representation) VALUES ('21#11');
+INSERT INTO intron_types(representation) VALUES ('21#12');
+
+INSERT INTO intron_types(representation) VALUES ('22#20');
+INSERT INTO intron_types(representation) VALUES ('22#21');
+INSERT INTO intron_types(representation) VALUES ('22#22');
+
+
+/* SUPPLEMENTARY TABLES */
+
+CREATE TABLE tax_kingdoms(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    name VARCHAR(30) UNIQUE NOT NULL
+);
+
+CREATE TABLE tax_groups1(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_tax_kingdoms INT NOT NULL,
+    name VARCHAR(30) UNIQUE NOT NULL,
+    typee VARCHAR(500)
+);
+
+CREATE TABLE tax_groups2(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_tax_groups1 INT NOT NULL,
+    id_tax_kingdoms INT NOT NULL,
+    name VARCHAR(30) UNIQUE NOT NULL,
+    typee VARCHAR(500)
+);
+
+/* OTHER TABLES */
+
+CREATE TABLE orthologous_groups(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    name VARCHAR(30),
+    fullName VARCHAR(100)
+);
+
+
+/* SPECIES TABLES */
+
+CREATE TABLE organisms(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    name VARCHAR(200) NOT NULL,
+    common_name VARCHAR(200) NOT NULL DEFAULT "xx",
+    ref_seq_assembly_id VARCHAR(20),
+    annotation_release VARCHAR(200),
+    annotation_date DATE,
+    taxonomy_xref VARCHAR(50),
+    taxonomy_list VARCHAR(500),
+    id_tax_groups2 INT,
+    real_chromosome_count INT DEFAULT 0,
+    db_chromosome_count INT DEFAULT 0,
+    real_mitochondria BOOLEAN DEFAULT 0,
+    db_mitochondria BOOLEAN DEFAULT 0,
+    unknown_sequences_count INT DEFAULT 0,
+    total_sequences_length BIGINT DEFAULT 0,
+    b_genes_count INT DEFAULT 0,
+    r_genes_count INT DEFAULT 0,
+    cds_count INT DEFAULT 0,
+    rna_count INT DEFAULT 0,
+    unknown_prot_genes_count INT DEFAULT 0,
+    unknown_prot_cds_count INT DEFAULT 0,
+    exons_count INT DEFAULT 0,
+    introns_count INT DEFAULT 0
+);
+
+CREATE TABLE chromosomes(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    name VARCHAR(50),
+    lengthh int
+);
+
+/* GENES TABLES */
+
+CREATE TABLE sequences(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    source_file_name VARCHAR(50),
+    refseq_id VARCHAR(20),
+    version VARCHAR(50),
+    description TEXT,
+    lengthh INT NOT NULL DEFAULT 0,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT,
+    origin_file_name VARCHAR(100),
+    gbk_date DATE
+);
+
+
+CREATE TABLE input_manifest(
+    file_name VARCHAR(700) NOT NULL PRIMARY KEY,
+    file_size BIGINT NOT NULL,
+    file_modified BIGINT NOT NULL,
+    content_hash CHAR(40) NOT NULL,
+    sequences_count INT NOT NULL DEFAULT 0,
+    last_gbk_date DATE
+);
+
+
+CREATE TABLE orphaned_cdses(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    source_file_name VARCHAR(50),
+    source_line_start INT NOT NULL,
+    source_line_end INT NOT NULL,
+    refseq_id VARCHAR(100) NOT NULL,
+    ncbi_gi VARCHAR(200),
+    product VARCHAR(200)
+    /* CONSTRAINT unique_orphaned_cdses UNIQUE(source_file_name,source_line_start,source_line_end) */
+);
+
+
+CREATE TABLE genes(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_sequences INT NOT NULL,
+    id_orthologous_groups INT,
+    name VARCHAR(40),
+    ncbi_gene_id VARCHAR(100),
+    backward_chain BOOLEAN DEFAULT 0,
+    protein_but_not_rna BOOLEAN,
+    pseudo_gene BOOLEAN,
+    startt INT,
+    endd INT,
+    start_code INT,
+    end_code INT,
+    max_introns_count INT DEFAULT 0,
+    fingerprint CHAR(40)
+);
+
+
+create TABLE isoforms(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    ncbi_gi VARCHAR(100),
+    protein_id VARCHAR(100),
+    product VARCHAR(250),
+    note TEXT,
+    cds_start INT,
+    cds_end INT,
+    mrna_start INT,
+    mrna_end INT,
+    mrna_length INT,
+    exons_cds_count INT DEFAULT 0,
+    exons_mrna_count INT DEFAULT 0,
+    exons_length INT,
+    start_codon VARCHAR(3),
+    end_codon VARCHAR(3),
+    maximum_by_introns BOOLEAN,
+    has_no_exons BOOLEAN,
+
+    error_in_length BOOLEAN NOT NULL DEFAULT 0,
+    warning_in_intron BOOLEAN NOT NULL DEFAULT 0,
+    warning_in_coding_exon BOOLEAN NOT NULL DEFAULT 0,
+    error_main BOOLEAN NOT NULL DEFAULT 0,
+    error_comment TEXT
+);
+
+create TABLE exons(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_sequences INT NOT NULL,
+    real_exon_id INT NOT NULL,
+
+    startt INT UNSIGNED NOT NULL,
+    endd INT UNSIGNED NOT NULL,
+    lengthh INT UNSIGNED,
+    typee TINYINT UNSIGNED NOT NULL DEFAULT 4 /* = Unknown */,
+    start_phase TINYINT,
+    end_phase TINYINT,
+    length_phase TINYINT,
+    indexx SMALLINT UNSIGNED,
+    rev_index SMALLINT UNSIGNED,
+    start_codon CHAR(3) CHARACTER SET ascii,
+    end_codon CHAR(3) CHARACTER SET ascii,
+
+    prev_intron INT DEFAULT 0,
+    next_intron INT DEFAULT 0,
+
+    /* 1 = from_main_isoform, 2 = error_in_isoform, 4 = warning_n_in_sequence */
+    flags TINYINT UNSIGNED NOT NULL DEFAULT 0,
+    origin TEXT CHARACTER SET ascii
+);
+
+create TABLE real_exons(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    
+    startt INT NOT NULL,
+    endd INT NOT NULL
+);
+
+create TABLE introns(
+    id INT NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_sequences INT NOT NULL,
+
+    prev_exon INT NOT NULL,
+    next_exon INT NOT NULL,
+    id_intron_types TINYINT UNSIGNED,
+
+    start_dinucleotide CHAR(2) CHARACTER SET ascii,
+    end_dinucleotide CHAR(2) CHARACTER SET ascii,
+
+    startt INT UNSIGNED NOT NULL,
+    endd INT UNSIGNED NOT NULL,
+    lengthh INT,
+    indexx SMALLINT UNSIGNED,
+    rev_index SMALLINT UNSIGNED,
+    length_phase TINYINT,
+    phase TINYINT,
+
+    /* 1 = from_main_isoform, 2 = warning_start_dinucleotide,
+       4 = warning_end_dinucleotide, 8 = error_main, 16 = error_in_isoform,
+       32 = warning_n_in_sequence */
+    flags TINYINT UNSIGNED NOT NULL DEFAULT 0,
+    origin LONGTEXT CHARACTER SET ascii
+);
+
+/* INDEXES used by lookups, sequence replacement in reload mode and
+   downstream queries. Names must match Backend::secondaryIndexes() */
+
+CREATE INDEX organisms_name ON organisms(name);
+CREATE INDEX chromosomes_organism_name ON chromosomes(id_organisms, name);
+CREATE INDEX sequences_organism_refseq ON sequences(id_organisms, refseq_id);
+CREATE INDEX genes_sequence ON genes(id_sequences);
+CREATE INDEX genes_organism ON genes(id_organisms);
+CREATE INDEX isoforms_gene ON isoforms(id_genes);
+CREATE INDEX isoforms_sequence ON isoforms(id_sequences);
+CREATE INDEX real_exons_gene ON real_exons(id_genes);
+CREATE INDEX real_exons_sequence ON real_exons(id_sequences);
+CREATE INDEX exons_isoform ON exons(id_isoforms);
+CREATE INDEX exons_sequence ON exons(id_sequences);
+CREATE INDEX introns_isoform ON introns(id_isoforms);
+CREATE INDEX introns_sequence ON introns(id_sequences);
+
+/* VIEWS with the columns of create_database.sql, for queries written
+   against the plain schema */
+
+CREATE VIEW exons_full AS SELECT
+    e.id, e.id_isoforms, i.id_genes, e.id_sequences, e.real_exon_id,
+    e.startt, e.endd, e.lengthh, e.typee,
+    e.start_phase, e.end_phase, e.length_phase, e.indexx, e.rev_index,
+    e.start_codon, e.end_codon, e.prev_intron, e.next_intron,
+    (e.flags & 1) <> 0 AS from_main_isoform,
+    (e.flags & 2) <> 0 AS error_in_isoform,
+    (e.flags & 4) <> 0 AS warning_n_in_sequence,
+    e.origin
+FROM exons e JOIN isoforms i ON i.id = e.id_isoforms;
+
+CREATE VIEW introns_full AS SELECT
+    n.id, n.id_isoforms, i.id_genes, n.id_sequences,
+    n.prev_exon, n.next_exon, n.id_intron_types,
+    n.start_dinucleotide, n.end_dinucleotide,
+    n.startt, n.endd, n.lengthh, n.indexx, n.rev_index,
+    n.length_phase, n.phase,
+    (n.flags & 1) <> 0 AS from_main_isoform,
+    (n.flags & 2) <> 0 AS warning_start_dinucleotide,
+    (n.flags & 4) <> 0 AS warning_end_dinucleotide,
+    (n.flags & 8) <> 0 AS error_main,
+    (n.flags & 16) <> 0 AS error_in_isoform,
+    (n.flags & 32) <> 0 AS warning_n_in_sequence,
+    n.origin
+FROM introns n JOIN isoforms i ON i.id = n.id_isoforms;
+
+ALTER TABLE  introns AUTO_INCREMENT = 1;
+ALTER TABLE  exons AUTO_INCREMENT = 1;
+ALTER TABLE  real_exons AUTO_INCREMENT = 1;
+ALTER TABLE  isoforms AUTO_INCREMENT = 1;
+ALTER TABLE  genes AUTO_INCREMENT = 1;
+ALTER TABLE  sequences AUTO_INCREMENT = 1;
+ALTER TABLE  organisms AUTO_INCREMENT = 1;
+ALTER TABLE  chromosomes AUTO_INCREMENT = 1;
+ALTER TABLE  intron_types AUTO_INCREMENT = 1;
+ALTER TABLE  tax_groups2 AUTO_INCREMENT = 1;
+ALTER TABLE  tax_groups1 AUTO_INCREMENT = 1;
+ALTER TABLE  tax_kingdoms AUTO_INCREMENT = 1;
+ALTER TABLE  orthologous_groups AUTO_INCREMENT = 1;
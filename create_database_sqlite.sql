@@ -0,0 +1,252 @@
+/* SQLite dialect of create_database.sql, used by --backend=sqlite to
+   create the schema of an empty database. Keep both files in sync:
+   AUTO_INCREMENT keys are INTEGER PRIMARY KEY here, there are no engine
+   or partition clauses, indexes are separate statements. */
+
+/* STATIC TABLE intron_types */
+CREATE TABLE intron_types(
+    id INTEGER PRIMARY KEY,
+    representation VARCHAR(5) NOT NULL UNIQUE
+);
+
+/* GROUP 0 */
+INSERT INTO intron_types(representation) VALUES ('00#00');
+INSERT INTO intron_types(representation) VALUES ('00#01');
+INSERT INTO intron_types(representation) VALUES ('00#02');
+
+INSERT INTO intron_types(representation) VALUES ('01#10');
+INSERT INTO intron_types(representation) VALUES ('01#11');
+INSERT INTO intron_types(representation) VALUES ('01#12');
+
+INSERT INTO intron_types(representation) VALUES ('02#20');
+INSERT INTO intron_types(representation) VALUES ('02#21');
+INSERT INTO intron_types(representation) VALUES ('02#22');
+
+/* GROUP 1 */
+INSERT INTO intron_types(representation) VALUES ('10#00');
+INSERT INTO intron_types(representation) VALUES ('10#01');
+INSERT INTO intron_types(representation) VALUES ('10#02');
+
+INSERT INTO intron_types(representation) VALUES ('11#10');
+INSERT INTO intron_types(representation) VALUES ('11#11');
+INSERT INTO intron_types(representation) VALUES ('11#12');
+
+INSERT INTO intron_types(representation) VALUES ('12#20');
+INSERT INTO intron_types(representation) VALUES ('12#21');
+INSERT INTO intron_types(representation) VALUES ('12#22');
+
+/* GROUP 2 */
+INSERT INTO intron_types(representation) VALUES ('20#00');
+INSERT INTO intron_types(representation) VALUES ('20#01');
+INSERT INTO intron_types(representation) VALUES ('20#02');
+
+INSERT INTO intron_types(representation) VALUES ('21#10');
+INSERT INTO intron_types(representation) VALUES ('21#11');
+INSERT INTO intron_types(representation) VALUES ('21#12');
+
+INSERT INTO intron_types(representation) VALUES ('22#20');
+INSERT INTO intron_types(representation) VALUES ('22#21');
+INSERT INTO intron_types(representation) VALUES ('22#22');
+
+CREATE TABLE tax_kingdoms(
+    id INTEGER PRIMARY KEY,
+    name VARCHAR(30) UNIQUE NOT NULL
+);
+
+CREATE TABLE tax_groups1(
+    id INTEGER PRIMARY KEY,
+    id_tax_kingdoms INT NOT NULL,
+    name VARCHAR(30) UNIQUE NOT NULL,
+    typee VARCHAR(500)
+);
+
+CREATE TABLE tax_groups2(
+    id INTEGER PRIMARY KEY, id_tax_groups1 INT NOT NULL,
+    id_tax_kingdoms INT NOT NULL,
+    name VARCHAR(30) UNIQUE NOT NULL,
+    typee VARCHAR(500)
+);
+
+CREATE TABLE orthologous_groups(
+    id INTEGER PRIMARY KEY,
+    name VARCHAR(30),
+    fullName VARCHAR(100)
+);
+
+CREATE TABLE organisms(
+    id INTEGER PRIMARY KEY,
+    name VARCHAR(200) NOT NULL,
+    common_name VARCHAR(200) NOT NULL DEFAULT 'xx',
+    ref_seq_assembly_id VARCHAR(20),
+    annotation_release VARCHAR(200),
+    annotation_date DATE,
+    taxonomy_xref VARCHAR(50),
+    taxonomy_list VARCHAR(500), id_tax_groups2 INT,
+    real_chromosome_count INT DEFAULT 0,
+    db_chromosome_count INT DEFAULT 0,
+    real_mitochondria BOOLEAN DEFAULT 0,
+    db_mitochondria BOOLEAN DEFAULT 0,
+    unknown_sequences_count INT DEFAULT 0,
+    total_sequences_length BIGINT DEFAULT 0,
+    b_genes_count INT DEFAULT 0,
+    r_genes_count INT DEFAULT 0,
+    cds_count INT DEFAULT 0,
+    rna_count INT DEFAULT 0,
+    unknown_prot_genes_count INT DEFAULT 0,
+    unknown_prot_cds_count INT DEFAULT 0,
+    exons_count INT DEFAULT 0,
+    introns_count INT DEFAULT 0
+);
+
+CREATE TABLE chromosomes(
+    id INTEGER PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    name VARCHAR(50),
+    lengthh INT
+);
+
+CREATE TABLE sequences(
+    id INTEGER PRIMARY KEY,
+    source_file_name VARCHAR(50),
+    refseq_id VARCHAR(20),
+    version VARCHAR(50),
+    description TEXT,
+    lengthh INT NOT NULL DEFAULT 0,
+    id_organisms INT NOT NULL,
+    id_chromosomes INT,
+    origin_file_name VARCHAR(100),
+    gbk_date DATE
+);
+
+CREATE TABLE orphaned_cdses(
+    id INTEGER PRIMARY KEY,
+    source_file_name VARCHAR(50),
+    source_line_start INT NOT NULL,
+    source_line_end INT NOT NULL,
+    refseq_id VARCHAR(100) NOT NULL,
+    ncbi_gi VARCHAR(200),
+    product VARCHAR(200)
+);
+
+CREATE TABLE genes(
+    id INTEGER PRIMARY KEY,
+    id_organisms INT NOT NULL,
+    id_sequences INT NOT NULL,
+    id_orthologous_groups INT,
+    name VARCHAR(40),
+    ncbi_gene_id VARCHAR(100),
+    backward_chain BOOLEAN DEFAULT 0,
+    protein_but_not_rna BOOLEAN,
+    pseudo_gene BOOLEAN,
+    startt INT,
+    endd INT,
+    start_code INT,
+    end_code INT,
+    max_introns_count INT DEFAULT 0,
+    fingerprint CHAR(40)
+);
+
+CREATE TABLE isoforms(
+    id INTEGER PRIMARY KEY,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    ncbi_gi VARCHAR(100),
+    protein_id VARCHAR(100),
+    product VARCHAR(250),
+    note TEXT,
+    cds_start INT,
+    cds_end INT,
+    mrna_start INT,
+    mrna_end INT,
+    mrna_length INT,
+    exons_cds_count INT DEFAULT 0,
+    exons_mrna_count INT DEFAULT 0,
+    exons_length INT,
+    start_codon VARCHAR(3),
+    end_codon VARCHAR(3),
+    maximum_by_introns BOOLEAN,
+    has_no_exons BOOLEAN,
+    error_in_length BOOLEAN NOT NULL DEFAULT 0,
+    warning_in_intron BOOLEAN NOT NULL DEFAULT 0,
+    warning_in_coding_exon BOOLEAN NOT NULL DEFAULT 0,
+    error_main BOOLEAN NOT NULL DEFAULT 0,
+    error_comment TEXT
+);
+
+CREATE TABLE exons(
+    id INTEGER PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    real_exon_id INT NOT NULL,
+    startt INT NOT NULL,
+    endd INT NOT NULL,
+    lengthh INT,
+    typee SMALLINT NOT NULL DEFAULT 4,
+    start_phase SMALLINT,
+    end_phase SMALLINT,
+    length_phase SMALLINT,
+    indexx INT,
+    rev_index INT,
+    start_codon VARCHAR(3),
+    end_codon VARCHAR(3),
+    prev_intron INT DEFAULT 0,
+    next_intron INT DEFAULT 0,
+    from_main_isoform BOOLEAN NOT NULL DEFAULT 0,
+    error_in_isoform BOOLEAN NOT NULL DEFAULT 0,
+    warning_n_in_sequence BOOLEAN NOT NULL DEFAULT 0,
+    origin TEXT
+);
+
+CREATE TABLE real_exons(
+    id INTEGER PRIMARY KEY,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    startt INT NOT NULL,
+    endd INT NOT NULL
+);
+
+CREATE TABLE introns(
+    id INTEGER PRIMARY KEY,
+    id_isoforms INT NOT NULL,
+    id_genes INT NOT NULL,
+    id_sequences INT NOT NULL,
+    prev_exon INT NOT NULL,
+    next_exon INT NOT NULL,
+    id_intron_types INT,
+    start_dinucleotide VARCHAR(2),
+    end_dinucleotide VARCHAR(2),
+    startt INT NOT NULL,
+    endd INT NOT NULL,
+    lengthh INT,
+    indexx INT,
+    rev_index INT,
+    length_phase SMALLINT,
+    phase SMALLINT,
+    from_main_isoform BOOLEAN NOT NULL DEFAULT 0,
+    warning_start_dinucleotide BOOLEAN NOT NULL DEFAULT 0,
+    warning_end_dinucleotide BOOLEAN NOT NULL DEFAULT 0,
+    error_main BOOLEAN NOT NULL DEFAULT 0,
+    error_in_isoform BOOLEAN NOT NULL DEFAULT 0,
+    warning_n_in_sequence BOOLEAN NOT NULL DEFAULT 0,
+    origin TEXT
+);
+
+/* Lookups by name while loading */
+CREATE INDEX organisms_name ON organisms(name);
+CREATE INDEX chromosomes_organism_name ON chromosomes(id_organisms, name);
+CREATE INDEX sequences_organism_refseq ON sequences(id_organisms, refseq_id);
+
+/* Secondary indexes, dropped before a bulk load and built after it */
+CREATE INDEX IF NOT EXISTS genes_sequence ON genes(id_sequences);
+CREATE INDEX IF NOT EXISTS genes_organism ON genes(id_organisms);
+CREATE INDEX IF NOT EXISTS isoforms_gene ON isoforms(id_genes);
+CREATE INDEX IF NOT EXISTS isoforms_sequence ON isoforms(id_sequences);
+CREATE INDEX IF NOT EXISTS real_exons_gene ON real_exons(id_genes);
+CREATE INDEX IF NOT EXISTS real_exons_sequence ON real_exons(id_sequences);
+CREATE INDEX IF NOT EXISTS exons_isoform ON exons(id_isoforms);
+CREATE INDEX IF NOT EXISTS exons_gene ON exons(id_genes);
+CREATE INDEX IF NOT EXISTS exons_sequence ON exons(id_sequences);
+CREATE INDEX IF NOT EXISTS introns_isoform ON introns(id_isoforms);
+CREATE INDEX IF NOT EXISTS introns_gene ON introns(id_genes);
+CREATE INDEX IF NOT EXISTS introns_sequence ON introns(id_sequences);
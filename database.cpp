@@ -9,10 +9,17 @@
 
 
 #include "database.h"
+#include "connectionpool.h"
+#include "fastastore.h"
+#include "genomestore.h"
 
 #include <QByteArray>
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QAtomicInt>
 #include <QFile>
 #include <QSqlDatabase>
 #include <QSqlError>
@@ -23,92 +30,637 @@
 // #include <typeinfo>
 // #include <QSqlDriver>
 
-QMap<QString, OrganismPtr> Database::_organisms;
-QMutex Database::_organismsMutex;
+QMutex Database::_originStatsMutex;
+quint64 Database::_totalOriginBytes = 0;
+quint64 Database::_totalEncodedOriginBytes = 0;
+Database::DeltaStats Database::_totalDeltaStats;
 
-QMap<QPair<OrganismPtr,QString>, ChromosomePtr> Database::_chromosomes;
-QMutex Database::_chromosomesMutex;
+QMutex Database::_targetsMutex;
+QMap<QString, QSharedPointer<Database::Target> > Database::_targets;
 
-QMutex Database::_taxMutex;
-QMap<QString, TaxKingdomPtr> Database::_kingdoms;
-QMap<QPair<QString,QString>, TaxGroup1Ptr> Database::_taxGroups1;
-QMap<QPair<QString,QString>, TaxGroup2Ptr> Database::_taxGroups2;
+QString DatabaseOptions::targetKey() const
+{
+    return QString("%1://%2@%3/%4").arg(backend).arg(userName).arg(host).arg(dbName);
+}
 
-QMutex Database::_connectionsMutex;
-QMap<Qt::HANDLE,QSqlDatabase> Database::_connections;
+QSharedPointer<Database::Target> Database::target(const DatabaseOptions &options)
+{
+    QMutexLocker lock(&_targetsMutex);
+    QSharedPointer<Target> & result = _targets[options.targetKey()];
+    if (!result) {
+        result = QSharedPointer<Target>(new Target);
+    }
+    return result;
+}
 
-QSharedPointer<Database> Database::open(const QString &host,
-                         const QString &userName, const QString &password,
-                         const QString &dbName, const QString &sequencesStoreDir,
-                                        const QString &translationsStoreDir)
+QSharedPointer<Database> Database::open(const DatabaseOptions &options)
 {
     QSharedPointer<Database> result(new Database);
-    QMutexLocker lock(&_connectionsMutex);
-    const Qt::HANDLE threadId = QThread::currentThreadId();
-
-    if (_connections.contains(threadId)) {
-        result->_db = &_connections[threadId];
+    result->_pool = ConnectionPool::forOptions(options);
+    if (!result->_pool) {
+        result.clear();
+        return result;
     }
-    else {
-        _connections[threadId] = QSqlDatabase::addDatabase(
-                    "QMYSQL",
-                    QString("introns_db_fill_pid%1_thread%2")
-                    .arg(qApp->applicationPid())
-                    .arg(qint64(QThread::currentThreadId()))
-                    .toLatin1()
-                    );
-
-        _connections[threadId].setHostName(host);
-        _connections[threadId].setUserName(userName);
-        _connections[threadId].setPassword(password);
-        _connections[threadId].setDatabaseName(dbName);
-        _connections[threadId].setConnectOptions("CLIENT_COMPRESS=1");
-        qDebug() << _connections[threadId].lastError();
-        qDebug() << QSqlDatabase::drivers();
-        result->_db = &_connections[threadId];
-    }
-    qDebug() << result->_db->databaseName();
+    result->_backend = result->_pool->backend();
+    result->_target = target(options);
+    result->_connection = result->_pool->acquire();
+    if (!result->_connection) {
+        result.clear();
+        return result;
+    }
+    result->_db = &result->_connection->db;
+    result->_statements = result->_connection->statements.data();
     result->_sequencesStoreDir = QDir::root();
-    result->_translationsStoreDir = QDir::root();
 
     
-    if (sequencesStoreDir.length() > 0) {
-        const QString absPath = QDir(sequencesStoreDir).absolutePath();
+    if (options.sequencesStoreDir.length() > 0) {
+        const QString absPath = QDir(options.sequencesStoreDir).absolutePath();
         if (QDir::root().mkpath(absPath)) {
             result->_sequencesStoreDir = QDir(absPath);
         }
+        result->_sequenceStore = options.sequenceStore;
+        result->_coordinatesOnly = options.coordinatesOnly && "packed" == options.sequenceStore;
+    }
+
+    Target & shared = *result->_target;
+    QMutexLocker schemaLock(&shared.schemaMutex);
+    if (!shared.schemaPrepared) {
+        shared.schemaPrepared = result->_backend->prepareSchema(*result->_db, options);
+    }
+    if (shared.schemaPrepared && !shared.cachesWarmed) {
+        shared.partitions = result->_backend->organismPartitions(*result->_db).toSet();
+        shared.partitioned = !shared.partitions.isEmpty();
+        shared.compact = result->_db->record("exons").contains("flags");
+        shared.binaryOrigins = result->_backend->blobsInTextColumns()
+                || QVariant::ByteArray == result->_db->record("introns").field("origin").type();
+        shared.geneFingerprints = result->_db->record("genes").contains("fingerprint");
+        if (!shared.geneFingerprints && "delta" == options.loadMode) {
+            // Databases created before delta mode get the column on first use
+            shared.geneFingerprints = result->exec(QStringList()
+                                                   << "ALTER TABLE genes ADD COLUMN fingerprint CHAR(40)");
+        }
+        result->warmUpCaches();
+        shared.cachesWarmed = true;
+        if (shared.compact) {
+            qDebug() << "Using compact exons and introns rows";
+        }
+        if (shared.partitioned) {
+            qDebug() << "Tables are partitioned by organism";
+            Q_FOREACH(OrganismPtr organism, shared.organisms.values()) {
+                result->ensurePartition(organism->id);
+            }
+        }
     }
-    if (translationsStoreDir.length() > 0) {
-        const QString absPath = QDir(translationsStoreDir).absolutePath();
-        if (QDir::root().mkpath(absPath)) {
-            result->_translationsStoreDir = QDir(absPath);
+    schemaLock.unlock();
+
+    result->_freshLoad = "fresh" == options.loadMode;
+    result->_replaceOrganisms = "organism" == options.loadMode;
+    result->_deltaLoad = "delta" == options.loadMode && shared.geneFingerprints;
+    OriginCodec::methodFromName(options.originCodec, &result->_originCodec);
+    if (OriginCodec::Text != result->_originCodec && !shared.binaryOrigins) {
+        static QAtomicInt warned;
+        if (warned.testAndSetOrdered(0, 1)) {
+            qWarning() << "Origin columns are not BLOB, origins are stored as text. "
+                       << "Change exons.origin and introns.origin to LONGBLOB to encode them.";
         }
+        result->_originCodec = OriginCodec::Text;
+    }
+    if (!result->_freshLoad) {
+        result->loadExistingSequences();
     }
+    return result;
+}
 
-    if (!result->_db->open()) {
-        // qDebug() << "db not opened";
-        result.clear();
+void Database::loadExistingSequences()
+{
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    if (_target->existingSequencesLoaded) {
+        return;
+    }
+    QSqlQuery query("", *_db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, id_organisms, refseq_id, version FROM sequences")) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+        return;
+    }
+    while (query.next()) {
+        const SequenceKey key(query.value(1).toInt(), query.value(2).toString());
+        _target->existingSequences[key].append(query.value(0).toInt());
+        _target->existingVersions[key] = query.value(3).toString();
+    }
+    _target->existingSequencesLoaded = true;
+    qDebug() << "Found " << _target->existingSequences.size() << " sequences already stored";
+}
+
+void Database::ensurePartition(qint32 organismId)
+{
+    if (!_target->partitioned || organismId <= 0) {
+        return;
+    }
+    QMutexLocker lock(&_target->partitionsMutex);
+    const QString name = Backend::partitionName(organismId);
+    if (!_target->partitions.contains(name) && exec(_backend->addPartitionStatements(organismId))) {
+        _target->partitions.insert(name);
+    }
+}
+
+QSqlQuery & Database::partitionedStatement(Statement id, const char *sql)
+{
+    if (!_target->partitioned) {
+        return statement(id, sql);
+    }
+    QString withKey = QString::fromLatin1(sql);
+    if (withKey.startsWith("INSERT")) {
+        withKey.insert(withKey.indexOf('(') + 1, "id_organisms, ");
+        withKey.replace("VALUES(", "VALUES(:id_organisms, ");
+    }
+    else {
+        withKey += " AND id_organisms=:id_organisms";
+    }
+    QSqlQuery & query = statement(id, withKey.toLatin1().constData());
+    query.bindValue(":id_organisms", _organismId);
+    return query;
+}
+
+QSqlQuery & Database::fingerprintedStatement(Statement id, const char *sql, GenePtr gene)
+{
+    // Only delta loads read fingerprints, other modes leave them NULL
+    // instead of hashing every origin
+    if (!_deltaLoad) {
+        return statement(id, sql);
+    }
+    if (gene->fingerprint.isEmpty()) {
+        gene->fingerprint = geneFingerprint(gene);
+    }
+    QString withColumn = QString::fromLatin1(sql);
+    if (withColumn.startsWith("INSERT")) {
+        withColumn.insert(withColumn.indexOf('(') + 1, "fingerprint, ");
+        withColumn.replace("VALUES(", "VALUES(:fingerprint, ");
+    }
+    else {
+        withColumn.replace(" WHERE ", ", fingerprint=:fingerprint WHERE ");
+    }
+    QSqlQuery & query = statement(id, withColumn.toLatin1().constData());
+    query.bindValue(":fingerprint", gene->fingerprint);
+    return query;
+}
+
+void Database::warmUpCaches()
+{
+    // One query per table instead of one SELECT per cache miss
+    QSqlQuery query("", *_db);
+    query.setForwardOnly(true);
+
+    QHash<qint32, OrganismPtr> organismsById;
+    if (query.exec("SELECT * FROM organisms")) {
+        while (query.next()) {
+            OrganismPtr organism = organismFromRecord(query.record());
+            organismsById[organism->id] = organism;
+            _target->organisms.insert(organism->name, organism);
+        }
+    }
+    else {
+        qWarning() << query.lastError();
+    }
+
+    if (query.exec("SELECT id, id_organisms, name, lengthh FROM chromosomes")) {
+        while (query.next()) {
+            ChromosomePtr chromosome(new Chromosome);
+            chromosome->id = query.value(0).toInt();
+            chromosome->organism = organismsById.value(query.value(1).toInt());
+            chromosome->name = query.value(2).toString();
+            chromosome->length = query.value(3).toUInt();
+            _target->chromosomes.insert(qMakePair(query.value(1).toInt(), chromosome->name), chromosome);
+        }
+    }
+    else {
+        qWarning() << query.lastError();
+    }
+
+    QHash<qint32, TaxKingdomPtr> kingdomsById;
+    if (query.exec("SELECT id, name FROM tax_kingdoms")) {
+        while (query.next()) {
+            TaxKingdomPtr kingdom(new TaxKingdom);
+            kingdom->id = query.value(0).toInt();
+            kingdom->name = query.value(1).toString();
+            kingdomsById[kingdom->id] = kingdom;
+            _target->kingdoms.insert(kingdom->name, kingdom);
+        }
+    }
+    else {
+        qWarning() << query.lastError();
+    }
+
+    QHash<qint32, TaxGroup1Ptr> groups1ById;
+    if (query.exec("SELECT id, id_tax_kingdoms, name, typee FROM tax_groups1")) {
+        while (query.next()) {
+            TaxGroup1Ptr group(new TaxGroup1);
+            group->id = query.value(0).toInt();
+            group->kingdomPtr = kingdomsById.value(query.value(1).toInt());
+            group->name = query.value(2).toString();
+            group->type = query.value(3).toString();
+            groups1ById[group->id] = group;
+            _target->taxGroups1.insert(qMakePair(group->name, group->type), group);
+        }
+    }
+    else {
+        qWarning() << query.lastError();
+    }
+
+    if (query.exec("SELECT id, id_tax_groups1, id_tax_kingdoms, name, typee FROM tax_groups2")) {
+        while (query.next()) {
+            TaxGroup2Ptr group(new TaxGroup2);
+            group->id = query.value(0).toInt();
+            group->taxGroup1Ptr = groups1ById.value(query.value(1).toInt());
+            group->kingdomPtr = kingdomsById.value(query.value(2).toInt());
+            group->name = query.value(3).toString();
+            group->type = query.value(4).toString();
+            _target->taxGroups2.insert(qMakePair(group->name, group->type), group);
+        }
+    }
+    else {
+        qWarning() << query.lastError();
+    }
+
+    qDebug() << "Dimension caches loaded: "
+             << _target->organisms.size() << " organisms, "
+             << _target->chromosomes.size() << " chromosomes, "
+             << _target->kingdoms.size() << " kingdoms, "
+             << _target->taxGroups1.size() << " + " << _target->taxGroups2.size() << " tax groups";
+}
+
+void Database::rememberSequence(SequenceKey key, qint32 id)
+{
+    if (_freshLoad) {
+        return;
+    }
+    _pendingSequence.changed = true;
+    _pendingSequence.key = key;
+    _pendingSequence.id = id;
+}
+
+void Database::applyPendingSequence()
+{
+    if (!_pendingSequence.changed) {
+        return;
+    }
+    const PendingSequence & pending = _pendingSequence;
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    QList<qint32> & ids = _target->existingSequences[pending.key];
+    Q_FOREACH(const qint32 id, pending.staleIds) {
+        ids.removeAll(id);
+    }
+    if (pending.id && !ids.contains(pending.id)) {
+        ids.append(pending.id);
+    }
+    if (ids.isEmpty()) {
+        _target->existingSequences.remove(pending.key);
+    }
+    _target->existingVersions.remove(pending.key);
+    lock.unlock();
+    _pendingSequence = PendingSequence();
+}
+
+QList<IndexDefinition> Database::deferredIndexes(const DatabaseOptions &options,
+                                                 const Backend &backend,
+                                                 const QSqlDatabase &db)
+{
+    QList<IndexDefinition> result;
+    if (!options.deferIndexes && !backend.defersIndexes()) {
+        return result;
+    }
+    Q_FOREACH(const IndexDefinition & index, Backend::secondaryIndexes()) {
+        // Replacing sequences deletes by id_sequences, keep those indexes
+        if (index.usedByLoader && "fresh" != options.loadMode) {
+            continue;
+        }
+        // Compact schema has no id_genes in exons and introns
+        if (!db.record(index.table).contains(index.columns)) {
+            continue;
+        }
+        result << index;
     }
     return result;
 }
 
-OrganismPtr Database::findOrCreateOrganism(const QString &name)
+void Database::prepareBulkLoad(const DatabaseOptions &options)
 {
-    OrganismPtr organism;
-    QMutexLocker lock(&_organismsMutex);
+    QSharedPointer<Database> db = open(options);
+    if (!db) {
+        return;
+    }
+    const QList<IndexDefinition> indexes = deferredIndexes(options, *db->_backend, *db->_db);
+    if (!indexes.isEmpty()) {
+        qDebug() << "Dropping " << indexes.size() << " indexes for bulk load";
+    }
+    QSqlQuery query("", *db->_db);
+    Q_FOREACH(const IndexDefinition & index, indexes) {
+        // Fails if the index is already missing, which is fine
+        if (!query.exec(db->_backend->dropIndexStatement(index))) {
+            qDebug() << query.lastError().text();
+        }
+    }
+}
 
-    if (_organisms.contains(name)) {
-        organism = _organisms[name];
-    }    
+namespace {
 
-    if (organism) {
-        return organism;
+// Builds indexes of one table on its own connection
+class IndexBuilder
+        : public QThread
+{
+public:
+    IndexBuilder(const DatabaseOptions & options, const QStringList & statements)
+        : _options(options), _statements(statements) {}
+    qint64 msecs = 0;
+    bool ok = false;
+private:
+    void run() override
+    {
+        QElapsedTimer timer;
+        timer.start();
+        QSharedPointer<Database> db = Database::open(_options);
+        ok = db && db->exec(_statements);
+        msecs = timer.elapsed();
+    }
+    const DatabaseOptions & _options;
+    const QStringList _statements;
+};
+
+}
+
+void Database::buildIndexes(const DatabaseOptions &options, const QList<IndexDefinition> &indexes)
+{
+    QSharedPointer<Backend> backend = Backend::create(options.backend);
+    QStringList tables;
+    QMap<QString, QList<IndexDefinition> > byTable;
+    Q_FOREACH(const IndexDefinition & index, indexes) {
+        if (!byTable.contains(index.table)) {
+            tables << index.table;
+        }
+        byTable[index.table] << index;
+    }
+
+    qDebug() << "Building indexes of " << tables.join(", ")
+             << (backend->parallelIndexBuild() ? " in parallel" : "");
+    QElapsedTimer timer;
+    timer.start();
+    QList<IndexBuilder*> builders;
+    Q_FOREACH(const QString & table, tables) {
+        IndexBuilder * builder = new IndexBuilder(
+                    options, backend->createIndexStatements(byTable[table]));
+        builders << builder;
+        builder->start();
+        if (!backend->parallelIndexBuild()) {
+            builder->wait();
+        }
     }
-    
+    QStringList times;
+    for (int i=0; i<builders.size(); ++i) {
+        builders[i]->wait();
+        times << QString("%1 %2 s%3")
+                 .arg(tables[i])
+                 .arg(builders[i]->msecs / 1000.0, 0, 'f', 1)
+                 .arg(builders[i]->ok ? "" : " FAILED");
+        delete builders[i];
+    }
+    qDebug() << QString("Index build took %1 s: %2")
+                .arg(timer.elapsed() / 1000.0, 0, 'f', 1)
+                .arg(times.join(", "));
+}
+
+void Database::beginBulkLoadSession()
+{
+    const QStringList statements = _backend->bulkLoadSessionStatements(true);
+    _bulkLoadSession = !statements.isEmpty() && exec(statements);
+}
+
+void Database::finishBulkLoad(const DatabaseOptions &options)
+{
+    QSharedPointer<Database> db = open(options);
+    if (!db) {
+        return;
+    }
+    const QList<IndexDefinition> indexes = deferredIndexes(options, *db->_backend, *db->_db);
+    if (!indexes.isEmpty()) {
+        buildIndexes(options, indexes);
+    }
+    db->_backend->finishBulkLoad(*db->_db);
+}
+
+bool Database::exec(const QStringList &statements)
+{
+    QSqlQuery query("", *_db);
+    Q_FOREACH(const QString & sql, statements) {
+        if (!query.exec(sql)) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArray Database::encodeOrigin(const QByteArray &origin)
+{
+    const QByteArray result = OriginCodec::encode(origin, _originCodec);
+    _originBytes += origin.size();
+    _encodedOriginBytes += result.size();
+    return result;
+}
+
+QVariant Database::originValue(const QByteArray &origin)
+{
+    if (_coordinatesOnly) {
+        _originBytes += origin.size();
+        return QVariant(QVariant::ByteArray);
+    }
+    return encodeOrigin(origin);
+}
+
+QByteArray Database::storedOrigin(const QString &table, qint32 id)
+{
+    if ("exons" != table && "introns" != table) {
+        qWarning() << "No origins in table " << table;
+        return QByteArray();
+    }
+    QSqlQuery query("", *_db);
+    query.prepare(QString("SELECT origin FROM %1 WHERE id=:id").arg(table));
+    query.bindValue(":id", id);
+    if (!query.exec()) {
+        qWarning() << query.lastError();
+        return QByteArray();
+    }
+    if (!query.next()) {
+        qWarning() << "No " << table << " row with id " << id;
+        return QByteArray();
+    }
+    return OriginCodec::decode(query.value(0).toByteArray());
+}
+
+bool Database::originLocation(const QString &table, qint32 id, OriginLocation *location)
+{
+    if ("exons" != table && "introns" != table) {
+        qWarning() << "No origins in table " << table;
+        return false;
+    }
+    // Through isoforms, compact schema has no id_genes in exons and introns
+    QSqlQuery query("", *_db);
+    query.prepare(QString("SELECT x.startt, x.endd, g.backward_chain, s.refseq_id, s.origin_file_name "
+                          "FROM %1 x "
+                          "JOIN isoforms i ON i.id=x.id_isoforms "
+                          "JOIN genes g ON g.id=i.id_genes "
+                          "JOIN sequences s ON s.id=x.id_sequences "
+                          "WHERE x.id=:id").arg(table));
+    query.bindValue(":id", id);
+    if (!query.exec()) {
+        qWarning() << query.lastError();
+        return false;
+    }
+    if (!query.next()) {
+        qWarning() << "No " << table << " row with id " << id;
+        return false;
+    }
+    location->start = query.value(0).toInt();
+    location->end = query.value(1).toInt();
+    location->backward = query.value(2).toBool();
+    location->refSeqId = query.value(3).toString();
+    location->originFileName = query.value(4).toString();
+    return true;
+}
+
+QString Database::originStatsReport()
+{
+    QMutexLocker lock(&_originStatsMutex);
+    return QString("Origins: %1 MB as text, %2 MB stored (%3x)")
+            .arg(_totalOriginBytes / 1048576.0, 0, 'f', 1)
+            .arg(_totalEncodedOriginBytes / 1048576.0, 0, 'f', 1)
+            .arg(_totalEncodedOriginBytes ? double(_totalOriginBytes) / _totalEncodedOriginBytes : 1.0,
+                 0, 'f', 2);
+}
+
+QString Database::deltaStatsReport()
+{
+    QMutexLocker lock(&_originStatsMutex);
+    return QString("Delta: %1 genes unchanged, %2 rewritten, %3 added, %4 removed")
+            .arg(_totalDeltaStats.unchanged)
+            .arg(_totalDeltaStats.updated)
+            .arg(_totalDeltaStats.inserted)
+            .arg(_totalDeltaStats.deleted);
+}
+
+QString Database::geneFingerprint(GenePtr gene)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_8);
+    out << gene->name << gene->ncbiGeneId << gene->note
+        << gene->backwardChain << gene->isProteinButNotRna << gene->isPseudoGene
+        << gene->start << gene->end << gene->startCode << gene->endCode;
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        out << quint8(isoform->type) << isoform->proteinXref << isoform->proteinId
+            << isoform->product << isoform->note
+            << isoform->cdsStart << isoform->cdsEnd << isoform->mrnaStart << isoform->mrnaEnd
+            << isoform->translation;
+        // Origins too: a new sequence version may change bases only
+        Q_FOREACH(ExonPtr exon, isoform->exons) {
+            out << exon->start << exon->end << exon->origin;
+        }
+        Q_FOREACH(IntronPtr intron, isoform->introns) {
+            out << intron->start << intron->end << intron->origin;
+        }
+    }
+    return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex());
+}
+
+QSqlQuery & Database::statement(Statement id, const char *sql)
+{
+    return _statements->query(id, sql);
+}
+
+void Database::beginSequence()
+{
+    // Rows of a replaced sequence are deleted in the same transaction as
+    // the new ones are stored, so a crash never leaves both or neither
+    _pendingSequence = PendingSequence();
+    _inSequenceTransaction = _backend->transactionPerSequence() || !_freshLoad;
+    if (_inSequenceTransaction) {
+        _db->transaction();
+    }
+}
+
+bool Database::endSequence()
+{
+    if (!_inSequenceTransaction) {
+        applyPendingSequence();
+        return true;
+    }
+    _inSequenceTransaction = false;
+    if (!_db->commit()) {
+        qWarning() << _db->lastError();
+        _db->rollback();
+        _pendingSequence = PendingSequence();
+        return false;
+    }
+    applyPendingSequence();
+    return true;
+}
+
+void Database::abortSequence()
+{
+    // Stored rows stay as they were, so does the map of them
+    _pendingSequence = PendingSequence();
+    if (_inSequenceTransaction) {
+        if (!_db->rollback()) {
+            qWarning() << _db->lastError();
+        }
+        _inSequenceTransaction = false;
+    }
+}
+
+OrganismPtr Database::organismFromRecord(const QSqlRecord &organismRecord)
+{
+    OrganismPtr organism(new Organism);
+    organism->id = organismRecord.field("id").value().toInt();
+    organism->name = organismRecord.field("name").value().toString();
+    organism->commonName = organismRecord.field("common_name").value().toString();
+    organism->refSeqAssemblyId = organismRecord.field("ref_seq_assembly_id").value().toString();
+    organism->annotationRelease = organismRecord.field("annotation_release").value().toString();
+    organism->annotationDate = organismRecord.field("annotation_date").value().toDate();
+    organism->taxonomyXref = organismRecord.field("taxonomy_xref").value().toString();
+    organism->taxonomyList = organismRecord.field("taxonomy_list").value().toString()
+            .split(QRegExp(";\\s+"), QString::SkipEmptyParts);
+    organism->realChromosomeCount = organismRecord.field("real_chromosome_count").value().toInt();
+    organism->dbChromosomeCount = organismRecord.field("db_chromosome_count").value().toInt();
+    organism->realMitochondria = organismRecord.field("real_mitichondria").value().toBool();
+    organism->dbMitochondria = organismRecord.field("db_mitochondria").value().toBool();
+    organism->unknownSequencesCount = organismRecord.field("unknown_sequences_count").value().toInt();
+    organism->totalSequencesLength = organismRecord.field("total_sequences_length").value().toInt();
+    organism->bGenesCount = organismRecord.field("b_genes_count").value().toInt();
+    organism->rGenesCount = organismRecord.field("r_genes_count").value().toInt();
+    organism->cdsCount = organismRecord.field("cds_count").value().toInt();
+    organism->rnaCount = organismRecord.field("rna_count").value().toInt();
+    organism->unknownProtGenesCount = organismRecord.field("unknown_prot_genes_count").value().toInt();
+    organism->unknownProtCdsCount = organismRecord.field("unknown_prot_cds_count").value().toInt();
+    organism->exonsCount = organismRecord.field("exons_count").value().toInt();
+    organism->intronsCount = organismRecord.field("introns_count").value().toInt();
+    return organism;
+}
+
+OrganismPtr Database::findOrCreateOrganism(const QString &name)
+{
+    return _target->organisms.findOrResolve(name, [&]() { return resolveOrganism(name); });
+}
+
+OrganismPtr Database::resolveOrganism(const QString &name)
+{
+    OrganismPtr organism;
+
     // qDebug() << "preparing query";
-    QSqlQuery selectQuery("", *_db);
-    // qDebug() << "create query";
-    selectQuery.prepare("SELECT * FROM organisms WHERE name=:name");
+    QSqlQuery & selectQuery = statement(SelectOrganism,
+                                        "SELECT * FROM organisms WHERE name=:name");
     // qDebug() << "select prepared";
     selectQuery.bindValue(":name", name);
     // qDebug() << "binding done";
@@ -118,41 +670,16 @@ OrganismPtr Database::findOrCreateOrganism(const QString &name)
         qWarning() << selectQuery.lastQuery();
     }
     else {
-        Q_ASSERT(selectQuery.size() == 1 || selectQuery.size() == 0);  // Unique values in table
-        if (1 == selectQuery.size()) {
-            selectQuery.seek(0);
-            QSqlRecord organismRecord = selectQuery.record();
-            organism = OrganismPtr(new Organism);
-            organism->id = organismRecord.field("id").value().toInt();
-            organism->name = organismRecord.field("name").value().toString();
-            organism->commonName = organismRecord.field("common_name").value().toString();
-            organism->refSeqAssemblyId = organismRecord.field("ref_seq_assembly_id").value().toString();
-            organism->annotationRelease = organismRecord.field("annotation_release").value().toString();
-            organism->annotationDate = organismRecord.field("annotation_date").value().toDate();
-            organism->taxonomyXref = organismRecord.field("taxonomy_xref").value().toString();
-            organism->taxonomyList = organismRecord.field("taxonomy_list").value().toString()
-                    .split(QRegExp(";\\s+"), QString::SkipEmptyParts);
-            organism->realChromosomeCount = organismRecord.field("real_chromosome_count").value().toInt();
-            organism->dbChromosomeCount = organismRecord.field("db_chromosome_count").value().toInt();
-            organism->realMitochondria = organismRecord.field("real_mitichondria").value().toBool();
-            organism->dbMitochondria = organismRecord.field("db_mitochondria").value().toBool();
-            organism->unknownSequencesCount = organismRecord.field("unknown_sequences_count").value().toInt();
-            organism->totalSequencesLength = organismRecord.field("total_sequences_length").value().toInt();
-            organism->bGenesCount = organismRecord.field("b_genes_count").value().toInt();
-            organism->rGenesCount = organismRecord.field("r_genes_count").value().toInt();
-            organism->cdsCount = organismRecord.field("cds_count").value().toInt();
-            organism->rnaCount = organismRecord.field("rna_count").value().toInt();
-            organism->unknownProtGenesCount = organismRecord.field("unknown_prot_genes_count").value().toInt();
-            organism->unknownProtCdsCount = organismRecord.field("unknown_prot_cds_count").value().toInt();
-            organism->exonsCount = organismRecord.field("exons_count").value().toInt();
-            organism->intronsCount = organismRecord.field("introns_count").value().toInt();
+        // Unique values in table; QSqlQuery::size() is not supported by every driver
+        if (selectQuery.next()) {
+            organism = organismFromRecord(selectQuery.record());
         }
-        else if (0 == selectQuery.size()) {
+        else {
             // Insert into table new one
             organism = OrganismPtr(new Organism);
             organism->name = name;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO organisms(name) VALUES(:name)");
+            QSqlQuery & insertQuery = statement(InsertOrganism,
+                                                "INSERT INTO organisms(name) VALUES(:name)");
             insertQuery.bindValue(":name", name);
             if (!insertQuery.exec()) {
                 qWarning() << insertQuery.lastError();
@@ -163,34 +690,34 @@ OrganismPtr Database::findOrCreateOrganism(const QString &name)
                 organism->id = insertQuery.lastInsertId().toInt();
             }
             _db->commit();
+            ensurePartition(organism->id);
         }
+        selectQuery.finish();
     }
 
-    _organisms[name] = organism;
-
     return organism;
 }
 
 ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr organism)
 {
-    ChromosomePtr chromosome;
-    QMutexLocker locker(&_chromosomesMutex);
-    QMutexLocker locker2(&organism->mutex);
-
-    const QPair<OrganismPtr,QString> key(organism, name);
-
-    if (_chromosomes.contains(key)) {
-        chromosome = _chromosomes[key];
-    }
+    organism->mutex.lock();
+    const qint32 organismId = organism->id;
+    organism->mutex.unlock();
+    const QPair<qint32,QString> key(organismId, name);
+    return _target->chromosomes.findOrResolve(key, [&]() { return resolveChromosome(name, organism); });
+}
 
-    if (chromosome) {
-        return chromosome;
-    }
+ChromosomePtr Database::resolveChromosome(const QString &name, OrganismPtr organism)
+{
+    ChromosomePtr chromosome;
+    organism->mutex.lock();
+    const qint32 organismId = organism->id;
+    organism->mutex.unlock();
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM chromosomes WHERE name=:name AND id_organisms=:org_id");
+    QSqlQuery & selectQuery = statement(SelectChromosome,
+                                        "SELECT * FROM chromosomes WHERE name=:name AND id_organisms=:org_id");
     selectQuery.bindValue(":name", name);
-    selectQuery.bindValue(":org_id", organism->id);
+    selectQuery.bindValue(":org_id", organismId);
 
     if (!selectQuery.exec()) {
         qWarning() << selectQuery.lastError();
@@ -198,24 +725,25 @@ ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr
         qWarning() << selectQuery.lastQuery();
     }
     else {
-        Q_ASSERT(selectQuery.size() == 1 || selectQuery.size() == 0);  // Unique values in table
-        if (1 == selectQuery.size()) {
-            selectQuery.seek(0);
+        // Unique values in table
+        if (selectQuery.next()) {
             QSqlRecord chromosomeRecord = selectQuery.record();
             chromosome = ChromosomePtr(new Chromosome);
             chromosome->length = chromosomeRecord.field("lengthh").value().toUInt();
             chromosome->name = name;
+            chromosome->organism = organism;
             chromosome->id = chromosomeRecord.field("id").value().toInt();
         }
-        else if (0 == selectQuery.size()) {
+        else {
             // Insert into table new one
             chromosome = ChromosomePtr(new Chromosome);
             chromosome->name = name;
+            chromosome->organism = organism;
 
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO chromosomes(name, id_organisms) VALUES(:name,:org_id)");
+            QSqlQuery & insertQuery = statement(InsertChromosome,
+                                                "INSERT INTO chromosomes(name, id_organisms) VALUES(:name,:org_id)");
             insertQuery.bindValue(":name", name);
-            insertQuery.bindValue(":org_id", organism->id);
+            insertQuery.bindValue(":org_id", organismId);
             if (!insertQuery.exec()) {
                 qWarning() << insertQuery.lastError();
                 qWarning() << insertQuery.lastError().text();
@@ -226,11 +754,13 @@ ChromosomePtr Database::findOrCreateChromosome(const QString &name, OrganismPtr
             }
             _db->commit();
             if (!name.toLower().startsWith("unk") && !name.toLower().startsWith("mit")) {
+                organism->mutex.lock();
                 organism->dbChromosomeCount ++;
+                organism->mutex.unlock();
             }
         }
+        selectQuery.finish();
     }
-    _chromosomes[key] = chromosome;
     return chromosome;
 }
 
@@ -243,20 +773,10 @@ void Database::updateOrganism(OrganismPtr organism)
     }
 
     // Name might be changed, so update search key
-    _organismsMutex.lock();
-    Q_FOREACH(const QString &key, _organisms.keys()) {
-        OrganismPtr oldCandidate = _organisms[key];
-        if (oldCandidate == organism && key != organism->name) {
-            _organisms[organism->name] = organism;
-            _organisms.remove(key);
-            break;
-        }
-    }
-    _organismsMutex.unlock();
+    _target->organisms.rekey(organism, organism->name);
 
-    QSqlQuery query("", *_db);
     // TODO tax groups id
-    query.prepare("UPDATE organisms SET "
+    QSqlQuery & query = statement(UpdateOrganism, "UPDATE organisms SET "
                         "name=:name, "
                         "ref_seq_assembly_id=:ref_seq_assembly_id, "
                         "common_name=:common_name, "
@@ -310,14 +830,14 @@ void Database::updateOrganism(OrganismPtr organism)
     }
 
     if (organism->taxGroup2) {
-        query.clear();
-        query.prepare("UPDATE organisms SET id_tax_groups2=:tid WHERE id=:id");
-        query.bindValue(":tid", organism->taxGroup2.toStrongRef()->id);
-        query.bindValue(":id", organism->id);
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        QSqlQuery & taxQuery = statement(UpdateOrganismTaxGroup,
+                                         "UPDATE organisms SET id_tax_groups2=:tid WHERE id=:id");
+        taxQuery.bindValue(":tid", organism->taxGroup2.toStrongRef()->id);
+        taxQuery.bindValue(":id", organism->id);
+        if (!taxQuery.exec()) {
+            qWarning() << taxQuery.lastError();
+            qWarning() << taxQuery.lastError().text();
+            qWarning() << taxQuery.lastQuery();
         }
     }
 }
@@ -331,8 +851,8 @@ void Database::updateChromosome(ChromosomePtr chromosome)
     if (0==chromosome->id) {
         return;
     }
-    QSqlQuery query("", *_db);
-    query.prepare("UPDATE chromosomes SET lengthh=:l WHERE id=:id");
+    QSqlQuery & query = statement(UpdateChromosome,
+                                  "UPDATE chromosomes SET lengthh=:l WHERE id=:id");
     query.bindValue(":l", chromosome->length);
     query.bindValue(":id", chromosome->id);
     if (!query.exec()) {
@@ -343,19 +863,16 @@ void Database::updateChromosome(ChromosomePtr chromosome)
 }
 
 TaxKingdomPtr Database::findOrCreateTaxKingdom(const QString &name)
+{
+    return _target->kingdoms.findOrResolve(name, [&]() { return resolveTaxKingdom(name); });
+}
+
+TaxKingdomPtr Database::resolveTaxKingdom(const QString &name)
 {
     TaxKingdomPtr kingdom;
-    _taxMutex.lock();
-    if (_kingdoms.contains(name)) {
-        kingdom = _kingdoms[name];
-    }
-    _taxMutex.unlock();
-    if (kingdom) {
-        return kingdom;
-    }
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_kingdoms WHERE name=:name");
+    QSqlQuery & selectQuery = statement(SelectTaxKingdom,
+                                        "SELECT * FROM tax_kingdoms WHERE name=:name");
     selectQuery.bindValue(":name", name);
     if (!selectQuery.exec()) {
         qWarning() << selectQuery.lastError();
@@ -363,19 +880,18 @@ TaxKingdomPtr Database::findOrCreateTaxKingdom(const QString &name)
         qWarning() << selectQuery.lastQuery();
     }
     else {
-        Q_ASSERT(selectQuery.size() == 1 || selectQuery.size() == 0);  // Unique values in table
-        if (1 == selectQuery.size()) {
-            selectQuery.seek(0);
+        // Unique values in table
+        if (selectQuery.next()) {
             QSqlRecord kingdomRecord = selectQuery.record();
             kingdom = TaxKingdomPtr(new TaxKingdom);
             kingdom->name = name;
             kingdom->id = kingdomRecord.field("id").value().toInt();
         }
-        else if (0 == selectQuery.size()) {
+        else {
             kingdom = TaxKingdomPtr(new TaxKingdom);
             kingdom->name = name;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_kingdoms(name) VALUES(:name)");
+            QSqlQuery & insertQuery = statement(InsertTaxKingdom,
+                                                "INSERT INTO tax_kingdoms(name) VALUES(:name)");
             insertQuery.bindValue(":name", name);
             if (!insertQuery.exec()) {
                 qWarning() << insertQuery.lastError();
@@ -386,30 +902,25 @@ TaxKingdomPtr Database::findOrCreateTaxKingdom(const QString &name)
                 kingdom->id = insertQuery.lastInsertId().toInt();
             }
         }
+        selectQuery.finish();
 
     }
 
-    _taxMutex.lock();
-    _kingdoms[name] = kingdom;
-    _taxMutex.unlock();
     return kingdom;
 }
 
 TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString &type, TaxKingdomPtr kingdom)
 {
-    TaxGroup1Ptr group;
     const auto key = QPair<QString,QString>(name, type);
-    _taxMutex.lock();
-    if (_taxGroups1.contains(key)) {
-        group = _taxGroups1[key];
-    }
-    _taxMutex.unlock();
-    if (group) {
-        return group;
-    }
+    return _target->taxGroups1.findOrResolve(key, [&]() { return resolveTaxGroup1(name, type, kingdom); });
+}
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
+TaxGroup1Ptr Database::resolveTaxGroup1(const QString &name, const QString &type, TaxKingdomPtr kingdom)
+{
+    TaxGroup1Ptr group;
+
+    QSqlQuery & selectQuery = statement(SelectTaxGroup1,
+                                        "SELECT * FROM tax_groups1 WHERE name=:name AND typee=:typee");
     selectQuery.bindValue(":name", name);
     selectQuery.bindValue(":typee", type);
     if (!selectQuery.exec()) {
@@ -418,9 +929,8 @@ TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString
         qWarning() << selectQuery.lastQuery();
     }
     else {
-        Q_ASSERT(selectQuery.size() == 1 || selectQuery.size() == 0);  // Unique values in table
-        if (1 == selectQuery.size()) {
-            selectQuery.seek(0);
+        // Unique values in table
+        if (selectQuery.next()) {
             QSqlRecord kingdomRecord = selectQuery.record();
             group = TaxGroup1Ptr(new TaxGroup1);
             group->name = name;
@@ -428,13 +938,13 @@ TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString
             group->id = kingdomRecord.field("id").value().toInt();
             group->kingdomPtr = kingdom;
         }
-        else if (0 == selectQuery.size()) {
+        else {
             group = TaxGroup1Ptr(new TaxGroup1);
             group->name = name;
             group->type = type;
             group->kingdomPtr = kingdom;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_groups1(name,typee,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_kingdoms)");
+            QSqlQuery & insertQuery = statement(InsertTaxGroup1,
+                                                "INSERT INTO tax_groups1(name,typee,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_kingdoms)");
             insertQuery.bindValue(":name", name);
             insertQuery.bindValue(":typee", type);
             insertQuery.bindValue(":id_tax_kingdoms", kingdom->id);
@@ -447,30 +957,25 @@ TaxGroup1Ptr Database::findOrCreateTaxGroup1(const QString &name, const QString
                 group->id = insertQuery.lastInsertId().toInt();
             }
         }
+        selectQuery.finish();
 
     }
 
-    _taxMutex.lock();
-    _taxGroups1[key] = group;
-    _taxMutex.unlock();
     return group;
 }
 
 TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString &type, TaxGroup1Ptr group1)
 {
-    TaxGroup2Ptr group;
     const auto key = QPair<QString,QString>(name, type);
-    _taxMutex.lock();
-    if (_taxGroups2.contains(key)) {
-        group = _taxGroups2[key];
-    }
-    _taxMutex.unlock();
-    if (group) {
-        return group;
-    }
+    return _target->taxGroups2.findOrResolve(key, [&]() { return resolveTaxGroup2(name, type, group1); });
+}
 
-    QSqlQuery selectQuery("", *_db);
-    selectQuery.prepare("SELECT * FROM tax_groups2 WHERE name=:name AND typee=:typee");
+TaxGroup2Ptr Database::resolveTaxGroup2(const QString &name, const QString &type, TaxGroup1Ptr group1)
+{
+    TaxGroup2Ptr group;
+
+    QSqlQuery & selectQuery = statement(SelectTaxGroup2,
+                                        "SELECT * FROM tax_groups2 WHERE name=:name AND typee=:typee");
     selectQuery.bindValue(":name", name);
     selectQuery.bindValue(":typee", type);
     if (!selectQuery.exec()) {
@@ -479,9 +984,8 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
         qWarning() << selectQuery.lastQuery();
     }
     else {
-        Q_ASSERT(selectQuery.size() == 1 || selectQuery.size() == 0);  // Unique values in table
-        if (1 == selectQuery.size()) {
-            selectQuery.seek(0);
+        // Unique values in table
+        if (selectQuery.next()) {
             QSqlRecord kingdomRecord = selectQuery.record();
             group = TaxGroup2Ptr(new TaxGroup2);
             group->name = name;
@@ -490,14 +994,14 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
             group->kingdomPtr = group1->kingdomPtr;
             group->taxGroup1Ptr = group1;
         }
-        else if (0 == selectQuery.size()) {
+        else {
             group = TaxGroup2Ptr(new TaxGroup2);
             group->name = name;
             group->type = type;
             group->kingdomPtr = group1->kingdomPtr;
             group->taxGroup1Ptr = group1;
-            QSqlQuery insertQuery("", *_db);
-            insertQuery.prepare("INSERT INTO tax_groups2(name,typee,id_tax_groups1,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_groups1,:id_tax_kingdoms)");
+            QSqlQuery & insertQuery = statement(InsertTaxGroup2,
+                                                "INSERT INTO tax_groups2(name,typee,id_tax_groups1,id_tax_kingdoms) VALUES(:name,:typee,:id_tax_groups1,:id_tax_kingdoms)");
             insertQuery.bindValue(":name", name);
             insertQuery.bindValue(":typee", type);
             insertQuery.bindValue(":id_tax_groups1", group1->id);
@@ -512,85 +1016,436 @@ TaxGroup2Ptr Database::findOrCreateTaxGroup2(const QString &name, const QString
                 group->id = insertQuery.lastInsertId().toInt();
             }
         }
-
+        selectQuery.finish();
+
+    }
+
+    return group;
+}
+
+void Database::dropSequenceIfExists(SequencePtr sequence)
+{
+    if (_freshLoad) {
+        return;
+    }
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    qint32 organismId = organism->id;
+    organism->mutex.unlock();
+    const SequenceKey key(organismId, sequence->refSeqId);
+
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    const QList<qint32> seqIds = _target->existingSequences.value(key);
+    lock.unlock();
+
+    if (seqIds.isEmpty()) {
+        return;
+    }
+    // Forgotten by applyPendingSequence() once the deletes are committed
+    _pendingSequence.changed = true;
+    _pendingSequence.key = key;
+    _pendingSequence.staleIds = seqIds;
+    _staleSequenceIds.append(seqIds);
+    flushStaleSequences();
+}
+
+bool Database::sequenceUnchanged(SequencePtr sequence)
+{
+    if (_freshLoad || _replaceOrganisms || sequence->version.isEmpty()) {
+        return false;
+    }
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    qint32 organismId = organism->id;
+    organism->mutex.unlock();
+    const SequenceKey key(organismId, sequence->refSeqId);
+
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    return _target->existingSequences.contains(key)
+            && _target->existingVersions.value(key) == sequence->version;
+}
+
+QHash<QString, InputFileEntry> Database::inputManifest()
+{
+    QHash<QString, InputFileEntry> result;
+    // Same statement for MySQL and SQLite, databases created before
+    // the table was added to the schema get it on first use
+    const bool created = exec(QStringList() <<
+                              "CREATE TABLE IF NOT EXISTS input_manifest("
+                              " file_name VARCHAR(700) NOT NULL PRIMARY KEY,"
+                              " file_size BIGINT NOT NULL,"
+                              " file_modified BIGINT NOT NULL,"
+                              " content_hash CHAR(40) NOT NULL,"
+                              " sequences_count INT NOT NULL DEFAULT 0,"
+                              " last_gbk_date DATE"
+                              ")");
+    if (!created) {
+        return result;
+    }
+    if ("mysql" == _backend->name()) {
+        // Tables of earlier runs keyed by file names without directory.
+        // SQLite does not limit VARCHAR length.
+        exec(QStringList() << "ALTER TABLE input_manifest MODIFY file_name VARCHAR(700) NOT NULL");
+    }
+    QSqlQuery query("", *_db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT file_name, file_size, file_modified, content_hash, "
+                    "sequences_count, last_gbk_date FROM input_manifest")) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+        return result;
+    }
+    while (query.next()) {
+        InputFileEntry entry;
+        entry.fileName = query.value(0).toString();
+        entry.size = query.value(1).toLongLong();
+        entry.modified = query.value(2).toLongLong();
+        entry.contentHash = query.value(3).toString();
+        entry.sequencesCount = query.value(4).toUInt();
+        entry.lastGbkDate = query.value(5).toDate();
+        result[entry.fileName] = entry;
+    }
+    return result;
+}
+
+void Database::storeInputManifest(const QList<InputFileEntry> &entries)
+{
+    if (entries.isEmpty()) {
+        return;
+    }
+    QSqlQuery query("", *_db);
+    query.prepare("REPLACE INTO input_manifest("
+                  "file_name, file_size, file_modified, content_hash, sequences_count, last_gbk_date"
+                  ") VALUES("
+                  ":file_name, :file_size, :file_modified, :content_hash, :sequences_count, :last_gbk_date"
+                  ")");
+    Q_FOREACH(const InputFileEntry & entry, entries) {
+        query.bindValue(":file_name", entry.fileName);
+        query.bindValue(":file_size", entry.size);
+        query.bindValue(":file_modified", entry.modified);
+        query.bindValue(":content_hash", entry.contentHash);
+        query.bindValue(":sequences_count", entry.sequencesCount);
+        query.bindValue(":last_gbk_date", entry.lastGbkDate);
+        if (!query.exec()) {
+            qWarning() << query.lastError();
+            qWarning() << query.lastError().text();
+            qWarning() << query.lastQuery();
+        }
     }
-
-    _taxMutex.lock();
-    _taxGroups2[key] = group;
-    _taxMutex.unlock();
-    return group;
 }
 
-void Database::dropSequenceIfExists(SequencePtr sequence)
+void Database::replaceOrganism(qint32 organismId)
 {
-    OrganismPtr organism = sequence->organism.toStrongRef();
-    organism->mutex.lock();
-    qint32 organismId = organism->id;
-    organism->mutex.unlock();
-    const QString refSeqId = sequence->refSeqId;
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    // No writer stores a sequence of this organism until its old rows are
+    // gone, or it would go to a partition being truncated
+    while (_target->replacingOrganisms.contains(organismId)) {
+        _target->organismReplaced.wait(&_target->existingSequencesMutex);
+    }
+    if (_target->replacedOrganisms.contains(organismId)) {
+        return;
+    }
+    _target->replacedOrganisms.insert(organismId);
 
-    QSqlQuery query("", *_db);
+    QList<qint32> seqIds;
+    QHash<SequenceKey, QList<qint32> >::iterator it = _target->existingSequences.begin();
+    while (it != _target->existingSequences.end()) {
+        if (it.key().first == organismId) {
+            seqIds += it.value();
+            it = _target->existingSequences.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    if (seqIds.isEmpty()) {
+        return;
+    }
+    _target->replacingOrganisms.insert(organismId);
+    // TRUNCATE PARTITION waits for open transactions of other writers,
+    // which need this mutex to commit: never hold it across statements.
+    // Called outside of the sequence transaction, since DDL commits it.
+    lock.unlock();
+    bool truncated = false;
+    if (_target->partitioned) {
+        QElapsedTimer timer;
+        timer.start();
+        truncated = exec(_backend->truncatePartitionStatements(organismId));
+        if (truncated) {
+            qDebug() << "Organism " << organismId << ": " << seqIds.size()
+                     << " sequences removed by partition truncate in " << timer.elapsed() << " ms";
+        }
+    }
+    if (!truncated) {
+        _staleSequenceIds.append(seqIds);
+        flushStaleSequences();
+    }
+    lock.relock();
+    _target->replacingOrganisms.remove(organismId);
+    _target->organismReplaced.wakeAll();
+}
 
-    query.prepare("SELECT id FROM sequences WHERE id_organisms=:id_organisms AND refseq_id=:refseq_id");
-    query.bindValue(":id_organisms", organismId);
-    query.bindValue(":refseq_id", refSeqId);
+void Database::flushStaleSequences()
+{
+    // A whole organism may be replaced at once, keep statements bounded
+    while (_staleSequenceIds.size() > StaleSequencesBatch) {
+        const QList<qint32> rest = _staleSequenceIds.mid(StaleSequencesBatch);
+        _staleSequenceIds = _staleSequenceIds.mid(0, StaleSequencesBatch);
+        flushStaleSequences();
+        _staleSequenceIds = rest;
+    }
+    if (_staleSequenceIds.isEmpty()) {
+        return;
+    }
+    QStringList ids;
+    Q_FOREACH(const qint32 seqId, _staleSequenceIds) {
+        ids.append(QString::number(seqId));
+    }
+    _staleSequenceIds.clear();
+    const QString idList = ids.join(",");
+
+    // Children first; every table is indexed by id_sequences
+    static const char * Deletes[] = {
+        "DELETE FROM introns WHERE id_sequences IN (%1)",
+        "DELETE FROM exons WHERE id_sequences IN (%1)",
+        "DELETE FROM real_exons WHERE id_sequences IN (%1)",
+        "DELETE FROM isoforms WHERE id_sequences IN (%1)",
+        "DELETE FROM genes WHERE id_sequences IN (%1)",
+        "DELETE FROM sequences WHERE id IN (%1)"
+    };
+
+    QSqlQuery deleteQuery("", *_db);
+    for (const char * del : Deletes) {
+        if (!deleteQuery.exec(QString(del).arg(idList))) {
+            qWarning() << deleteQuery.lastError();
+            qWarning() << deleteQuery.lastError().text();
+            qWarning() << deleteQuery.lastQuery();
+        }
+    }
+}
 
+bool Database::updateStoredSequence(SequencePtr sequence)
+{
+    const SequenceKey key(_organismId, sequence->refSeqId);
+    QMutexLocker lock(&_target->existingSequencesMutex);
+    QList<qint32> seqIds = _target->existingSequences.value(key);
+    lock.unlock();
+    if (seqIds.isEmpty()) {
+        return false;
+    }
+    // The latest row is kept, duplicates of earlier loads are removed
+    const qint32 sequenceId = seqIds.takeLast();
+    if (!seqIds.isEmpty()) {
+        _staleSequenceIds.append(seqIds);
+        flushStaleSequences();
+    }
+    _pendingSequence.staleIds = seqIds;
+    rememberSequence(key, sequenceId);
+
+    QSqlQuery & query = statement(UpdateSequence, "UPDATE sequences SET "
+                                  "source_file_name=:source_file_name"
+                                  ", version=:version"
+                                  ", description=:description"
+                                  ", lengthh=:lengthh"
+                                  ", id_chromosomes=:id_chromosomes"
+                                  ", origin_file_name=:origin_file_name"
+                                  ", gbk_date=:gbk_date"
+                                  " WHERE id=:id");
+    query.bindValue(":source_file_name", sequence->sourceFileName);
+    query.bindValue(":version", sequence->version);
+    query.bindValue(":description", sequence->description);
+    query.bindValue(":lengthh", sequence->length);
+    qint32 chromosomeId = 0;
+    if (sequence->chromosome) {
+        ChromosomePtr chr = sequence->chromosome.toStrongRef();
+        chr->mutex.lock();
+        chromosomeId = chr->id;
+        chr->mutex.unlock();
+    }
+    query.bindValue(":id_chromosomes", chromosomeId);
+    query.bindValue(":origin_file_name", sequence->originFileName);
+    query.bindValue(":gbk_date", sequence->gbk_date);
+    query.bindValue(":id", sequenceId);
     if (!query.exec()) {
         qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
-        return;
+        sequence->id = 0;
+        return true;
     }
+    sequence->id = sequenceId;
+    storeGenesDelta(sequence);
+    return true;
+}
 
-    for (int i=0; i<query.size(); ++i) {
-        query.seek(i);
-        const qint32 seqId = query.record().field("id").value().toInt();
+namespace {
 
-        query.prepare("DELETE FROM introns WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
+// Gene row of a sequence stored before, delta load mode
+struct StoredGene {
+    qint32 id;
+    QString fingerprint;
+    QString ncbiGeneId;
+    QString name;
+    bool backwardChain;
+    bool used;
+};
 
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
-        }
+}
 
-        query.prepare("DELETE FROM exons WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
+void Database::storeGenesDelta(SequencePtr sequence)
+{
+    QList<StoredGene> stored;
+    QSqlQuery query("", *_db);
+    query.setForwardOnly(true);
+    const QString select = "SELECT id, fingerprint, ncbi_gene_id, name, backward_chain "
+            "FROM genes WHERE id_sequences=%1";
+    if (!query.exec(select.arg(sequence->id))) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+        return;
+    }
+    while (query.next()) {
+        const StoredGene gene = {
+            query.value(0).toInt(), query.value(1).toString(), query.value(2).toString(),
+            query.value(3).toString(), query.value(4).toBool(), false
+        };
+        stored.append(gene);
+    }
 
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    // Same fingerprint: the stored rows are the same, nothing is written
+    QList<GenePtr> changed;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        gene->fingerprint = geneFingerprint(gene);
+        bool found = false;
+        for (int i=0; i<stored.size() && !found; ++i) {
+            if (!stored[i].used && stored[i].fingerprint == gene->fingerprint) {
+                stored[i].used = found = true;
+                gene->id = stored[i].id;
+                gene->unchanged = true;
+                _deltaStats.unchanged ++;
+            }
         }
-
-        query.prepare("DELETE FROM isoforms WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
-
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+        if (!found) {
+            changed.append(gene);
         }
+    }
 
-        query.prepare("DELETE FROM genes WHERE id_sequences=:seq_id");
-        query.bindValue(":seq_id", seqId);
-
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+    // Changed genes keep the id of the stored gene they replace
+    QList<GenePtr> updated;
+    QList<GenePtr> inserted;
+    Q_FOREACH(GenePtr gene, changed) {
+        bool found = false;
+        for (int i=0; i<stored.size() && !found; ++i) {
+            const StoredGene & old = stored[i];
+            const bool sameGene = gene->ncbiGeneId.isEmpty()
+                    ? old.ncbiGeneId.isEmpty() && old.name == gene->name
+                      && old.backwardChain == gene->backwardChain
+                    : old.ncbiGeneId == gene->ncbiGeneId;
+            if (!old.used && sameGene) {
+                stored[i].used = found = true;
+                gene->id = old.id;
+                updated.append(gene);
+            }
+        }
+        if (!found) {
+            inserted.append(gene);
         }
+    }
 
-        query.prepare("DELETE FROM sequences WHERE id=:seq_id");
-        query.bindValue(":seq_id", seqId);
+    QStringList rewrittenIds;
+    QStringList deletedIds;
+    Q_FOREACH(GenePtr gene, updated) {
+        rewrittenIds.append(QString::number(gene->id));
+    }
+    Q_FOREACH(const StoredGene & old, stored) {
+        if (!old.used) {
+            rewrittenIds.append(QString::number(old.id));
+            deletedIds.append(QString::number(old.id));
+        }
+    }
+    deleteGeneChildren(sequence->id, rewrittenIds);
+    if (!deletedIds.isEmpty()
+            && !query.exec(QString("DELETE FROM genes WHERE id IN (%1)").arg(deletedIds.join(",")))) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+    }
+    Q_FOREACH(GenePtr gene, updated) {
+        updateGene(gene);
+        addGeneChildren(gene);
+    }
+    Q_FOREACH(GenePtr gene, inserted) {
+        addGene(gene);
+    }
+    _deltaStats.updated += updated.size();
+    _deltaStats.inserted += inserted.size();
+    _deltaStats.deleted += deletedIds.size();
+}
 
-        if (!query.exec()) {
-            qWarning() << query.lastError();
-            qWarning() << query.lastError().text();
-            qWarning() << query.lastQuery();
+void Database::deleteGeneChildren(qint32 sequenceId, const QStringList &geneIds)
+{
+    if (geneIds.isEmpty()) {
+        return;
+    }
+    // Compact schema has no id_genes in exons and introns, go by isoforms.
+    // Every statement is limited by id_sequences, indexed in reload modes.
+    const QString geneList = geneIds.join(",");
+    QSqlQuery query("", *_db);
+    query.setForwardOnly(true);
+    QStringList isoformIds;
+    if (query.exec(QString("SELECT id FROM isoforms WHERE id_sequences=%1 AND id_genes IN (%2)")
+                   .arg(sequenceId).arg(geneList))) {
+        while (query.next()) {
+            isoformIds.append(query.value(0).toString());
         }
     }
+    QStringList deletes;
+    if (!isoformIds.isEmpty()) {
+        const QString isoformList = isoformIds.join(",");
+        deletes << QString("DELETE FROM introns WHERE id_sequences=%1 AND id_isoforms IN (%2)")
+                   .arg(sequenceId).arg(isoformList)
+                << QString("DELETE FROM exons WHERE id_sequences=%1 AND id_isoforms IN (%2)")
+                   .arg(sequenceId).arg(isoformList);
+    }
+    deletes << QString("DELETE FROM real_exons WHERE id_sequences=%1 AND id_genes IN (%2)")
+               .arg(sequenceId).arg(geneList)
+            << QString("DELETE FROM isoforms WHERE id_sequences=%1 AND id_genes IN (%2)")
+               .arg(sequenceId).arg(geneList);
+    exec(deletes);
+}
+
+void Database::updateGene(GenePtr gene)
+{
+    QSqlQuery & query = fingerprintedStatement(UpdateGene, "UPDATE genes SET "
+                  "name=:name"
+                  ", ncbi_gene_id=:ncbi_gene_id"
+                  ", backward_chain=:backward_chain"
+                  ", protein_but_not_rna=:protein_but_not_rna"
+                  ", pseudo_gene=:pseudo_gene"
+                  ", startt=:startt"
+                  ", endd=:endd"
+                  ", start_code=:start_code"
+                  ", end_code=:end_code"
+                  ", max_introns_count=:max_introns_count"
+                  " WHERE id=:id", gene);
+    query.bindValue(":name", gene->name);
+    query.bindValue(":ncbi_gene_id", gene->ncbiGeneId);
+    query.bindValue(":backward_chain", gene->backwardChain);
+    query.bindValue(":protein_but_not_rna", gene->isProteinButNotRna);
+    query.bindValue(":pseudo_gene", gene->isPseudoGene);
+    query.bindValue(":startt", UINT32_MAX == gene->start ? 0 : gene->start);
+    query.bindValue(":endd", gene->end);
+    query.bindValue(":start_code", UINT32_MAX == gene->startCode ? 0 : gene->startCode);
+    query.bindValue(":end_code", gene->endCode);
+    query.bindValue(":max_introns_count", gene->maxIntronsCount);
+    query.bindValue(":id", gene->id);
+    if (!query.exec()) {
+        qWarning() << query.lastError();
+        qWarning() << query.lastError().text();
+        qWarning() << query.lastQuery();
+    }
 }
 
 void Database::addSequence(SequencePtr sequence)
@@ -599,11 +1454,27 @@ void Database::addSequence(SequencePtr sequence)
     organism->mutex.lock();
     qint32 organismId = organism->id;
     organism->mutex.unlock();
+    _organismId = organismId;
 
+    if (_replaceOrganisms) {
+        replaceOrganism(organismId);
+    }
+    beginSequence();
+    if (_deltaLoad && updateStoredSequence(sequence)) {
+        if (!sequence->id) {
+            abortSequence();
+        }
+        else if (!endSequence()) {
+            sequence->id = 0;
+        }
+        else {
+            accumulateStatistics(sequence);
+        }
+        return;
+    }
     dropSequenceIfExists(sequence);
 
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO sequences("
+    QSqlQuery & query = statement(InsertSequence, "INSERT INTO sequences("
                           "source_file_name"
                           ", refseq_id"
                           ", version"
@@ -614,7 +1485,7 @@ void Database::addSequence(SequencePtr sequence)
                           ", origin_file_name"
                           ", gbk_date"
                           ") VALUES("
-                          ":file_name"
+                          ":source_file_name"
                           ", :refseq_id"
                           ", :version"
                           ", :description"
@@ -646,45 +1517,83 @@ void Database::addSequence(SequencePtr sequence)
 	    qWarning() << query.lastError();
         qWarning() << query.lastError().text();
         qWarning() << query.lastQuery();
+        // Rows it replaces stay, resume or the next run replaces them
+        abortSequence();
         return;
     }
     else {
         sequence->id = query.lastInsertId().toInt();
+        rememberSequence(SequenceKey(organismId, sequence->refSeqId), sequence->id);
     }
 
     Q_FOREACH(GenePtr gene, sequence->genes) {
         addGene(gene);
     }
 
+    // Not stored: sinks, e.g. the journal, must not count it
+    if (!endSequence()) {
+        sequence->id = 0;
+        return;
+    }
+    accumulateStatistics(sequence);
+}
+
+void Database::accumulateStatistics(SequencePtr sequence)
+{
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    // Statistics are only accumulated here, see flushStatistics()
+    PendingOrganism & pending = _pendingOrganisms[organism.data()];
+    pending.organism = organism;
     if (sequence->chromosome) {
         ChromosomePtr chromosome = sequence->chromosome;
-        chromosome->mutex.lock();
-        chromosome->length += sequence->length;
-        const QString chromosomeName = chromosome->name;
-        chromosome->mutex.unlock();
-        updateChromosome(chromosome);
-        if (chromosomeName.toLower().startsWith("unk")) {
-            organism->mutex.lock();
-            organism->unknownSequencesCount ++;
-            organism->mutex.unlock();
+        PendingChromosome & pendingChromosome = _pendingChromosomes[chromosome.data()];
+        pendingChromosome.chromosome = chromosome;
+        pendingChromosome.length += sequence->length;
+        // Chromosome name never changes once created
+        if (chromosome->name.toLower().startsWith("unk")) {
+            pending.counters.unknownSequencesCount ++;
         }
     }
-
-    organism->mutex.lock();
-    organism->totalSequencesLength += sequence->length;
+    pending.counters += sequence->counters;
+    pending.counters.totalSequencesLength += sequence->length;
     Q_FOREACH(GenePtr gene, sequence->genes) {
         if (gene->hasCDS) {
-            organism->bGenesCount ++;
+            pending.counters.bGenesCount ++;
         }
         if (gene->hasRNA && !gene->hasCDS) {
-            organism->rGenesCount ++;
+            pending.counters.rGenesCount ++;
         }
         Q_FOREACH(IsoformPtr iso, gene->isoforms) {
-            organism->exonsCount += iso->exons.size();
-            organism->intronsCount += iso->introns.size();
+            pending.counters.exonsCount += iso->exons.size();
+            pending.counters.intronsCount += iso->introns.size();
         }
     }
-    organism->mutex.unlock();
+}
+
+void Database::flushStatistics()
+{
+    if (_pendingOrganisms.isEmpty() && _pendingChromosomes.isEmpty()) {
+        return;
+    }
+    // Merge this connection's counters into shared objects, then store
+    // current totals. update*() read the values under the object mutex,
+    // so concurrent flushes from other writers never store stale totals.
+    Q_FOREACH(const PendingChromosome & pending, _pendingChromosomes) {
+        pending.chromosome->mutex.lock();
+        pending.chromosome->length += pending.length;
+        pending.chromosome->mutex.unlock();
+        updateChromosome(pending.chromosome);
+    }
+    _pendingChromosomes.clear();
+
+    Q_FOREACH(const PendingOrganism & pending, _pendingOrganisms) {
+        OrganismPtr organism = pending.organism;
+        organism->mutex.lock();
+        pending.counters.mergeInto(*organism);
+        organism->mutex.unlock();
+        updateOrganism(organism);
+    }
+    _pendingOrganisms.clear();
 }
 
 void Database::addOrphanedCDS(const QString &fileName,
@@ -694,8 +1603,7 @@ void Database::addOrphanedCDS(const QString &fileName,
                               const QString &dbXref,
                               const QString &product)
 {
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO orphaned_cdses("
+    QSqlQuery & query = statement(InsertOrphanedCds, "INSERT INTO orphaned_cdses("
                   "source_file_name"
                   ", source_line_start"
                   ", source_line_end"
@@ -723,15 +1631,36 @@ void Database::addOrphanedCDS(const QString &fileName,
     }
 }
 
-void Database::storeOrigin(SequencePtr sequence)
+bool Database::storeOrigin(SequencePtr sequence)
 {
     if (QDir::root() == _sequencesStoreDir) {
-        return;
+        return true;
     }
     OrganismPtr organism = sequence->organism.toStrongRef();
     organism->mutex.lock();
     QString organismName = organism->name;
     organism->mutex.unlock();
+    if ("packed" == _sequenceStore) {
+        QSharedPointer<GenomeStore> store = GenomeStore::forOrganism(_sequencesStoreDir, organismName);
+        if (store && store->append(sequence->refSeqId, sequence->origin)) {
+            sequence->originFileName = store->fileName();
+            return true;
+        }
+        qWarning() << "Can't store origin of " << sequence->refSeqId
+                   << " into " << _sequencesStoreDir.path();
+        // Coordinates-only exons and introns would point to nothing
+        return !_coordinatesOnly;
+    }
+    if ("fasta" == _sequenceStore || "bgzf" == _sequenceStore) {
+        QSharedPointer<FastaStore> store =
+                FastaStore::forOrganism(_sequencesStoreDir, organismName, "bgzf" == _sequenceStore);
+        const qint64 offset = store ? store->append(sequence->refSeqId, sequence->origin) : -1;
+        if (offset >= 0) {
+            // Offset of the first base in the uncompressed file, same as in .fai
+            sequence->originFileName = QString("%1:%2").arg(store->fileName()).arg(offset);
+        }
+        return true;
+    }
     organismName.replace(QRegExp("\\s+"), "_");
     organismName.replace(QRegExp("[(),./\\]"), "");
     organismName = organismName.toLower();
@@ -761,14 +1690,14 @@ void Database::storeOrigin(SequencePtr sequence)
     if (! _sequencesStoreDir.mkpath(dirName)) {
         qWarning() << "Can't create dir '" << _sequencesStoreDir.filePath(dirName) <<
                       "'. Sequence '" << fileName << "' will not be stored!";
-        return;
+        return true;
     }
 
     QFile originFile(_sequencesStoreDir.absoluteFilePath(fileName));
     if (!originFile.open(QIODevice::WriteOnly)) {
         qWarning() << "Can't open '" << originFile.fileName() <<
                       "'. Sequence '" << fileName << "' will not be stored!";
-        return;
+        return true;
     }
 
     if (originFile.write(sequence->origin) != sequence->origin.size()) {
@@ -779,87 +1708,18 @@ void Database::storeOrigin(SequencePtr sequence)
         sequence->originFileName = fileName;
     }
     originFile.close();
-}
-
-void Database::storeTranslation(IsoformPtr isoform)
-{
-    if (QDir::root() == _translationsStoreDir) {
-        return;
-    }
-    if (isoform->translation.isEmpty()) {
-        return;
-    }
-    GenePtr gene = isoform->gene.toStrongRef();
-    SequencePtr sequence = isoform->sequence.toStrongRef();
-    OrganismPtr organism = sequence->organism.toStrongRef();
-    organism->mutex.lock();
-    QString organismName = organism->name;
-    organism->mutex.unlock();
-    organismName.replace(QRegExp("\\s+"), "_");
-    organismName.replace(QRegExp("[(),./\\]"), "");
-    organismName = organismName.toLower();
-
-    QString chromosomeName;
-    ChromosomePtr chromosome = sequence->chromosome.toStrongRef();
-    if (chromosome) {
-        chromosome->mutex.lock();
-        chromosomeName = chromosome->name;
-        chromosome->mutex.unlock();
-        chromosomeName.replace(QRegExp("\\s+"), "_");
-        chromosomeName.replace(".", "_");
-        chromosomeName.replace(QRegExp("[(),/\\]"), "");
-        chromosomeName = chromosomeName.toLower();
-    }
-
-    QString refName = sequence->refSeqId;
-    refName.replace(QRegExp("\\s+"), "_");
-    refName.replace(".", "_");
-    refName.replace(QRegExp("[(),/\\]"), "");
-    refName = refName.toLower();
-
-    QString dirName = chromosomeName.isEmpty()
-            ? organismName + "/" + refName
-            : organismName + "/" + chromosomeName + "/" + refName;
-
-    QString geneName = gene->name;
-    QString protName = isoform->proteinXref;
-    QString fileName = geneName + "_" + protName;
-    fileName.replace(QRegExp("\\s+"), "_");
-    fileName.replace(".", "_");
-    fileName.replace(QRegExp("[(),/\\]"), "");
-    fileName = fileName.toLower();
-    fileName += ".fasta";
-
-    if (! _translationsStoreDir.mkpath(dirName)) {
-        qWarning() << "Can't create dir '" << _translationsStoreDir.filePath(dirName) <<
-                      "'. Protein translation '" << fileName << "' will not be stored!";
-        return;
-    }
-
-    QFile translationFile(_translationsStoreDir.absoluteFilePath(fileName));
-    if (!translationFile.open(QIODevice::WriteOnly)) {
-        qWarning() << "Can't open '" << translationFile.fileName() <<
-                      "'. Protein translation '" << fileName << "' will not be stored!";
-        return;
-    }
-    QTextStream ts(&translationFile);
-    ts << "> " << geneName << "(genes id: " << gene->id <<") | " << protName << "\n";
-    ts << format60(isoform->translation) << "\n\n";
-    translationFile.close();
+    return true;
 }
 
 QString Database::format60(const QString &s)
 {
     QString result;
     result.reserve(s.length() + s.length() / 60);
-    quint8 counter = 0;
-    for (int i=0; i<s.length(); ++i) {
-        if (60 == counter) {
-            result.push_back('\n');
-            counter = 0;
+    for (int i=0; i<s.length(); i += 60) {
+        if (i > 0) {
+            result += '\n';
         }
-        result.push_back(s[i]);
-        counter ++;
+        result += s.midRef(i, 60);
     }
     return result;
 }
@@ -873,8 +1733,7 @@ void Database::addGene(GenePtr gene)
     organism->mutex.lock();
     const qint32 organismId = organism->id;
     organism->mutex.unlock();
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO genes("
+    QSqlQuery & query = fingerprintedStatement(InsertGene, "INSERT INTO genes("
                   "id_sequences"
                   ", id_organisms"
                   ", name"
@@ -900,7 +1759,7 @@ void Database::addGene(GenePtr gene)
                   ", :start_code"
                   ", :end_code"
                   ", :max_introns_count"
-                  ")");
+                  ")", gene);
     query.bindValue(":id_sequences", sequenceId);
     query.bindValue(":id_organisms", organismId);
     query.bindValue(":name", gene->name);
@@ -924,14 +1783,7 @@ void Database::addGene(GenePtr gene)
     else {
         gene->id = query.lastInsertId().toInt();
     }
-
-    QHash<quint32, quint32> real_exon_hash;
-    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
-        addRealExons(isoform, real_exon_hash);
-    }
-    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
-        addIsoform(isoform);
-    }
+    addGeneChildren(gene);
 
     // int exons_count = 0;
     // QSet<quint32> max_real_exons;
@@ -952,13 +1804,23 @@ void Database::addGene(GenePtr gene)
     // }
 }
 
+void Database::addGeneChildren(GenePtr gene)
+{
+    QHash<quint32, quint32> real_exon_hash;
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        addRealExons(isoform, real_exon_hash);
+    }
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        addIsoform(isoform);
+    }
+}
+
 void Database::addRealExons(IsoformPtr isoform, QHash<quint32, quint32> & exon_hash){
     Q_FOREACH(ExonPtr exon, isoform->exons) {
         if(exon_hash.contains(exon->real_exon_id)){
             exon->real_exon_id = exon_hash[exon->real_exon_id];
         }else{
-            QSqlQuery query("", *_db);
-            query.prepare("INSERT INTO real_exons("
+            QSqlQuery & query = partitionedStatement(InsertRealExon, "INSERT INTO real_exons("
                           "id_genes"
                           ", id_sequences"
                           ", startt"
@@ -1019,8 +1881,7 @@ void Database::addIsoform(IsoformPtr isoform)
 
     // isoform->errorMain = isoform->errorMain || isoform->errorInLength;
 
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO isoforms("
+    QSqlQuery & query = partitionedStatement(InsertIsoform, "INSERT INTO isoforms("
                   "id_genes"
                   ", id_sequences"
                   ", ncbi_gi"
@@ -1125,6 +1986,47 @@ void Database::addIsoform(IsoformPtr isoform)
 
 }
 
+namespace {
+
+// exons.flags and introns.flags bits of create_database_compact.sql
+enum ExonFlag {
+    ExonFromMainIsoform = 1,
+    ExonErrorInIsoform = 2,
+    ExonWarningNInSequence = 4
+};
+
+enum IntronFlag {
+    IntronFromMainIsoform = 1,
+    IntronWarningStartDinucleotide = 2,
+    IntronWarningEndDinucleotide = 4,
+    IntronErrorMain = 8,
+    IntronErrorInIsoform = 16,
+    IntronWarningNInSequence = 32
+};
+
+quint8 exonFlags(const Exon & exon)
+{
+    quint8 result = 0;
+    if (exon.fromMainIsoform) result |= ExonFromMainIsoform;
+    if (exon.errorInIsoform) result |= ExonErrorInIsoform;
+    if (exon.warningNInSequence) result |= ExonWarningNInSequence;
+    return result;
+}
+
+quint8 intronFlags(const Intron & intron)
+{
+    quint8 result = 0;
+    if (intron.fromMainIsoform) result |= IntronFromMainIsoform;
+    if (intron.warningInStartDinucleotide) result |= IntronWarningStartDinucleotide;
+    if (intron.warningInEndDinucleotide) result |= IntronWarningEndDinucleotide;
+    if (intron.errorMain) result |= IntronErrorMain;
+    if (intron.errorInIsoform) result |= IntronErrorInIsoform;
+    if (intron.warningNInSequence) result |= IntronWarningNInSequence;
+    return result;
+}
+
+}
+
 void Database::addCodingExon(ExonPtr exon)
 {
     const qint32 seqId = exon->isoform.toStrongRef()->gene.toStrongRef()->sequence.toStrongRef()->id;
@@ -1134,50 +2036,88 @@ void Database::addCodingExon(ExonPtr exon)
         exon->startCodon = "";
         exon->endCodon = "";
     }
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO exons("
-                  "id_isoforms"
-                  ", id_genes"
-                  ", id_sequences"
-                  ", real_exon_id"
-                  ", startt"
-                  ", endd"
-                  ", lengthh"
-                  ", typee"
-                  ", start_phase"
-                  ", end_phase"
-                  ", length_phase"
-                  ", indexx"
-                  ", rev_index"
-                  ", start_codon"
-                  ", end_codon"
-                  ", from_main_isoform"
-                  ", error_in_isoform"
-                  ", warning_n_in_sequence"
-                  ", origin"
-                  ") VALUES("
-                  ":id_isoforms"
-                  ", :id_genes"
-                  ", :id_sequences"
-                  ", :real_exon_id"
-                  ", :startt"
-                  ", :endd"
-                  ", :lengthh"
-                  ", :typee"
-                  ", :start_phase"
-                  ", :end_phase"
-                  ", :length_phase"
-                  ", :indexx"
-                  ", :rev_index"
-                  ", :start_codon"
-                  ", :end_codon"
-                  ", :from_main_isoform"
-                  ", :error_in_isoform"
-                  ", :warning_n_in_sequence"
-                  ", :origin"
-                  ")");
+    const bool compact = _target->compact;
+    QSqlQuery & query = compact
+            ? partitionedStatement(InsertCompactExon, "INSERT INTO exons("
+                      "id_isoforms"
+                      ", id_sequences"
+                      ", real_exon_id"
+                      ", startt"
+                      ", endd"
+                      ", lengthh"
+                      ", typee"
+                      ", start_phase"
+                      ", end_phase"
+                      ", length_phase"
+                      ", indexx"
+                      ", rev_index"
+                      ", start_codon"
+                      ", end_codon"
+                      ", flags"
+                      ", origin"
+                      ") VALUES("
+                      ":id_isoforms"
+                      ", :id_sequences"
+                      ", :real_exon_id"
+                      ", :startt"
+                      ", :endd"
+                      ", :lengthh"
+                      ", :typee"
+                      ", :start_phase"
+                      ", :end_phase"
+                      ", :length_phase"
+                      ", :indexx"
+                      ", :rev_index"
+                      ", :start_codon"
+                      ", :end_codon"
+                      ", :flags"
+                      ", :origin"
+                      ")")
+            : partitionedStatement(InsertExon, "INSERT INTO exons("
+                      "id_isoforms"
+                      ", id_genes"
+                      ", id_sequences"
+                      ", real_exon_id"
+                      ", startt"
+                      ", endd"
+                      ", lengthh"
+                      ", typee"
+                      ", start_phase"
+                      ", end_phase"
+                      ", length_phase"
+                      ", indexx"
+                      ", rev_index"
+                      ", start_codon"
+                      ", end_codon"
+                      ", from_main_isoform"
+                      ", error_in_isoform"
+                      ", warning_n_in_sequence"
+                      ", origin"
+                      ") VALUES("
+                      ":id_isoforms"
+                      ", :id_genes"
+                      ", :id_sequences"
+                      ", :real_exon_id"
+                      ", :startt"
+                      ", :endd"
+                      ", :lengthh"
+                      ", :typee"
+                      ", :start_phase"
+                      ", :end_phase"
+                      ", :length_phase"
+                      ", :indexx"
+                      ", :rev_index"
+                      ", :start_codon"
+                      ", :end_codon"
+                      ", :from_main_isoform"
+                      ", :error_in_isoform"
+                      ", :warning_n_in_sequence"
+                      ", :origin"
+                      ")");
     query.bindValue(":id_isoforms", isoformId);
-    query.bindValue(":id_genes", geneId);
+    if (!compact) {
+        query.bindValue(":id_genes", geneId);
+    }
     query.bindValue(":id_sequences", seqId);
     query.bindValue(":real_exon_id", exon->real_exon_id);
     query.bindValue(":startt", exon->start);
@@ -1191,10 +2131,15 @@ void Database::addCodingExon(ExonPtr exon)
     query.bindValue(":rev_index", exon->revIndex);
     query.bindValue(":start_codon", exon->startCodon);
     query.bindValue(":end_codon", exon->endCodon);
-    query.bindValue(":from_main_isoform", exon->fromMainIsoform);
-    query.bindValue(":error_in_isoform", exon->errorInIsoform);
-    query.bindValue(":warning_n_in_sequence", exon->warningNInSequence);
-    query.bindValue(":origin", exon->origin);
+    if (compact) {
+        query.bindValue(":flags", exonFlags(*exon));
+    }
+    else {
+        query.bindValue(":from_main_isoform", exon->fromMainIsoform);
+        query.bindValue(":error_in_isoform", exon->errorInIsoform);
+        query.bindValue(":warning_n_in_sequence", exon->warningNInSequence);
+    }
+    query.bindValue(":origin", originValue(exon->origin));
 
     if (!query.exec()) {
         qWarning() << query.lastError();
@@ -1217,56 +2162,94 @@ void Database::addIntron(IntronPtr intron)
     const qint32 seqId = intron->isoform.toStrongRef()->gene.toStrongRef()->sequence.toStrongRef()->id;
     const qint32 geneId = intron->isoform.toStrongRef()->gene.toStrongRef()->id;
     const qint32 isoformId = intron->isoform.toStrongRef()->id;
-    QSqlQuery query("", *_db);
-    query.prepare("INSERT INTO introns("
-                  "id_isoforms"
-                  ", id_genes"
-                  ", id_sequences"
-                  ", prev_exon"
-                  ", next_exon"
-                  ", startt"
-                  ", endd"
-                  ", id_intron_types"
-                  ", start_dinucleotide"
-                  ", end_dinucleotide"
-                  ", lengthh"
-                  ", indexx"
-                  ", rev_index"
-                  ", length_phase"
-                  ", phase"
-                  ", from_main_isoform"
-                  ", warning_start_dinucleotide"
-                  ", warning_end_dinucleotide"
-                  ", error_main"
-                  ", error_in_isoform"
-                  ", warning_n_in_sequence"
-                  ", origin"
-                  ") VALUES("
-                  ":id_isoforms"
-                  ", :id_genes"
-                  ", :id_sequences"
-                  ", :prev_exon"
-                  ", :next_exon"
-                  ", :startt"
-                  ", :endd"
-                  ", :id_intron_types"
-                  ", :start_dinucleotide"
-                  ", :end_dinucleotide"
-                  ", :lengthh"
-                  ", :indexx"
-                  ", :rev_index"
-                  ", :length_phase"
-                  ", :phase"
-                  ", :from_main_isoform"
-                  ", :warning_start_dinucleotide"
-                  ", :warning_end_dinucleotide"
-                  ", :error_main"
-                  ", :error_in_isoform"
-                  ", :warning_n_in_sequence"
-                  ", :origin"
-                  ")");
+    const bool compact = _target->compact;
+    QSqlQuery & query = compact
+            ? partitionedStatement(InsertCompactIntron, "INSERT INTO introns("
+                      "id_isoforms"
+                      ", id_sequences"
+                      ", prev_exon"
+                      ", next_exon"
+                      ", id_intron_types"
+                      ", start_dinucleotide"
+                      ", end_dinucleotide"
+                      ", startt"
+                      ", endd"
+                      ", lengthh"
+                      ", indexx"
+                      ", rev_index"
+                      ", length_phase"
+                      ", phase"
+                      ", flags"
+                      ", origin"
+                      ") VALUES("
+                      ":id_isoforms"
+                      ", :id_sequences"
+                      ", :prev_exon"
+                      ", :next_exon"
+                      ", :id_intron_types"
+                      ", :start_dinucleotide"
+                      ", :end_dinucleotide"
+                      ", :startt"
+                      ", :endd"
+                      ", :lengthh"
+                      ", :indexx"
+                      ", :rev_index"
+                      ", :length_phase"
+                      ", :phase"
+                      ", :flags"
+                      ", :origin"
+                      ")")
+            : partitionedStatement(InsertIntron, "INSERT INTO introns("
+                      "id_isoforms"
+                      ", id_genes"
+                      ", id_sequences"
+                      ", prev_exon"
+                      ", next_exon"
+                      ", startt"
+                      ", endd"
+                      ", id_intron_types"
+                      ", start_dinucleotide"
+                      ", end_dinucleotide"
+                      ", lengthh"
+                      ", indexx"
+                      ", rev_index"
+                      ", length_phase"
+                      ", phase"
+                      ", from_main_isoform"
+                      ", warning_start_dinucleotide"
+                      ", warning_end_dinucleotide"
+                      ", error_main"
+                      ", error_in_isoform"
+                      ", warning_n_in_sequence"
+                      ", origin"
+                      ") VALUES("
+                      ":id_isoforms"
+                      ", :id_genes"
+                      ", :id_sequences"
+                      ", :prev_exon"
+                      ", :next_exon"
+                      ", :startt"
+                      ", :endd"
+                      ", :id_intron_types"
+                      ", :start_dinucleotide"
+                      ", :end_dinucleotide"
+                      ", :lengthh"
+                      ", :indexx"
+                      ", :rev_index"
+                      ", :length_phase"
+                      ", :phase"
+                      ", :from_main_isoform"
+                      ", :warning_start_dinucleotide"
+                      ", :warning_end_dinucleotide"
+                      ", :error_main"
+                      ", :error_in_isoform"
+                      ", :warning_n_in_sequence"
+                      ", :origin"
+                      ")");
     query.bindValue(":id_isoforms", isoformId);
-    query.bindValue(":id_genes", geneId);
+    if (!compact) {
+        query.bindValue(":id_genes", geneId);
+    }
     query.bindValue(":id_sequences", seqId);
 
     query.bindValue(":prev_exon", intron->prevExon.toStrongRef()->id);
@@ -1282,13 +2265,18 @@ void Database::addIntron(IntronPtr intron)
     query.bindValue(":rev_index", UINT32_MAX == intron->revIndex ? 0 : intron->revIndex);
     query.bindValue(":length_phase", intron->lengthPhase);
     query.bindValue(":phase", intron->phase);
-    query.bindValue(":from_main_isoform", intron->fromMainIsoform);
-    query.bindValue(":warning_start_dinucleotide", intron->warningInStartDinucleotide);
-    query.bindValue(":warning_end_dinucleotide", intron->warningInEndDinucleotide);
-    query.bindValue(":error_main", intron->errorMain);
-    query.bindValue(":error_in_isoform", intron->errorInIsoform);
-    query.bindValue(":warning_n_in_sequence", intron->warningNInSequence);
-    query.bindValue(":origin", intron->origin);
+    if (compact) {
+        query.bindValue(":flags", intronFlags(*intron));
+    }
+    else {
+        query.bindValue(":from_main_isoform", intron->fromMainIsoform);
+        query.bindValue(":warning_start_dinucleotide", intron->warningInStartDinucleotide);
+        query.bindValue(":warning_end_dinucleotide", intron->warningInEndDinucleotide);
+        query.bindValue(":error_main", intron->errorMain);
+        query.bindValue(":error_in_isoform", intron->errorInIsoform);
+        query.bindValue(":warning_n_in_sequence", intron->warningNInSequence);
+    }
+    query.bindValue(":origin", originValue(intron->origin));
 
 
     if (!query.exec()) {
@@ -1305,10 +2293,10 @@ void Database::addIntron(IntronPtr intron)
 void Database::updateNeigbourIntronsIds(ExonPtr exon)
 {
     const qint32 exonId = exon->id;
-    QSqlQuery query("", *_db);
     if (exon->prevIntron) {
         const qint32 prevId = exon->prevIntron.toStrongRef()->id;
-        query.prepare("UPDATE exons SET prev_intron=:prev_id WHERE id=:exon_id");
+        QSqlQuery & query = partitionedStatement(UpdateExonPrevIntron,
+                                      "UPDATE exons SET prev_intron=:prev_id WHERE id=:exon_id");
         query.bindValue(":prev_id", prevId);
         query.bindValue(":exon_id", exonId);
         if (!query.exec()) {
@@ -1319,7 +2307,8 @@ void Database::updateNeigbourIntronsIds(ExonPtr exon)
     }
     if (exon->nextIntron) {
         const qint32 nextId = exon->nextIntron.toStrongRef()->id;
-        query.prepare("UPDATE exons SET next_intron=:next_id WHERE id=:exon_id");
+        QSqlQuery & query = partitionedStatement(UpdateExonNextIntron,
+                                      "UPDATE exons SET next_intron=:next_id WHERE id=:exon_id");
         query.bindValue(":next_id", nextId);
         query.bindValue(":exon_id", exonId);
         if (!query.exec()) {
@@ -1332,8 +2321,27 @@ void Database::updateNeigbourIntronsIds(ExonPtr exon)
 
 Database::~Database()
 {
-    if (_db->isOpen()) {
-        _db->close();
+    if (_db && _db->isOpen()) {
+        flushStatistics();
+    }
+    if (_db && _db->isOpen() && _bulkLoadSession) {
+        exec(_backend->bulkLoadSessionStatements(false));
+    }
+    if (_originBytes > 0) {
+        QMutexLocker lock(&_originStatsMutex);
+        _totalOriginBytes += _originBytes;
+        _totalEncodedOriginBytes += _encodedOriginBytes;
+    }
+    if (_deltaLoad) {
+        QMutexLocker lock(&_originStatsMutex);
+        _totalDeltaStats.unchanged += _deltaStats.unchanged;
+        _totalDeltaStats.updated += _deltaStats.updated;
+        _totalDeltaStats.inserted += _deltaStats.inserted;
+        _totalDeltaStats.deleted += _deltaStats.deleted;
+    }
+    if (_pool) {
+        // Connection stays open for the next file
+        _pool->release(_connection);
     }
 }
 
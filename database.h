@@ -1,22 +1,78 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "backend.h"
+#include "dimensioncache.h"
+#include "origincodec.h"
+#include "statementcache.h"
 #include "structures.h"
 
+#include <QDate>
 #include <QDir>
+#include <QHash>
 #include <QList>
 #include <QMap>
 #include <QMutex>
 #include <QPair>
 #include <QSqlDatabase>
+#include <QSqlRecord>
+#include <QSet>
 #include <QSharedPointer>
+#include <QStringList>
+#include <QWaitCondition>
+
+class ConnectionPool;
+struct PooledConnection;
+
+// Where an exon or an intron is in its sequence
+struct OriginLocation {
+  QString originFileName;  // sequences.origin_file_name
+  QString refSeqId;
+  qint32 start = 0;
+  qint32 end = 0;
+  bool backward = false;
+};
+
+// Row of input_manifest: an input file as it was when completely loaded
+struct InputFileEntry {
+  QString fileName;  // canonical path, files of the same name may differ
+  qint64 size = 0;
+  qint64 modified = 0;  // seconds since epoch
+  QString contentHash;  // SHA-1 of the file as it is on disk
+  quint32 sequencesCount = 0;
+  QDate lastGbkDate;  // latest sequences.gbk_date of the file
+};
+
+struct DatabaseOptions {
+  QString backend;  // "mysql" or "sqlite"
+  QString host;
+  QString userName;
+  QString password;
+  QString dbName;  // database name for MySQL, file name for SQLite
+  QString loadMode;  // "reload" (default), "organism", "fresh" or "delta"
+  int poolSize = 1;  // connections per database
+  bool deferIndexes = false;  // drop big tables indexes for the load time
+  QStringList sessionStatements;  // executed on every new connection
+  QString schemaScript;  // MySQL: creates tables if the database is empty
+  qint64 idOffset = 0;  // first AUTO_INCREMENT value, substituted into schemaScript
+  QString originCodec;  // exons/introns origin encoding: "text" (default), "packed" or "zlib"
+  QString sequencesStoreDir;
+  QString sequenceStore;  // origins in sequencesStoreDir: "raw" (default), "packed", "fasta" or "bgzf"
+  bool coordinatesOnly = false;  // no exons/introns origins, slice them from the packed store
+
+  // Identifies the database, connections and caches are shared by key
+  QString targetKey() const;
+};
 
 class Database {
 public:
-  static QSharedPointer<Database> open(const QString &host,
-                        const QString &userName, const QString &password,
-                        const QString &dbName, const QString &sequencesStoreDir,
-                                       const QString &translationsStoreDir);
+  static QSharedPointer<Database> open(const DatabaseOptions &options);
+  // Called once before any file is loaded and once after the last one
+  static void prepareBulkLoad(const DatabaseOptions &options);
+  static void finishBulkLoad(const DatabaseOptions &options);
+  // Writer connection: relaxed checks until this object is destroyed and
+  // the connection goes back to the pool
+  void beginBulkLoadSession();
 
   OrganismPtr findOrCreateOrganism(const QString & name);
   ChromosomePtr findOrCreateChromosome(const QString &name, OrganismPtr organism);
@@ -24,22 +80,50 @@ public:
   void updateOrganism(OrganismPtr organism);
   void updateChromosome(ChromosomePtr chromosome);
 
+  // Store organism and chromosome statistics accumulated by addSequence()
+  // since the previous flush. Also called when the connection is closed.
+  void flushStatistics();
+
   TaxKingdomPtr findOrCreateTaxKingdom(const QString & name);
   TaxGroup1Ptr findOrCreateTaxGroup1(const QString & name, const QString & type, TaxKingdomPtr kingdom);
   TaxGroup2Ptr findOrCreateTaxGroup2(const QString & name, const QString & type, TaxGroup1Ptr group1);
 
   void dropSequenceIfExists(SequencePtr sequence);
+  // Reload mode: the same version of the sequence is already stored
+  bool sequenceUnchanged(SequencePtr sequence);
+
+  // input_manifest table, created if missing
+  QHash<QString, InputFileEntry> inputManifest();
+  void storeInputManifest(const QList<InputFileEntry> & entries);
 
   void addSequence(SequencePtr sequence);
   void addOrphanedCDS(const QString & fileName, const quint32 lineStart, const quint32 lineEnd,
                       const QString &refSeqId,
                       const QString &dbXref,
                       const QString &product);
-  void storeOrigin(SequencePtr sequence);
-  void storeTranslation(IsoformPtr isoform);
+  // False if the sequence must not be stored: coordinates-only mode and
+  // its origin is not in the packed store
+  bool storeOrigin(SequencePtr sequence);
+
+  // Run plain statements, stops at the first failure
+  bool exec(const QStringList & statements);
+
+  // Decoded origin of an exon or an intron, table is "exons" or "introns"
+  QByteArray storedOrigin(const QString & table, qint32 id);
+  // Coordinates of an exon or an intron, table is "exons" or "introns"
+  bool originLocation(const QString & table, qint32 id, OriginLocation * location);
+  // Origin bytes before and after encoding by all connections
+  static QString originStatsReport();
+  // Delta load mode: genes kept, rewritten, added and removed by all connections
+  static QString deltaStatsReport();
+  // SHA-1 of everything stored for a gene: its fields, isoforms, exons
+  // and introns with their origins
+  static QString geneFingerprint(GenePtr gene);
   static QString format60(const QString &s);
 
   void addGene(GenePtr gene);
+  // Real exons, isoforms, exons and introns of a stored gene
+  void addGeneChildren(GenePtr gene);
   void addIsoform(IsoformPtr isoform);
   
   void addRealExons(IsoformPtr isoform, QHash<quint32, quint32> & exon_hash);
@@ -54,25 +138,159 @@ public:
   ~Database();
 
 private:
+  enum Statement {
+    SelectOrganism, InsertOrganism, UpdateOrganism, UpdateOrganismTaxGroup,
+    SelectChromosome, InsertChromosome, UpdateChromosome,
+    SelectTaxKingdom, InsertTaxKingdom,
+    SelectTaxGroup1, InsertTaxGroup1,
+    SelectTaxGroup2, InsertTaxGroup2,
+    InsertSequence, InsertOrphanedCds, InsertGene, InsertRealExon, InsertIsoform,
+    InsertExon, InsertIntron, InsertCompactExon, InsertCompactIntron,
+    UpdateExonPrevIntron, UpdateExonNextIntron,
+    UpdateSequence, UpdateGene
+  };
+
+  QSqlQuery & statement(Statement id, const char * sql);
+
+  // Reload mode: (id_organisms, refseq_id) -> ids of sequences already stored
+  typedef QPair<qint32,QString> SequenceKey;
+
+  // State shared by all connections to the same database: schema flag,
+  // dimension caches loaded once at startup and, in reload mode, sequences
+  // already stored, fetched once for the whole run. Ids are only meaningful
+  // within one database, so every shard has its own.
+  struct Target {
+    QMutex schemaMutex;
+    bool schemaPrepared = false;
+    bool cachesWarmed = false;
+
+    DimensionCache<QString, Organism> organisms;
+    DimensionCache<QPair<qint32,QString>, Chromosome> chromosomes;
+    DimensionCache<QString, TaxKingdom> kingdoms;
+    DimensionCache<QPair<QString,QString>, TaxGroup1> taxGroups1;
+    DimensionCache<QPair<QString,QString>, TaxGroup2> taxGroups2;
+
+    QMutex existingSequencesMutex;
+    bool existingSequencesLoaded = false;
+    QHash<SequenceKey, QList<qint32> > existingSequences;
+    QHash<SequenceKey, QString> existingVersions;
+    QSet<qint32> replacedOrganisms;  // "organism" load mode
+    QSet<qint32> replacingOrganisms;  // old rows being removed
+    QWaitCondition organismReplaced;
+
+    // Schema partitioned by id_organisms, partition names already created
+    bool partitioned = false;
+    QMutex partitionsMutex;
+    QSet<QString> partitions;
+
+    // create_database_compact.sql: flags byte, no id_genes in exons and introns
+    bool compact = false;
+    // Origin columns can hold encoded values
+    bool binaryOrigins = false;
+    // genes.fingerprint exists, needed by delta load mode
+    bool geneFingerprints = false;
+  };
+  static QSharedPointer<Target> target(const DatabaseOptions & options);
+  static QMutex _targetsMutex;
+  static QMap<QString, QSharedPointer<Target> > _targets;
+
+  void warmUpCaches();
+  static OrganismPtr organismFromRecord(const QSqlRecord & record);
+
+  // Cache miss handlers: SELECT, then INSERT if not found
+  OrganismPtr resolveOrganism(const QString & name);
+  ChromosomePtr resolveChromosome(const QString & name, OrganismPtr organism);
+  TaxKingdomPtr resolveTaxKingdom(const QString & name);
+  TaxGroup1Ptr resolveTaxGroup1(const QString & name, const QString & type, TaxKingdomPtr kingdom);
+  TaxGroup2Ptr resolveTaxGroup2(const QString & name, const QString & type, TaxGroup1Ptr group1);
+
+  static QList<IndexDefinition> deferredIndexes(const DatabaseOptions & options,
+                                                const Backend & backend,
+                                                const QSqlDatabase & db);
+  static void buildIndexes(const DatabaseOptions & options,
+                           const QList<IndexDefinition> & indexes);
+
+  void ensurePartition(qint32 organismId);
+  // Partitioned schema keeps id_organisms in every big table:
+  // adds it to INSERT columns or to UPDATE condition
+  QSqlQuery & partitionedStatement(Statement id, const char * sql);
+  // Delta load: adds genes.fingerprint to INSERT columns or UPDATE values
+  QSqlQuery & fingerprintedStatement(Statement id, const char * sql, GenePtr gene);
 
-  static QMutex _connectionsMutex;
-  static QMap<Qt::HANDLE, QSqlDatabase> _connections;
+  void loadExistingSequences();
+  void replaceOrganism(qint32 organismId);
+  // Reload mode: existingSequences changes of the sequence being stored,
+  // applied once its transaction is committed and dropped on rollback
+  struct PendingSequence {
+    bool changed = false;
+    SequenceKey key;
+    QList<qint32> staleIds;  // deleted rows
+    qint32 id = 0;  // stored row
+  };
+  PendingSequence _pendingSequence;
+  void rememberSequence(SequenceKey key, qint32 id);
+  void applyPendingSequence();
+  void flushStaleSequences();
 
-  static QMutex _organismsMutex;
-  static QMap<QString, OrganismPtr> _organisms;
+  // Delta mode: the stored sequence row is updated, its genes compared by
+  // fingerprint and only changed ones written. False if nothing is stored.
+  bool updateStoredSequence(SequencePtr sequence);
+  void storeGenesDelta(SequencePtr sequence);
+  void deleteGeneChildren(qint32 sequenceId, const QStringList & geneIds);
+  void updateGene(GenePtr gene);
+  void accumulateStatistics(SequencePtr sequence);
+  struct DeltaStats {
+    quint64 unchanged = 0;
+    quint64 updated = 0;
+    quint64 inserted = 0;
+    quint64 deleted = 0;
+  };
+  DeltaStats _deltaStats;
+  static DeltaStats _totalDeltaStats;
 
-  static QMutex _chromosomesMutex;
-  static QMap<QPair<OrganismPtr,QString>, ChromosomePtr> _chromosomes;
+  enum { StaleSequencesBatch = 500 };  // ids per DELETE statement
+  QList<qint32> _staleSequenceIds;
 
-  static QMutex _taxMutex;
-  static QMap<QString, TaxKingdomPtr> _kingdoms;
-  static QMap<QPair<QString,QString>, TaxGroup1Ptr> _taxGroups1;
-  static QMap<QPair<QString,QString>, TaxGroup2Ptr> _taxGroups2;
+  // Per-connection statistics deltas, merged into shared objects on flush
+  struct PendingOrganism {
+    OrganismPtr organism;
+    OrganismCounters counters;
+  };
+  struct PendingChromosome {
+    ChromosomePtr chromosome;
+    quint32 length = 0;
+  };
+  QHash<Organism*, PendingOrganism> _pendingOrganisms;
+  QHash<Chromosome*, PendingChromosome> _pendingChromosomes;
+  bool _freshLoad = false;
+  bool _replaceOrganisms = false;
+  bool _deltaLoad = false;
+  OriginCodec::Method _originCodec = OriginCodec::Text;
+  QByteArray encodeOrigin(const QByteArray & origin);
+  // Bound to :origin, NULL in coordinates-only mode
+  QVariant originValue(const QByteArray & origin);
+  QString _sequenceStore;
+  bool _coordinatesOnly = false;
+  quint64 _originBytes = 0;
+  quint64 _encodedOriginBytes = 0;
+  static QMutex _originStatsMutex;
+  static quint64 _totalOriginBytes;
+  static quint64 _totalEncodedOriginBytes;
+  qint32 _organismId = 0;  // of the sequence being stored
 
+  bool _inSequenceTransaction = false;
+  bool _bulkLoadSession = false;
+  void beginSequence();
+  bool endSequence();  // false if the commit failed
+  void abortSequence();
 
   QDir _sequencesStoreDir;
-  QDir _translationsStoreDir;
+  QSharedPointer<Target> _target;
+  QSharedPointer<ConnectionPool> _pool;
+  PooledConnection * _connection = nullptr;
   QSqlDatabase * _db = nullptr;
+  StatementCache * _statements = nullptr;
+  QSharedPointer<Backend> _backend;
 
 };
 
@@ -0,0 +1,195 @@
+#ifndef DIMENSIONCACHE_H
+#define DIMENSIONCACHE_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThreadStorage>
+#include <QWaitCondition>
+
+// Process-wide cache of dimension rows (organisms, chromosomes, taxonomy).
+//
+// Rows are never removed, so every thread keeps its own front copy of the
+// entries it has seen and a hit takes no lock at all. The shared table is
+// split into shards, each with its own mutex, held only for hash lookups
+// and never across a database round trip. A miss is resolved by exactly
+// one caller; other callers asking for the same key wait for it, callers
+// asking for other keys are not blocked. Re-keying an entry (organism
+// rename) bumps a generation counter which drops all the front copies.
+template <class Key, class Value, int Shards = 16>
+class DimensionCache
+{
+public:
+    typedef QSharedPointer<Value> Ptr;
+
+    Ptr find(const Key & key) const
+    {
+        Ptr result = localFind(key);
+        if (!result) {
+            const int generation = _generation;
+            const Shard & shard = shardFor(key);
+            QMutexLocker lock(&shard.mutex);
+            result = shard.values.value(key);
+            lock.unlock();
+            localRemember(key, result, generation);
+        }
+        return result;
+    }
+
+    // Used by startup warm-up
+    void insert(const Key & key, Ptr value)
+    {
+        Shard & shard = shardFor(key);
+        QMutexLocker lock(&shard.mutex);
+        shard.values.insert(key, value);
+    }
+
+    // Returns cached value or the result of resolve(), which is called
+    // without the lock held and at most once per key at a time
+    template <class Resolver>
+    Ptr findOrResolve(const Key & key, Resolver resolve)
+    {
+        Ptr result = localFind(key);
+        if (result) {
+            return result;
+        }
+
+        const int generation = _generation;
+        Shard & shard = shardFor(key);
+        QMutexLocker lock(&shard.mutex);
+        for (;;) {
+            result = shard.values.value(key);
+            if (result) {
+                lock.unlock();
+                localRemember(key, result, generation);
+                return result;
+            }
+            if (!shard.inFlight.contains(key)) {
+                break;
+            }
+            shard.resolved.wait(&shard.mutex);
+        }
+        shard.inFlight.insert(key);
+        lock.unlock();
+
+        result = resolve();
+
+        lock.relock();
+        if (result) {
+            shard.values.insert(key, result);
+        }
+        shard.inFlight.remove(key);
+        shard.resolved.wakeAll();
+        lock.unlock();
+        localRemember(key, result, generation);
+        return result;
+    }
+
+    // Move value to another key, e.g. after organism rename
+    void rekey(const Ptr & value, const Key & newKey)
+    {
+        Shard & target = shardFor(newKey);
+        QMutexLocker lock(&target.mutex);
+        if (target.values.value(newKey) == value) {
+            return;
+        }
+        lock.unlock();
+
+        for (int i=0; i<Shards; ++i) {
+            QMutexLocker shardLock(&_shards[i].mutex);
+            typename QHash<Key, Ptr>::iterator it = _shards[i].values.begin();
+            while (it != _shards[i].values.end()) {
+                if (it.value() == value) {
+                    _shards[i].values.erase(it);
+                    break;
+                }
+                ++it;
+            }
+        }
+        lock.relock();
+        target.values.insert(newKey, value);
+        _generation.fetchAndAddOrdered(1);
+    }
+
+    QList<Ptr> values() const
+    {
+        QList<Ptr> result;
+        for (int i=0; i<Shards; ++i) {
+            QMutexLocker lock(&_shards[i].mutex);
+            result += _shards[i].values.values();
+        }
+        return result;
+    }
+
+    int size() const
+    {
+        int result = 0;
+        for (int i=0; i<Shards; ++i) {
+            QMutexLocker lock(&_shards[i].mutex);
+            result += _shards[i].values.size();
+        }
+        return result;
+    }
+
+private:
+    struct Shard {
+        mutable QMutex mutex;
+        QWaitCondition resolved;
+        QHash<Key, Ptr> values;
+        QSet<Key> inFlight;
+    };
+
+    struct Local {
+        int generation = 0;
+        QHash<Key, Ptr> values;
+    };
+
+    Shard & shardFor(const Key & key)
+    {
+        return _shards[qHash(key) % Shards];
+    }
+
+    const Shard & shardFor(const Key & key) const
+    {
+        return _shards[qHash(key) % Shards];
+    }
+
+    // Thread's own copy, valid until the next rekey()
+    Local * local() const
+    {
+        if (!_local.hasLocalData()) {
+            _local.setLocalData(new Local);
+        }
+        Local * result = _local.localData();
+        const int generation = _generation;
+        if (result->generation != generation) {
+            result->values.clear();
+            result->generation = generation;
+        }
+        return result;
+    }
+
+    Ptr localFind(const Key & key) const
+    {
+        return local()->values.value(key);
+    }
+
+    // Skipped if rekey() happened since the shard lookup
+    void localRemember(const Key & key, const Ptr & value, int generation) const
+    {
+        Local * front = local();
+        if (value && front->generation == generation) {
+            front->values.insert(key, value);
+        }
+    }
+
+    Shard _shards[Shards];
+    QAtomicInt _generation;
+    mutable QThreadStorage<Local*> _local;
+};
+
+#endif // DIMENSIONCACHE_H
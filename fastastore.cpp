@@ -0,0 +1,536 @@
+#include "fastastore.h"
+
+#include <zlib.h>
+#include <cstring>
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+
+QMutex FastaStore::_storesMutex;
+QMap<QString, QSharedPointer<FastaStore> > FastaStore::_stores;
+QList<FastaStore*> FastaStore::_openStores;
+
+namespace {
+
+void writeUInt16(char * out, quint16 value)
+{
+    out[0] = char(value & 0xff);
+    out[1] = char(value >> 8);
+}
+
+void writeUInt32(char * out, quint32 value)
+{
+    for (int i=0; i<4; ++i) {
+        out[i] = char((value >> (8*i)) & 0xff);
+    }
+}
+
+QByteArray uint64Bytes(quint64 value)
+{
+    QByteArray result(8, 0);
+    for (int i=0; i<8; ++i) {
+        result[i] = char((value >> (8*i)) & 0xff);
+    }
+    return result;
+}
+
+// Little endian unsigned of size bytes
+quint32 readUInt(const char * in, int size)
+{
+    quint32 result = 0;
+    for (int i=0; i<size; ++i) {
+        result |= quint32(quint8(in[i])) << (8*i);
+    }
+    return result;
+}
+
+// One BGZF block: gzip member with BC extra field holding the block size.
+// Empty data gives the end of file marker.
+QByteArray bgzfBlock(const char * data, int size, int level)
+{
+    enum { HeaderSize = 18, TrailerSize = 8, BlockMax = 0x10000 };
+    QByteArray result(BlockMax, 0);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (Z_OK != deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) {
+        return QByteArray();
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = size;
+    zs.next_out = reinterpret_cast<Bytef*>(result.data() + HeaderSize);
+    zs.avail_out = BlockMax - HeaderSize - TrailerSize;
+    const int rc = deflate(&zs, Z_FINISH);
+    const int compressedSize = zs.total_out;
+    deflateEnd(&zs);
+    if (Z_STREAM_END != rc) {
+        // Does not fit into a block, stored deflate always does
+        return Z_NO_COMPRESSION == level ? QByteArray() : bgzfBlock(data, size, Z_NO_COMPRESSION);
+    }
+
+    const int blockSize = HeaderSize + compressedSize + TrailerSize;
+    static const char header[] = {
+        31, char(139), 8, 4,  // gzip magic, deflate, FEXTRA
+        0, 0, 0, 0,  // mtime
+        0, char(255),  // xfl, os
+        6, 0,  // xlen
+        'B', 'C', 2, 0  // subfield, its length
+    };
+    memcpy(result.data(), header, sizeof(header));
+    writeUInt16(result.data() + 16, quint16(blockSize - 1));
+    char * trailer = result.data() + HeaderSize + compressedSize;
+    writeUInt32(trailer, crc32(0, reinterpret_cast<const Bytef*>(data), size));
+    writeUInt32(trailer + 4, quint32(size));
+    result.resize(blockSize);
+    return result;
+}
+
+// Uncompressed content of a whole BGZF block, null on error
+QByteArray bgzfBlockData(const QByteArray & block)
+{
+    enum { TrailerSize = 8 };
+    if (block.size() < 12 + TrailerSize) {
+        return QByteArray();
+    }
+    const int dataStart = 12 + readUInt(block.constData() + 10, 2);
+    const quint32 size = readUInt(block.constData() + block.size() - 4, 4);
+    QByteArray result(int(size), 0);
+    if (0 == size) {
+        return result;
+    }
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (dataStart > block.size() - TrailerSize
+            || Z_OK != inflateInit2(&zs, -15)) {
+        return QByteArray();
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block.constData() + dataStart));
+    zs.avail_in = block.size() - TrailerSize - dataStart;
+    zs.next_out = reinterpret_cast<Bytef*>(result.data());
+    zs.avail_out = size;
+    const int rc = inflate(&zs, Z_FINISH);
+    const bool ok = Z_STREAM_END == rc && zs.total_out == size;
+    inflateEnd(&zs);
+    return ok ? result : QByteArray();
+}
+
+}
+
+QSharedPointer<FastaStore> FastaStore::forOrganism(const QDir &dir, const QString &organismName, bool bgzf)
+{
+    return forFile(dir.absoluteFilePath(fileNameFor(organismName, bgzf)), bgzf);
+}
+
+QSharedPointer<FastaStore> FastaStore::forFile(const QString &fileName, bool bgzf)
+{
+    QMutexLocker lock(&_storesMutex);
+    QSharedPointer<FastaStore> store = _stores.value(fileName);
+    if (!store) {
+        store = QSharedPointer<FastaStore>(new FastaStore(fileName, bgzf));
+        if (!store->open()) {
+            return QSharedPointer<FastaStore>();
+        }
+        _stores[fileName] = store;
+    }
+    else {
+        QMutexLocker storeLock(&store->_mutex);
+        if (!store->reopen()) {
+            return QSharedPointer<FastaStore>();
+        }
+    }
+    _openStores.removeOne(store.data());
+    _openStores.append(store.data());
+    if (_openStores.size() > MaxOpenStores) {
+        _openStores.takeFirst()->close();
+    }
+    return store;
+}
+
+void FastaStore::closeAll()
+{
+    QMutexLocker lock(&_storesMutex);
+    Q_FOREACH(QSharedPointer<FastaStore> store, _stores) {
+        store->close();
+    }
+    _stores.clear();
+    _openStores.clear();
+}
+
+QString FastaStore::baseNameFor(const QString &organismName)
+{
+    QString result = organismName;
+    result.replace(QRegExp("\\s+"), "_");
+    result.replace(QRegExp("[(),./\\]"), "");
+    return result.toLower();
+}
+
+QString FastaStore::fileNameFor(const QString &organismName, bool bgzf)
+{
+    return baseNameFor(organismName) + (bgzf ? ".fa.gz" : ".fa");
+}
+
+FastaStore::FastaStore(const QString &fileName, bool bgzf)
+    : _bgzf(bgzf)
+    , _data(fileName)
+{
+}
+
+FastaStore::~FastaStore()
+{
+    close();
+}
+
+QString FastaStore::fileName() const
+{
+    return QFileInfo(_data.fileName()).fileName();
+}
+
+bool FastaStore::open()
+{
+    const bool exists = _data.exists();
+    if (!_data.open(_bgzf ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Can't open '" << _data.fileName() << "'. Sequences will not be stored!";
+        return false;
+    }
+    if (_bgzf) {
+        if (!scanBlocks()) {
+            _data.close();
+            return false;
+        }
+        _data.seek(_compressedSize);
+    }
+    else {
+        _uncompressedSize = _data.size();
+    }
+    if (exists && !loadIndexes()) {
+        _data.close();
+        return false;
+    }
+    return true;
+}
+
+bool FastaStore::reopen()
+{
+    if (_data.isOpen()) {
+        return true;
+    }
+    if (_failed) {
+        return false;
+    }
+    if (!_data.open(_bgzf ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Can't open '" << _data.fileName() << "'. Sequences will not be stored!";
+        return false;
+    }
+    if (_bgzf) {
+        // Continue before the EOF marker written by close()
+        _data.resize(_compressedSize);
+        _data.seek(_compressedSize);
+    }
+    return true;
+}
+
+bool FastaStore::scanBlocks()
+{
+    // Block offsets and sizes are taken from the data itself: the .gzi of
+    // a run that did not finish is stale
+    const qint64 size = _data.size();
+    qint64 pos = 0;
+    quint64 uncompressed = 0;
+    while (pos + BgzfHeaderSize <= size && _data.seek(pos)) {
+        const QByteArray header = _data.read(BgzfHeaderSize);
+        if (header.size() != BgzfHeaderSize
+                || 31 != quint8(header[0]) || 139 != quint8(header[1])
+                || 'B' != header[12] || 'C' != header[13]) {
+            break;
+        }
+        const qint64 blockSize = readUInt(header.constData() + 16, 2) + 1;
+        if (pos + blockSize > size || !_data.seek(pos + blockSize - 4)) {
+            break;
+        }
+        const QByteArray isize = _data.read(4);
+        if (isize.size() != 4) {
+            break;
+        }
+        const quint32 blockData = readUInt(isize.constData(), 4);
+        if (0 == blockData && pos + blockSize == size) {
+            // EOF marker, written again on close
+            break;
+        }
+        if (pos > 0) {
+            _blocks.append(qMakePair(quint64(pos), uncompressed));
+        }
+        uncompressed += blockData;
+        pos += blockSize;
+    }
+    if (pos < size) {
+        const QByteArray eof = bgzfBlock(nullptr, 0, Z_DEFAULT_COMPRESSION);
+        if (size - pos != eof.size()) {
+            qWarning() << "Dropping " << size - pos << " bytes after the last complete block of '"
+                       << _data.fileName() << "'";
+        }
+        if (!_data.resize(pos)) {
+            qWarning() << "Can't truncate '" << _data.fileName() << "'. Sequences will not be stored!";
+            return false;
+        }
+    }
+    _compressedSize = pos;
+    _uncompressedSize = uncompressed;
+    return true;
+}
+
+bool FastaStore::loadIndexes()
+{
+    QFile fai(_data.fileName() + ".fai");
+    if (fai.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        while (!fai.atEnd()) {
+            const QByteArray line = fai.readLine().trimmed();
+            const int tab = line.indexOf('\t');
+            if (tab > 0) {
+                _faiIndex[QString::fromLatin1(line.left(tab))] = _faiLines.size();
+                _faiLines.append(line);
+            }
+        }
+        fai.close();
+    }
+    // The data is only appended, so the .fai of a run that did not finish
+    // describes a prefix of it: complete if the last record ends the file
+    qint64 indexedSize = 0;
+    Q_FOREACH(const QByteArray & line, _faiLines) {
+        const QList<QByteArray> fields = line.split('\t');
+        if (fields.size() < 5) {
+            continue;
+        }
+        const qint64 length = fields[1].toLongLong();
+        const qint64 lineBases = qMax(1LL, fields[3].toLongLong());
+        const qint64 lineWidth = fields[4].toLongLong();
+        const qint64 rest = length % lineBases;
+        indexedSize = qMax(indexedSize, fields[2].toLongLong() + length / lineBases * lineWidth
+                           + (rest ? rest + lineWidth - lineBases : 0));
+    }
+    if (indexedSize == _uncompressedSize) {
+        return true;
+    }
+    qWarning() << "Index of '" << _data.fileName() << "' is stale, rebuilding it";
+    return rebuildFai();
+}
+
+bool FastaStore::rebuildFai()
+{
+    QFile in(_data.fileName());
+    if (!in.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't read '" << in.fileName() << "'. Sequences will not be stored!";
+        return false;
+    }
+    _faiLines.clear();
+    _faiIndex.clear();
+    FaiScanner scanner(this);
+    if (!_bgzf) {
+        while (!in.atEnd()) {
+            scanner.feed(in.read(BufferSize));
+        }
+    }
+    else {
+        // Blocks are those of scanBlocks(), the first one starts at 0
+        QList<quint64> starts;
+        starts << 0;
+        for (int i=0; i<_blocks.size(); ++i) {
+            starts << _blocks[i].first;
+        }
+        starts << quint64(_compressedSize);
+        for (int i=0; i+1<starts.size() && starts[i] < starts[i+1]; ++i) {
+            in.seek(starts[i]);
+            const QByteArray block = in.read(starts[i+1] - starts[i]);
+            const QByteArray data = bgzfBlockData(block);
+            if (data.isNull()) {
+                qWarning() << "Can't decompress '" << in.fileName() << "' at " << starts[i]
+                           << ". Sequences will not be stored!";
+                return false;
+            }
+            scanner.feed(data);
+        }
+    }
+    scanner.finish();
+    in.close();
+    return true;
+}
+
+void FastaStore::FaiScanner::feed(const QByteArray &data)
+{
+    for (int i=0; i<data.size(); ++i, ++_offset) {
+        const char c = data[i];
+        if (_lineStart && '>' == c) {
+            finish();
+            _inHeader = _inName = true;
+            _name.clear();
+        }
+        else if (_inHeader) {
+            if ('\n' == c) {
+                _inHeader = _inName = false;
+                _record = true;
+                _sequenceOffset = _offset + 1;
+                _length = 0;
+            }
+            else if (' ' == c || '\t' == c) {
+                _inName = false;
+            }
+            else if (_inName) {
+                _name += c;
+            }
+        }
+        else if ('\n' != c && '\r' != c) {
+            _length ++;
+        }
+        _lineStart = '\n' == c;
+    }
+}
+
+void FastaStore::FaiScanner::finish()
+{
+    if (!_record) {
+        return;
+    }
+    _record = false;
+    // Written by append(), so LineBases per line; the later copy wins
+    const QString name = QString::fromLatin1(_name);
+    const QByteArray faiLine = QString("%1\t%2\t%3\t%4\t%5")
+            .arg(name).arg(_length).arg(_sequenceOffset).arg(int(LineBases)).arg(int(LineBases) + 1)
+            .toLatin1();
+    if (_store->_faiIndex.contains(name)) {
+        _store->_faiLines[_store->_faiIndex[name]] = faiLine;
+    }
+    else {
+        _store->_faiIndex[name] = _store->_faiLines.size();
+        _store->_faiLines.append(faiLine);
+    }
+}
+
+qint64 FastaStore::append(const QString &name, const QByteArray &sequence, const QString &description)
+{
+    const QByteArray header = ">" + name.toLatin1()
+            + (description.isEmpty() ? QByteArray() : " " + description.toLatin1()) + "\n";
+    QByteArray record;
+    record.reserve(header.size() + sequence.size() + sequence.size() / LineBases + 1);
+    record += header;
+    for (int i=0; i<sequence.size(); i += LineBases) {
+        record.append(sequence.constData() + i, qMin(int(LineBases), sequence.size() - i));
+        record += '\n';
+    }
+
+    QMutexLocker lock(&_mutex);
+    // Closed as least recently used after the caller got it
+    if (!reopen()) {
+        return -1;
+    }
+    const qint64 offset = _uncompressedSize + header.size();
+    _buffer += record;
+    _uncompressedSize += record.size();
+
+    const QByteArray faiLine = QString("%1\t%2\t%3\t%4\t%5")
+            .arg(name).arg(sequence.size()).arg(offset).arg(int(LineBases)).arg(int(LineBases) + 1)
+            .toLatin1();
+    if (_faiIndex.contains(name)) {
+        _faiLines[_faiIndex[name]] = faiLine;
+    }
+    else {
+        _faiIndex[name] = _faiLines.size();
+        _faiLines.append(faiLine);
+    }
+
+    if (_buffer.size() >= BufferSize && !flushBuffer(false)) {
+        return -1;
+    }
+    return offset;
+}
+
+bool FastaStore::flushBuffer(bool all)
+{
+    if (!_bgzf) {
+        const bool ok = _data.write(_buffer) == _buffer.size();
+        _buffer.clear();
+        if (!ok) {
+            qWarning() << "Can't write '" << _data.fileName() << "' (possible out of space)";
+            _failed = true;
+        }
+        return ok;
+    }
+
+    // Full blocks only, the tail waits for more data unless closing
+    qint64 uncompressedOffset = _uncompressedSize - _buffer.size();
+    QByteArray out;
+    int done = 0;
+    while (_buffer.size() - done >= BgzfBlockData || (all && _buffer.size() > done)) {
+        const int size = qMin(int(BgzfBlockData), _buffer.size() - done);
+        const QByteArray block = bgzfBlock(_buffer.constData() + done, size, Z_DEFAULT_COMPRESSION);
+        if (block.isEmpty()) {
+            qWarning() << "Can't compress '" << _data.fileName() << "'";
+            _failed = true;
+            return false;
+        }
+        const quint64 compressedOffset = _compressedSize + out.size();
+        if (compressedOffset > 0) {
+            _blocks.append(qMakePair(compressedOffset, quint64(uncompressedOffset)));
+        }
+        out += block;
+        uncompressedOffset += size;
+        done += size;
+    }
+    _buffer.remove(0, done);
+    if (_data.write(out) != out.size()) {
+        qWarning() << "Can't write '" << _data.fileName() << "' (possible out of space)";
+        _failed = true;
+        return false;
+    }
+    _compressedSize += out.size();
+    return true;
+}
+
+bool FastaStore::writeIndexes()
+{
+    QFile fai(_data.fileName() + ".fai");
+    if (!fai.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Can't write '" << fai.fileName() << "'";
+        return false;
+    }
+    Q_FOREACH(const QByteArray & line, _faiLines) {
+        fai.write(line + "\n");
+    }
+    fai.close();
+    if (!_bgzf) {
+        return true;
+    }
+
+    QFile gzi(_data.fileName() + ".gzi");
+    if (!gzi.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Can't write '" << gzi.fileName() << "'";
+        return false;
+    }
+    QByteArray content = uint64Bytes(_blocks.size());
+    for (int i=0; i<_blocks.size(); ++i) {
+        content += uint64Bytes(_blocks[i].first);
+        content += uint64Bytes(_blocks[i].second);
+    }
+    gzi.write(content);
+    gzi.close();
+    return true;
+}
+
+void FastaStore::close()
+{
+    QMutexLocker lock(&_mutex);
+    if (!_data.isOpen()) {
+        return;
+    }
+    if (!_failed && flushBuffer(true) && _bgzf) {
+        const QByteArray eof = bgzfBlock(nullptr, 0, Z_DEFAULT_COMPRESSION);
+        _data.write(eof);
+    }
+    _data.close();
+    if (_failed) {
+        qWarning() << "'" << _data.fileName() << "' is incomplete, its index is not updated";
+        return;
+    }
+    writeIndexes();
+}
@@ -0,0 +1,116 @@
+#ifndef FASTASTORE_H
+#define FASTASTORE_H
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+
+// Per-organism FASTA file of sequence origins with samtools compatible
+// index (--seqstore=fasta or --seqstore=bgzf):
+//
+//   <organism>.fa        60 bases per line, record name is refseq_id
+//   <organism>.fa.fai    NAME LENGTH OFFSET LINEBASES LINEWIDTH
+//
+// or, BGZF compressed, <organism>.fa.gz with .fa.gz.fai and .fa.gz.gzi, so
+// `samtools faidx` reads any region without decompressing the whole file.
+//
+// Records are formatted by the calling writer thread and appended under
+// the store mutex to a large buffer, which goes to disk in sequential
+// writes. The .fai is rewritten on close; a sequence stored again on
+// reload is appended once more and its index line points to the last copy.
+// Indexes left stale by a run that did not finish are rebuilt from the
+// data file when it is opened again.
+// Only the most recently used stores keep their files open, others are
+// flushed, closed with their indexes written and reopened for append when
+// their file is asked for again.
+class FastaStore
+{
+public:
+    // Shared writer of the organism store in dir
+    static QSharedPointer<FastaStore> forOrganism(const QDir & dir, const QString & organismName, bool bgzf);
+    // Shared writer of any other multi-FASTA file, e.g. protein translations
+    static QSharedPointer<FastaStore> forFile(const QString & fileName, bool bgzf);
+    // Flush and close all the writers, write the indexes
+    static void closeAll();
+
+    // Organism name as a file name, without extension
+    static QString baseNameFor(const QString & organismName);
+    static QString fileNameFor(const QString & organismName, bool bgzf);
+
+    ~FastaStore();
+
+    QString fileName() const;
+
+    // Returns uncompressed offset of the first base, -1 on failure.
+    // Description goes to the header line after the name.
+    qint64 append(const QString & name, const QByteArray & sequence,
+                  const QString & description = QString());
+
+private:
+    enum {
+        MaxOpenStores = 64,
+        LineBases = 60,
+        BufferSize = 4 * 1024 * 1024,
+        BgzfHeaderSize = 18,
+        BgzfBlockData = 0xff00,  // uncompressed bytes per block, as htslib
+        BgzfBlockMax = 0x10000
+    };
+
+    FastaStore(const QString & fileName, bool bgzf);
+    bool open();
+    bool reopen();  // under _mutex, after close()
+    void close();
+    bool flushBuffer(bool all);
+    bool writeBgzfBlock(const char * data, int size);
+    // BGZF: blocks and sizes of an existing file, cuts off its EOF marker
+    // and a partly written last block
+    bool scanBlocks();
+    // .fai of an existing file, rebuilt if it does not cover the data
+    bool loadIndexes();
+    bool rebuildFai();
+    bool writeIndexes();
+
+    // Indexes FASTA records of uncompressed data fed in order
+    class FaiScanner
+    {
+    public:
+        explicit FaiScanner(FastaStore * store) : _store(store) {}
+        void feed(const QByteArray & data);
+        void finish();
+
+    private:
+        FastaStore * _store;
+        qint64 _offset = 0;  // of the next byte fed
+        bool _lineStart = true;
+        bool _inHeader = false;
+        bool _inName = false;
+        bool _record = false;
+        QByteArray _name;
+        qint64 _sequenceOffset = 0;
+        qint64 _length = 0;
+    };
+
+    const bool _bgzf;
+    QFile _data;
+    QMutex _mutex;
+    QByteArray _buffer;  // uncompressed, not written yet
+    qint64 _uncompressedSize = 0;  // including buffer
+    qint64 _compressedSize = 0;  // BGZF: written to file
+    QList<QByteArray> _faiLines;
+    QHash<QString, int> _faiIndex;  // refseq_id -> _faiLines index
+    QList<QPair<quint64,quint64> > _blocks;  // BGZF: compressed, uncompressed offsets
+    bool _failed = false;
+
+    static QMutex _storesMutex;
+    static QMap<QString, QSharedPointer<FastaStore> > _stores;
+    static QList<FastaStore*> _openStores;  // least recently used first
+};
+
+#endif // FASTASTORE_H
@@ -0,0 +1,321 @@
+#include "featureexporter.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QStringList>
+
+namespace {
+
+const char IntronColumns[] =
+        "id\torganism\trefseq_id\tstartt\tendd\tstrand\tid_genes\tid_isoforms"
+        "\tindexx\tphase\tlength_phase\tid_intron_types\tstart_dinucleotide\tend_dinucleotide"
+        "\tfrom_main_isoform\terror_main\terror_in_isoform"
+        "\twarning_start_dinucleotide\twarning_end_dinucleotide\twarning_n_in_sequence\torigin\n";
+
+const char ExonColumns[] =
+        "id\torganism\trefseq_id\tstartt\tendd\tstrand\tid_genes\tid_isoforms"
+        "\tindexx\ttypee\tstart_phase\tend_phase\tlength_phase\tstart_codon\tend_codon"
+        "\tfrom_main_isoform\terror_in_isoform\twarning_n_in_sequence\torigin\n";
+
+enum { LineBases = 60, WriteBufferSize = 1024 * 1024 };
+
+// FASTA record or TSV row from (column, value) pairs and the sequence
+QByteArray row(const QStringList & columns, const QStringList & values,
+               const QByteArray & origin, bool tsv)
+{
+    QByteArray result;
+    if (tsv) {
+        result = values.join("\t").toLatin1();
+        result += '\t';
+        result += origin;
+        result += '\n';
+        return result;
+    }
+    result.reserve(origin.size() + origin.size() / LineBases + 256);
+    result += '>';
+    result += values[0].toLatin1();
+    for (int i=1; i<columns.size(); ++i) {
+        QString value = values[i];
+        value.replace(' ', '_');
+        result += ' ';
+        result += columns[i].toLatin1();
+        result += '=';
+        result += value.toLatin1();
+    }
+    result += '\n';
+    for (int i=0; i<origin.size(); i += LineBases) {
+        result.append(origin.constData() + i, qMin(int(LineBases), origin.size() - i));
+        result += '\n';
+    }
+    return result;
+}
+
+}
+
+FeatureExporter::FeatureExporter(const FeatureExportOptions &options, int capacity)
+    : QThread()
+    , _options(options)
+    , _capacity(qMax(1, capacity))
+{
+}
+
+FeatureExporter::~FeatureExporter()
+{
+    _introns.close();
+    _exons.close();
+}
+
+bool FeatureExporter::open()
+{
+    if (!_options.intronsFileName.isEmpty()) {
+        if (!_introns.open(_options.intronsFileName)) {
+            return false;
+        }
+        if (_introns.tsv) {
+            _introns.write(IntronColumns);
+        }
+    }
+    if (!_options.exonsFileName.isEmpty()) {
+        if (!_exons.open(_options.exonsFileName)) {
+            return false;
+        }
+        if (_exons.tsv) {
+            _exons.write(ExonColumns);
+        }
+    }
+    return true;
+}
+
+bool FeatureExporter::accepted(quint32 start, quint32 end, bool main, bool error) const
+{
+    const quint32 length = end >= start ? end - start + 1 : start - end + 1;
+    return (main || !_options.mainIsoformOnly)
+            && (!error || !_options.noErrors)
+            && length >= _options.minLength
+            && length <= _options.maxLength;
+}
+
+void FeatureExporter::enqueue(SequencePtr sequence)
+{
+    Owner owner;
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    owner.organism = organism->name;
+    organism->mutex.unlock();
+    owner.refSeqId = sequence->refSeqId;
+
+    Batch batch;
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        if (gene->unchanged) {
+            continue;
+        }
+        owner.geneId = gene->id;
+        owner.backward = gene->backwardChain;
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            owner.isoformId = isoform->id;
+            if (!_options.intronsFileName.isEmpty()) {
+                Q_FOREACH(IntronPtr intron, isoform->introns) {
+                    if (accepted(intron->start, intron->end, intron->fromMainIsoform,
+                                 intron->errorMain || intron->errorInIsoform)) {
+                        batch.introns.append(qMakePair(owner, intron));
+                    }
+                }
+            }
+            if (!_options.exonsFileName.isEmpty()) {
+                Q_FOREACH(ExonPtr exon, isoform->exons) {
+                    if (accepted(exon->start, exon->end, exon->fromMainIsoform, exon->errorInIsoform)) {
+                        batch.exons.append(qMakePair(owner, exon));
+                    }
+                }
+            }
+        }
+    }
+    if (batch.introns.isEmpty() && batch.exons.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker lock(&_mutex);
+    if (_queue.size() >= _capacity && !_closed) {
+        QElapsedTimer timer;
+        timer.start();
+        while (_queue.size() >= _capacity && !_closed) {
+            _notFull.wait(&_mutex);
+        }
+        _producerWaitNsecs += timer.nsecsElapsed();
+    }
+    _queue.enqueue(batch);
+    _notEmpty.wakeOne();
+}
+
+void FeatureExporter::finish()
+{
+    QMutexLocker lock(&_mutex);
+    _closed = true;
+    _notEmpty.wakeAll();
+    lock.unlock();
+    wait();
+    _introns.close();
+    _exons.close();
+}
+
+void FeatureExporter::run()
+{
+    QElapsedTimer timer;
+    QByteArray introns;
+    QByteArray exons;
+    QMutexLocker lock(&_mutex);
+    for (;;) {
+        while (_queue.isEmpty() && !_closed) {
+            _notEmpty.wait(&_mutex);
+        }
+        if (_queue.isEmpty()) {
+            break;
+        }
+        const Batch batch = _queue.dequeue();
+        _notFull.wakeOne();
+        lock.unlock();
+
+        timer.start();
+        for (int i=0; i<batch.introns.size(); ++i) {
+            introns += format(batch.introns[i].first, *batch.introns[i].second, _introns.tsv);
+        }
+        for (int i=0; i<batch.exons.size(); ++i) {
+            exons += format(batch.exons[i].first, *batch.exons[i].second, _exons.tsv);
+        }
+        // Large sequential writes, compressed in big chunks
+        if (introns.size() >= WriteBufferSize) {
+            _introns.write(introns);
+            introns.clear();
+        }
+        if (exons.size() >= WriteBufferSize) {
+            _exons.write(exons);
+            exons.clear();
+        }
+        const qint64 elapsed = timer.nsecsElapsed();
+
+        lock.relock();
+        _introns.rows += batch.introns.size();
+        _exons.rows += batch.exons.size();
+        _writeNsecs += elapsed;
+    }
+    lock.unlock();
+    if (!introns.isEmpty()) {
+        _introns.write(introns);
+    }
+    if (!exons.isEmpty()) {
+        _exons.write(exons);
+    }
+}
+
+QByteArray FeatureExporter::format(const Owner &owner, const Intron &intron, bool tsv) const
+{
+    static const QStringList columns = QString(IntronColumns).trimmed().split('\t');
+    QStringList values;
+    values << QString("intron:%1").arg(intron.id)
+           << owner.organism
+           << owner.refSeqId
+           << QString::number(intron.start)
+           << QString::number(intron.end)
+           << (owner.backward ? "-" : "+")
+           << QString::number(owner.geneId)
+           << QString::number(owner.isoformId)
+           << QString::number(intron.index)
+           << QString::number(intron.phase)
+           << QString::number(intron.lengthPhase)
+           << QString::number(intron.intronTypeId)
+           << QString::fromLatin1(intron.startDinucleotide)
+           << QString::fromLatin1(intron.endDinucleotide)
+           << QString::number(intron.fromMainIsoform)
+           << QString::number(intron.errorMain)
+           << QString::number(intron.errorInIsoform)
+           << QString::number(intron.warningInStartDinucleotide)
+           << QString::number(intron.warningInEndDinucleotide)
+           << QString::number(intron.warningNInSequence);
+    if (tsv) {
+        values[0] = QString::number(intron.id);
+    }
+    return row(columns, values, intron.origin, tsv);
+}
+
+QByteArray FeatureExporter::format(const Owner &owner, const Exon &exon, bool tsv) const
+{
+    static const QStringList columns = QString(ExonColumns).trimmed().split('\t');
+    QStringList values;
+    values << QString("exon:%1").arg(exon.id)
+           << owner.organism
+           << owner.refSeqId
+           << QString::number(exon.start)
+           << QString::number(exon.end)
+           << (owner.backward ? "-" : "+")
+           << QString::number(owner.geneId)
+           << QString::number(owner.isoformId)
+           << QString::number(exon.index)
+           << QString::number(int(exon.type))
+           << QString::number(exon.startPhase)
+           << QString::number(exon.endPhase)
+           << QString::number(exon.lengthPhase)
+           << QString::fromLatin1(exon.startCodon)
+           << QString::fromLatin1(exon.endCodon)
+           << QString::number(exon.fromMainIsoform)
+           << QString::number(exon.errorInIsoform)
+           << QString::number(exon.warningNInSequence);
+    if (tsv) {
+        values[0] = QString::number(exon.id);
+    }
+    return row(columns, values, exon.origin, tsv);
+}
+
+QString FeatureExporter::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Export: %1 introns, %2 exons written in %3 ms, writers blocked %4 ms")
+            .arg(_introns.rows)
+            .arg(_exons.rows)
+            .arg(_writeNsecs / 1000000)
+            .arg(_producerWaitNsecs / 1000000);
+}
+
+
+bool FeatureExporter::Output::open(const QString &fileName)
+{
+    _fileName = fileName;
+    tsv = fileName.contains(".tsv");
+    if (fileName.endsWith(".gz")) {
+        _gz = gzopen(fileName.toLocal8Bit().constData(), "wb6");
+        if (_gz) {
+            gzbuffer(_gz, WriteBufferSize);
+        }
+    }
+    else {
+        _file.setFileName(fileName);
+        _file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+    if (!_gz && !_file.isOpen()) {
+        qWarning() << "Can't create '" << fileName << "'";
+        return false;
+    }
+    return true;
+}
+
+bool FeatureExporter::Output::write(const QByteArray &data)
+{
+    const bool ok = _gz
+            ? gzwrite(_gz, data.constData(), data.size()) == data.size()
+            : _file.isOpen() && _file.write(data) == data.size();
+    if (!ok) {
+        qWarning() << "Can't write '" << _fileName << "' (possible out of space)";
+    }
+    return ok;
+}
+
+void FeatureExporter::Output::close()
+{
+    if (_gz) {
+        gzclose(_gz);
+        _gz = nullptr;
+    }
+    if (_file.isOpen()) {
+        _file.close();
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef FEATUREEXPORTER_H
+#define FEATUREEXPORTER_H
+
+#include "sequencesink.h"
+#include "structures.h"
+
+#include <zlib.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+struct FeatureExportOptions {
+    QString intronsFileName;  // --export-introns=...
+    QString exonsFileName;  // --export-exons=...
+    bool mainIsoformOnly = false;  // --export-main-only
+    bool noErrors = false;  // --export-no-errors
+    quint32 minLength = 0;  // --export-min-length=...
+    quint32 maxLength = UINT32_MAX;  // --export-max-length=...
+
+    bool enabled() const { return !intronsFileName.isEmpty() || !exonsFileName.isEmpty(); }
+};
+
+// Intron and exon sequence library written while loading, so motif
+// analysis does not have to read origins back from the database.
+// Output is FASTA, or TSV if the file name has .tsv in it, gzip
+// compressed if it ends with .gz. Ids, coordinates, phases, intron type,
+// dinucleotides and flags go to FASTA header or TSV columns.
+//
+// Writer threads pick the rows that pass the filters of a stored sequence
+// (so database ids are set) and go on; this thread formats and writes them.
+class FeatureExporter
+        : public QThread
+        , public SequenceSink
+{
+public:
+    FeatureExporter(const FeatureExportOptions & options, int capacity);
+    ~FeatureExporter();
+
+    // False if an output file can't be created
+    bool open();
+
+    // Blocks while the queue is full
+    void enqueue(SequencePtr sequence) override;
+
+    // No more input: write what is queued, close files and stop the thread
+    void finish();
+
+    QString report() const;
+
+private:
+    // Context of a row not kept by the row itself
+    struct Owner {
+        QString organism;
+        QString refSeqId;
+        qint32 geneId = 0;
+        qint32 isoformId = 0;
+        bool backward = false;
+    };
+    struct Batch {
+        QList<QPair<Owner, IntronPtr> > introns;
+        QList<QPair<Owner, ExonPtr> > exons;
+    };
+
+    class Output {
+    public:
+        bool open(const QString & fileName);
+        bool write(const QByteArray & data);
+        void close();
+        bool tsv = false;
+        quint64 rows = 0;
+    private:
+        QString _fileName;
+        QFile _file;
+        gzFile _gz = nullptr;
+    };
+
+    bool accepted(quint32 start, quint32 end, bool main, bool error) const;
+    QByteArray format(const Owner & owner, const Intron & intron, bool tsv) const;
+    QByteArray format(const Owner & owner, const Exon & exon, bool tsv) const;
+    void run() override;
+
+    const FeatureExportOptions _options;
+    const int _capacity;
+    Output _introns;
+    Output _exons;
+
+    mutable QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<Batch> _queue;
+    bool _closed = false;
+    qint64 _producerWaitNsecs = 0;
+    qint64 _writeNsecs = 0;
+};
+
+#endif // FEATUREEXPORTER_H
@@ -0,0 +1,134 @@
+#include "filescheduler.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QTextStream>
+
+namespace {
+
+const char * const GenBankPatterns[] = {
+    "*.gbk", "*.gbk.gz", "*.gbff", "*.gbff.gz", "*.gb", "*.gb.gz"
+};
+
+void discoverOne(const QString & argument, QStringList * result)
+{
+    if (argument.startsWith('@')) {
+        QFile list(argument.mid(1));
+        if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qWarning() << "Can't open input list " << list.fileName();
+            return;
+        }
+        QTextStream in(&list);
+        while (!in.atEnd()) {
+            const QString line = in.readLine().trimmed();
+            if (!line.isEmpty() && !line.startsWith('#') && !line.startsWith('@')) {
+                discoverOne(line, result);
+            }
+        }
+        return;
+    }
+    const QFileInfo info(argument);
+    if (info.isDir()) {
+        QStringList patterns;
+        for (const char * pattern : GenBankPatterns) {
+            patterns << pattern;
+        }
+        Q_FOREACH(const QFileInfo & entry, QDir(argument).entryInfoList(patterns, QDir::Files, QDir::Name)) {
+            result->append(entry.filePath());
+        }
+        return;
+    }
+    if (argument.contains(QRegExp("[*?\\[]"))) {
+        // Shell did not expand it, e.g. too many files for a command line
+        Q_FOREACH(const QFileInfo & entry,
+                  info.dir().entryInfoList(QStringList() << info.fileName(), QDir::Files, QDir::Name)) {
+            result->append(entry.filePath());
+        }
+        return;
+    }
+    QString fileName = argument;
+    // Earlier runs decompressed inputs in place, such copies are read as is
+    if (fileName.endsWith(".gz") && QFile::exists(fileName.left(fileName.length() - 3))) {
+        fileName.chop(3);
+    }
+    result->append(fileName);
+}
+
+}
+
+QStringList FileScheduler::discover(const QStringList &arguments)
+{
+    QStringList result;
+    Q_FOREACH(const QString & argument, arguments) {
+        discoverOne(argument, &result);
+    }
+    result.removeDuplicates();
+    return result;
+}
+
+bool FileScheduler::largerFirst(const InputFile &a, const InputFile &b)
+{
+    return a.size > b.size;
+}
+
+FileScheduler::FileScheduler(const QStringList &fileNames, int workers)
+{
+    QList<InputFile> files;
+    Q_FOREACH(const QString & fileName, fileNames) {
+        const InputFile file = { fileName, QFileInfo(fileName).size() };
+        files.append(file);
+    }
+    qStableSort(files.begin(), files.end(), largerFirst);
+    for (int i=0; i<qMax(1, workers); ++i) {
+        _queues.append(Queue());
+    }
+    Q_FOREACH(const InputFile & file, files) {
+        int lightest = 0;
+        for (int i=1; i<_queues.size(); ++i) {
+            if (_queues[i].bytes < _queues[lightest].bytes) {
+                lightest = i;
+            }
+        }
+        _queues[lightest].files.append(file);
+        _queues[lightest].bytes += file.size;
+    }
+}
+
+bool FileScheduler::next(int worker, QString *fileName)
+{
+    QMutexLocker lock(&_mutex);
+    int victim = worker;
+    if (_queues[worker].files.isEmpty()) {
+        victim = -1;
+        for (int i=0; i<_queues.size(); ++i) {
+            if (!_queues[i].files.isEmpty() && (-1 == victim || _queues[i].bytes > _queues[victim].bytes)) {
+                victim = i;
+            }
+        }
+        if (-1 == victim) {
+            return false;
+        }
+    }
+    // Largest first from own queue and when stealing: small files left
+    // for the end even out finishing times
+    const InputFile file = _queues[victim].files.takeFirst();
+    _queues[victim].bytes -= file.size;
+    if (victim != worker) {
+        _stolen ++;
+        _stolenBytes += file.size;
+    }
+    *fileName = file.fileName;
+    return true;
+}
+
+QString FileScheduler::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Scheduler: %1 files (%2 MB) stolen from other workers' queues")
+            .arg(_stolen)
+            .arg(_stolenBytes / 1048576.0, 0, 'f', 1);
+}
@@ -0,0 +1,48 @@
+#ifndef FILESCHEDULER_H
+#define FILESCHEDULER_H
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// Input files shared by parser threads. Sizes of inputs differ by four
+// orders of magnitude, so files are dealt largest first, each to the
+// worker with the least bytes dealt so far. A worker takes files of its
+// own queue largest first; once it is empty it steals the largest file
+// left in the queue with the most bytes, so nobody finishes hours after
+// the others because of a big file dealt late.
+class FileScheduler
+{
+public:
+    // Positional arguments to file names: directories give their GenBank
+    // files (*.gbk, *.gbff, *.gb, gzipped or not), wildcards are expanded,
+    // @LIST names a text file with an argument per line
+    static QStringList discover(const QStringList & arguments);
+
+    FileScheduler(const QStringList & fileNames, int workers);
+
+    // False when no files are left
+    bool next(int worker, QString * fileName);
+
+    QString report() const;
+
+private:
+    struct InputFile {
+        QString fileName;
+        qint64 size;
+    };
+    struct Queue {
+        QList<InputFile> files;  // largest first
+        qint64 bytes = 0;
+    };
+
+    static bool largerFirst(const InputFile & a, const InputFile & b);
+
+    mutable QMutex _mutex;
+    QList<Queue> _queues;
+    int _stolen = 0;
+    qint64 _stolenBytes = 0;
+};
+
+#endif // FILESCHEDULER_H
@@ -1,10 +1,14 @@
 #include "gbkparser.h"
 
 #include "database.h"
+#include "memorybudget.h"
+#include "parallelfor.h"
+#include "shardmap.h"
 #include "structures.h"
 
 #include <QDebug>
 #include <QFileInfo>
+#include <QMutexLocker>
 #include <QStringList>
 #include <QThread>
 // #include <QSqlQuery>
@@ -33,11 +37,36 @@ void GbkParser::setDatabase(QSharedPointer<Database> db)
     _db = db;
 }
 
+QSharedPointer<Database> GbkParser::database() const
+{
+    return _db;
+}
+
+void GbkParser::setRouter(ShardRouter *router)
+{
+    _router = router;
+}
+
+void GbkParser::setMemoryBudget(MemoryBudget *budget)
+{
+    _memoryBudget = budget;
+}
+
 void GbkParser::setOverrideOrganismName(const QString &name)
 {
     _overrideOrganismName = name;
 }
 
+void GbkParser::setSkippedRefSeqIds(const QSet<QString> &ids)
+{
+    _skippedRefSeqIds = ids;
+}
+
+bool GbkParser::routingFailed() const
+{
+    return _routingFailed;
+}
+
 bool GbkParser::atEnd() const
 {
     return !_io || !_stream || _stream->atEnd();
@@ -71,6 +100,17 @@ SequencePtr GbkParser::readSequence()
                     ? currentLine.mid(12).trimmed()
                     : QString();
 
+            if ("LOCUS" == prefix && !_skippedRefSeqIds.isEmpty()
+                    && _skippedRefSeqIds.contains(value.section(' ', 0, 0, QString::SectionSkipEmpty))) {
+                skipRecord();
+                return SequencePtr();
+            }
+            if ("LOCUS" == prefix && _memoryBudget) {
+                // Before the origin is read: parsers wait here while
+                // writers catch up
+                const quint32 length = value.section(' ', 1, 1, QString::SectionSkipEmpty).toUInt();
+                seq->memory = _memoryBudget->reserve(MemoryBudget::estimate(length));
+            }
             if (prefix.isEmpty()) {
                 if (topLevelValue.length() > 0) {
                     topLevelValue.push_back('\n');
@@ -81,6 +121,11 @@ SequencePtr GbkParser::readSequence()
                 if (topLevelName.length() > 0) {
                     parseTopLevel(topLevelName, topLevelValue, seq);
                 }
+                if (_unrouted) {
+                    _unrouted = false;
+                    skipRecord();
+                    return SequencePtr();
+                }
                 if (State::Features == _state) {
                     secondLevelName = prefix;
                     secondLevelValue = value;
@@ -134,18 +179,23 @@ SequencePtr GbkParser::readSequence()
     if (seq->genes.isEmpty() && seq->description.isEmpty()) {
         seq.clear();
     }else {
-        // qDebug() << "making real";
-        makeRealExons(seq);
-        // qDebug() << "filling introns& exons";
-        fillIntronsAndExonsFromOrigin(seq);
-        // qDebug() << "check main error";
-        checkIsoformsMainErrors(seq);
-        // qDebug() << "finish checking";
+        finishGenes(seq);
     }
 
     return seq;
 }
 
+void GbkParser::skipRecord()
+{
+    while (!atEnd()) {
+        const QString currentLine = _stream->readLine();
+        _currentLineNo += 1;
+        if ("//" == currentLine.trimmed()) {
+            break;
+        }
+    }
+}
+
 GenePtr GbkParser::findGeneMatchingLocation(
         const QList<GenePtr> &genes,
         const quint32 start, const quint32 end,
@@ -278,14 +328,26 @@ void GbkParser::parseTopLevel(const QString &prefix, QString value, SequencePtr
                 ? lines[0].trimmed()
                 : _overrideOrganismName;
         // qDebug() << "parse organism";
-        seq->organism = _db->findOrCreateOrganism(name).toWeakRef();
-        if (seq->organism.toStrongRef()->taxonomyList.size() == 0) {
+        if (_router) {
+            QSharedPointer<Database> shardDb = _router->database(name);
+            if (!shardDb) {
+                // Never stored into another shard instead
+                _unrouted = _routingFailed = true;
+                return;
+            }
+            _db = shardDb;
+            seq->shard = _router->currentShard();
+        }
+        OrganismPtr organism = _db->findOrCreateOrganism(name);
+        seq->organism = organism.toWeakRef();
+        QMutexLocker lock(&organism->mutex);
+        if (organism->taxonomyList.size() == 0) {
             for (int i=1; i<lines.size(); ++i) {
                 const QStringList words = lines[i].split(';', QString::SkipEmptyParts);
                 Q_FOREACH (QString word, words) {
                     word.replace('.', "");
                     word = word.simplified();
-                    seq->organism.toStrongRef()->taxonomyList.append(word);
+                    organism->taxonomyList.append(word);
                 }
             }
         }
@@ -324,14 +386,18 @@ void GbkParser::parseSecondLevel(const QString &prefix, QString value, SequenceP
     else if ("source" == prefix) {
         // qDebug() << "in source";
         const auto attrs = parseFeatureAttributes(value);
+        OrganismPtr organism = seq->organism.toStrongRef();
+        // Shared with other parsers and with the parse cache writer
+        organism->mutex.lock();
         if (attrs.contains("organelle")) {
-            seq->organism.toStrongRef()->dbMitochondria =
+            organism->dbMitochondria =
                     "mitochondrion" == attrs["organelle"];
         }
         if (attrs.contains("db_xref")) {
-            seq->organism.toStrongRef()->taxonomyXref =
+            organism->taxonomyXref =
                     attrs["db_xref"];
         }
+        organism->mutex.unlock();
         if (attrs.contains("organism")) {
             //Q_ASSERT(seq->organism.toStrongRef()->name == attrs["organism"]);
         }
@@ -385,10 +451,7 @@ GenePtr GbkParser::parseGene(const QString & value, SequencePtr seq)
     }
     gene->isPseudoGene = attrs.contains("pseudo") || attrs.contains("pseudogene");
     if (seq->chromosome && seq->chromosome.toStrongRef()->name.toLower().startsWith("unk")) {
-        OrganismPtr organism = seq->organism.toStrongRef();
-        organism->mutex.lock();
-        organism->unknownProtGenesCount++;
-        organism->mutex.unlock();
+        seq->counters.unknownProtGenesCount++;
     }
     return gene;
 }
@@ -409,17 +472,14 @@ void GbkParser::parseCdsOrRna(const QString & prefix,
     QRegExp gi_reg = QRegExp("^GI:*");
     GenePtr targetGene;
     IsoformPtr targetIsoform;
-    OrganismPtr organism = seq->organism.toStrongRef();
 
     if ("CDS" == prefix) {
         // CDS might have non-coding bounds inside gene
         targetGene = findGeneContainingLocation(allGenes, start, end, bw);
-        const QString & refSeqId = seq->refSeqId;
         const QString dbXref = attrs.contains("db_xref") ? attrs["db_xref"] : QString();
         const QString product = attrs.contains("product") ? attrs["product"] : QString();
         if (! targetGene) {
-            _db->addOrphanedCDS(seq->sourceFileName, _featureStartLineNo, _currentLineNo,
-                                refSeqId, dbXref, product);
+            addOrphanedCds(seq, dbXref, product);
             return;
         }
 
@@ -437,8 +497,7 @@ void GbkParser::parseCdsOrRna(const QString & prefix,
            //         QString("Can't find mRNA for CDS: { protein = %1, sequenceFile = %2 }")
            //         .arg(protName).arg(seqFileName);
            // qWarning() << message;
-            _db->addOrphanedCDS(seq->sourceFileName, _featureStartLineNo, _currentLineNo,
-                                refSeqId, dbXref, product);
+            addOrphanedCds(seq, dbXref, product);
             return;
         }
 
@@ -452,12 +511,10 @@ void GbkParser::parseCdsOrRna(const QString & prefix,
 
         targetIsoform->type = Isoform::CDS;
         targetGene->hasCDS = true;
-        organism->mutex.lock();
-        organism->cdsCount ++;
+        seq->counters.cdsCount ++;
         if (seq->chromosome && seq->chromosome.toStrongRef()->name.toLower().startsWith("unk")) {
-            organism->unknownProtCdsCount ++;
+            seq->counters.unknownProtCdsCount ++;
         }
-        organism->mutex.unlock();
 
         targetIsoform->cdsStart = start;
         targetIsoform->cdsEnd = end;
@@ -484,9 +541,7 @@ void GbkParser::parseCdsOrRna(const QString & prefix,
         }
         else {
             targetGene->hasRNA = true;
-            organism->mutex.lock();
-            organism->rnaCount ++;
-            organism->mutex.unlock();
+            seq->counters.rnaCount ++;
         }
     }
 
@@ -541,6 +596,18 @@ void GbkParser::parseCdsOrRna(const QString & prefix,
     }
 }
 
+void GbkParser::addOrphanedCds(SequencePtr seq, const QString &dbXref, const QString &product)
+{
+    OrphanedCds cds;
+    cds.lineStart = _featureStartLineNo;
+    cds.lineEnd = _currentLineNo;
+    cds.dbXref = dbXref;
+    cds.product = product;
+    seq->orphanedCdses.append(cds);
+    _db->addOrphanedCDS(seq->sourceFileName, cds.lineStart, cds.lineEnd,
+                        seq->refSeqId, dbXref, product);
+}
+
 void GbkParser::createIntronsAndExons(IsoformPtr isoform,
                                       bool rna, bool bw,
                                       const QList<quint32> &starts,
@@ -699,23 +766,30 @@ QByteArray GbkParser::dnaReverseComplement(const QByteArray &origin,
     return result;
 }
 
-void GbkParser::fillIntronsAndExonsFromOrigin(SequencePtr seq)
+QByteArray GbkParser::featureOrigin(const QByteArray &origin, qint32 start, qint32 end, bool bw)
 {
+    return bw
+            ? dnaReverseComplement(origin, start, end)
+            : origin.mid(start-1, end-start+1);
+}
+
+void GbkParser::finishGenes(SequencePtr seq)
+{
+    // Genes are independent once the origin is read, so tens of thousands
+    // of genes of a chromosome are finished by the thread pool. Each gene
+    // only changes its own isoforms, exons and introns.
+    const QList<GenePtr> genes = seq->genes;
     const QByteArray & origin = seq->origin;
-    Q_FOREACH(GenePtr gene, seq->genes) {
+    parallelFor(genes.size(), GenesPerTask, [&](int i) {
+        const GenePtr & gene = genes.at(i);
+        makeRealExons(gene);
         Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
             fillIntronsAndExonsFromOrigin(isoform, origin);
         }
-    }
-}
-
-void GbkParser::checkIsoformsMainErrors(SequencePtr seq)
-{
-    Q_FOREACH(GenePtr gene, seq->genes) {
         Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
             checkIsoformError(isoform);
         }
-    }
+    });
 }
 
 void GbkParser::checkIsoformError(IsoformPtr isoform){
@@ -753,31 +827,29 @@ bool exonLessThan(const ExonPtr v1, const ExonPtr v2)
    return true;
 }
 
-void GbkParser::makeRealExons(SequencePtr seq)
+void GbkParser::makeRealExons(GenePtr gene)
 {
-    Q_FOREACH(GenePtr gene, seq->genes) {
-        QList<ExonPtr> exons;
-        QList<RealExonPtr> real_exons;
-        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
-            Q_FOREACH(ExonPtr exon, isoform->exons) {
-                exons.push_back(exon);
-            };
-        }
-        qSort(exons.begin(), exons.end(), exonLessThan);
-        int current_id = 0;
-        int current_start = -100;
-        int current_end = -100;
-        
-        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
-            Q_FOREACH(ExonPtr exon, isoform->exons) {
-                if ((int(exon->start) == current_start) && (int(exon->end) == current_end)){
-                    exon->real_exon_id = current_id;
-                }else{
-                    current_id++;
-                    exon->real_exon_id = current_id;
-                    current_start = exon->start;
-                    current_end = exon->end;            
-                }
+    QList<ExonPtr> exons;
+    QList<RealExonPtr> real_exons;
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        Q_FOREACH(ExonPtr exon, isoform->exons) {
+            exons.push_back(exon);
+        };
+    }
+    qSort(exons.begin(), exons.end(), exonLessThan);
+    int current_id = 0;
+    int current_start = -100;
+    int current_end = -100;
+
+    Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+        Q_FOREACH(ExonPtr exon, isoform->exons) {
+            if ((int(exon->start) == current_start) && (int(exon->end) == current_end)){
+                exon->real_exon_id = current_id;
+            }else{
+                current_id++;
+                exon->real_exon_id = current_id;
+                current_start = exon->start;
+                current_end = exon->end;
             }
         }
     }
@@ -823,9 +895,7 @@ void GbkParser::fillIntronsAndExonsFromOrigin(IsoformPtr isoform,
         const qint32 exonStart = exon->start;
         const qint32 exonEnd = exon->end;
 
-        exon->origin = bw
-                ? dnaReverseComplement(origin, exonStart, exonEnd)
-                : origin.mid(exonStart-1, exonEnd-exonStart+1);
+        exon->origin = featureOrigin(origin, exonStart, exonEnd, bw);
         // qDebug() << "EXON : ";
         // qDebug() << "Start: " << exonStart << " End: " << exonEnd;
         // qDebug() << bw;
@@ -846,9 +916,7 @@ void GbkParser::fillIntronsAndExonsFromOrigin(IsoformPtr isoform,
         Q_ASSERT(intronStart > start);
         Q_ASSERT(intronEnd < end);
 
-        intron->origin = bw
-                ? dnaReverseComplement(origin, intronStart, intronEnd)
-                : origin.mid(intronStart-1, intronEnd-intronStart+1);
+        intron->origin = featureOrigin(origin, intronStart, intronEnd, bw);
         // qDebug() << "INTRON : ";
         // qDebug() << "Start: " << intronStart << " End: " << intronEnd;
         // qDebug() << bw;
@@ -4,19 +4,36 @@
 #include "structures.h"
 
 #include <QIODevice>
+#include <QSet>
 #include <QTextStream>
 
 class Database;
+class MemoryBudget;
+class ShardRouter;
 
 class GbkParser
 {
 public:
     void setSource(QIODevice * sourceStream, const QString &fileName);
     void setDatabase(QSharedPointer<Database> db);
+    QSharedPointer<Database> database() const;
+    // Sharded load: database is chosen by organism of each sequence
+    void setRouter(ShardRouter * router);
     void setOverrideOrganismName(const QString & name);
+    // Records with these RefSeq ids are skipped right after LOCUS line,
+    // readSequence() returns null for them
+    void setSkippedRefSeqIds(const QSet<QString> & ids);
+    // Each record reserves its estimated size at LOCUS line, waiting for
+    // room if needed
+    void setMemoryBudget(MemoryBudget * budget);
+    // Some records were skipped, their shard database can't be opened
+    bool routingFailed() const;
     bool atEnd() const;
     SequencePtr readSequence();
 
+    // Exon or intron origin, reverse complemented for backward chains
+    static QByteArray featureOrigin(const QByteArray & origin, qint32 start, qint32 end, bool bw);
+
 private:
     static GenePtr findGeneMatchingLocation(const QList<GenePtr> &genes,
                                             const quint32 start,
@@ -35,22 +52,25 @@ private:
             const QList<quint32> & starts, const QList<quint32> & ends,
             const bool backwardChain);
 
+    void skipRecord();
     void parseTopLevel(const QString & prefix, QString value, SequencePtr seq);
     void parseSecondLevel(const QString & prefix, QString value, SequencePtr seq);
 
     GenePtr parseGene(const QString & value, SequencePtr seq);
     void parseCdsOrRna(const QString & prefix, const QString & value, SequencePtr seq);
+    void addOrphanedCds(SequencePtr seq, const QString & dbXref, const QString & product);
 
     void createIntronsAndExons(IsoformPtr isoform, bool rna, bool bw,
                                const QList<quint32> & starts,
                                const QList<quint32> ends,
                                const QMap<QString,QString> attrs);
-    void checkIsoformsMainErrors(SequencePtr seq);
+    // Real exons, exon and intron origins and errors of every gene, called
+    // once the origin is read; genes are done in parallel (see parallelFor)
+    void finishGenes(SequencePtr seq);
     void checkIsoformError(IsoformPtr isoform);
 
     static QByteArray dnaReverseComplement(const QByteArray & origin, int start, int end);
-    void makeRealExons(SequencePtr seq);
-    void fillIntronsAndExonsFromOrigin(SequencePtr seq);
+    void makeRealExons(GenePtr gene);
     void fillIntronsAndExonsFromOrigin(IsoformPtr isoform, const QByteArray & origin);
 
     void parseRange(const QString & value, quint32 * start, quint32 * end, bool * bw,
@@ -59,6 +79,8 @@ private:
 
 
 
+    enum { GenesPerTask = 64 };
+
     enum State {
         TopLevel, Features, Origin
     } _state = TopLevel;
@@ -69,7 +91,12 @@ private:
     quint32 _currentLineNo = 0u;
     QString _fileName;
     QSharedPointer<Database> _db;
+    ShardRouter * _router = nullptr;
+    bool _unrouted = false;  // current record
+    bool _routingFailed = false;
     QString _overrideOrganismName;
+    QSet<QString> _skippedRefSeqIds;
+    MemoryBudget * _memoryBudget = nullptr;
 };
 
 #endif // GBKPARSER_H
@@ -0,0 +1,219 @@
+#include "genomestore.h"
+#include "origincodec.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QStringList>
+#include <QTextStream>
+
+QMutex GenomeStore::_storesMutex;
+QMap<QString, QSharedPointer<GenomeStore> > GenomeStore::_stores;
+QList<GenomeStore*> GenomeStore::_openStores;
+
+QSharedPointer<GenomeStore> GenomeStore::forOrganism(const QDir &dir, const QString &organismName)
+{
+    const QString fileName = dir.absoluteFilePath(fileNameFor(organismName));
+    QMutexLocker lock(&_storesMutex);
+    QSharedPointer<GenomeStore> store = _stores.value(fileName);
+    if (!store) {
+        store = QSharedPointer<GenomeStore>(new GenomeStore(fileName));
+    }
+    store->_mutex.lock();
+    const bool opened = store->openForAppend();
+    store->_mutex.unlock();
+    if (!opened) {
+        return QSharedPointer<GenomeStore>();
+    }
+    _stores[fileName] = store;
+    _openStores.removeOne(store.data());
+    _openStores.append(store.data());
+    if (_openStores.size() > MaxOpenStores) {
+        // Every append is flushed, nothing is lost by closing
+        _openStores.takeFirst()->close();
+    }
+    return store;
+}
+
+void GenomeStore::closeAll()
+{
+    QMutexLocker lock(&_storesMutex);
+    Q_FOREACH(QSharedPointer<GenomeStore> store, _stores) {
+        store->close();
+    }
+    _stores.clear();
+    _openStores.clear();
+}
+
+QSharedPointer<GenomeStore> GenomeStore::openForReading(const QString &fileName)
+{
+    QSharedPointer<GenomeStore> store(new GenomeStore(fileName));
+    if (!store->load()) {
+        store.clear();
+    }
+    return store;
+}
+
+QString GenomeStore::fileNameFor(const QString &organismName)
+{
+    QString result = organismName;
+    result.replace(QRegExp("\\s+"), "_");
+    result.replace(QRegExp("[(),./\\]"), "");
+    return result.toLower() + ".pack";
+}
+
+QByteArray GenomeStore::reverseComplement(const QByteArray &origin)
+{
+    const int length = origin.size();
+    QByteArray result(length, 'N');
+    for (int i=0; i<length; ++i) {
+        switch (origin[length - i - 1]) {
+        case 'A': result[i] = 'T'; break;
+        case 'T': result[i] = 'A'; break;
+        case 'G': result[i] = 'C'; break;
+        case 'C': result[i] = 'G'; break;
+        default: break;
+        }
+    }
+    return result;
+}
+
+GenomeStore::GenomeStore(const QString &fileName)
+    : _data(fileName)
+    , _index(fileName + ".idx")
+{
+}
+
+GenomeStore::~GenomeStore()
+{
+    close();
+}
+
+QString GenomeStore::fileName() const
+{
+    return QFileInfo(_data.fileName()).fileName();
+}
+
+bool GenomeStore::openForAppend()
+{
+    if (_data.isOpen()) {
+        return true;
+    }
+    if (!_data.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Can't open '" << _data.fileName() << "'. Sequences will not be stored!";
+        return false;
+    }
+    if (!_index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Can't open '" << _index.fileName() << "'. Sequences will not be stored!";
+        _data.close();
+        return false;
+    }
+    _dataSize = _data.size();
+    return true;
+}
+
+bool GenomeStore::append(const QString &refSeqId, const QByteArray &origin)
+{
+    const QByteArray value = OriginCodec::encode(origin, OriginCodec::Packed);
+
+    QMutexLocker lock(&_mutex);
+    // Closed as least recently used after the caller got it
+    if (!openForAppend()) {
+        return false;
+    }
+    if (_data.write(value) != value.size() || !_data.flush()) {
+        qWarning() << "Can't write '" << _data.fileName() <<
+                      "' (possible out of space). Sequence '" << refSeqId << "' will not be stored!";
+        // Skip whatever part was written, the index never points there
+        _dataSize = _data.size();
+        return false;
+    }
+    // Index line goes after the data, so it never refers to a partial value
+    const QByteArray line = QString("%1\t%2\t%3\t%4\n")
+            .arg(refSeqId).arg(_dataSize).arg(value.size()).arg(origin.size())
+            .toLatin1();
+    _dataSize += value.size();
+    if (_index.write(line) != line.size() || !_index.flush()) {
+        qWarning() << "Can't write '" << _index.fileName() << "'. Sequence '" << refSeqId <<
+                      "' will not be stored!";
+        return false;
+    }
+    return true;
+}
+
+bool GenomeStore::load()
+{
+    if (!_index.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Can't open '" << _index.fileName() << "'";
+        return false;
+    }
+    while (!_index.atEnd()) {
+        const QStringList fields = QString::fromLatin1(_index.readLine()).trimmed().split('\t');
+        if (4 != fields.size()) {
+            continue;
+        }
+        Entry entry;
+        entry.offset = fields[1].toLongLong();
+        entry.size = fields[2].toLongLong();
+        entry.length = fields[3].toUInt();
+        _entries[fields[0]] = entry;
+    }
+    _index.close();
+
+    if (!_data.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open '" << _data.fileName() << "'";
+        return false;
+    }
+    _dataSize = _data.size();
+    if (_dataSize > 0) {
+        _map = _data.map(0, _dataSize);
+        if (!_map) {
+            qWarning() << "Can't map '" << _data.fileName() << "': " << _data.errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+void GenomeStore::close()
+{
+    QMutexLocker lock(&_mutex);
+    if (_map) {
+        _data.unmap(const_cast<uchar*>(_map));
+        _map = nullptr;
+    }
+    if (_data.isOpen()) {
+        _data.close();
+    }
+    if (_index.isOpen()) {
+        _index.close();
+    }
+}
+
+bool GenomeStore::contains(const QString &refSeqId) const
+{
+    return _entries.contains(refSeqId);
+}
+
+QByteArray GenomeStore::slice(const QString &refSeqId, qint32 start, qint32 end, bool backward) const
+{
+    if (!_map || !_entries.contains(refSeqId)) {
+        qWarning() << "No sequence " << refSeqId << " in " << _data.fileName();
+        return QByteArray();
+    }
+    const Entry entry = _entries[refSeqId];
+    if (entry.offset + entry.size > _dataSize) {
+        qWarning() << "Sequence " << refSeqId << " is beyond the end of " << _data.fileName();
+        return QByteArray();
+    }
+    const qint32 from = qMax(1, qMin(start, end));
+    const qint32 to = qMax(start, end);
+    if (to < from || quint32(from) > entry.length) {
+        return QByteArray();
+    }
+    const QByteArray result = OriginCodec::unpackRange(
+                reinterpret_cast<const char*>(_map) + entry.offset, entry.size,
+                from - 1, to - from + 1);
+    return backward ? reverseComplement(result) : result;
+}
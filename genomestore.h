@@ -0,0 +1,80 @@
+#ifndef GENOMESTORE_H
+#define GENOMESTORE_H
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+// Per-organism file of packed sequence origins, the random access source
+// of exon and intron sequences in coordinates-only mode (--seqstore=packed).
+//
+//   <organism>.pack      OriginCodec packed values written back to back
+//   <organism>.pack.idx  one line per sequence: refseq_id, offset, size, length
+//
+// Writers append under the store mutex, so all the writer threads storing
+// sequences of the same organism share one instance. A sequence stored
+// again on reload is appended once more and the later index line wins.
+// Only the most recently used writers keep their files open, others are
+// closed and reopened for append when their organism comes again.
+// Readers map the data file and unpack only the requested slice.
+class GenomeStore
+{
+public:
+    // Shared writer of the organism store in dir
+    static QSharedPointer<GenomeStore> forOrganism(const QDir & dir, const QString & organismName);
+    // Flush and close all the writers
+    static void closeAll();
+
+    // Reader of an existing store, fileName is the .pack file
+    static QSharedPointer<GenomeStore> openForReading(const QString & fileName);
+
+    // File name without directory, as stored in sequences.origin_file_name
+    static QString fileNameFor(const QString & organismName);
+
+    // Same as GbkParser::dnaReverseComplement() of the whole value
+    static QByteArray reverseComplement(const QByteArray & origin);
+
+    ~GenomeStore();
+
+    QString fileName() const;
+
+    bool append(const QString & refSeqId, const QByteArray & origin);
+
+    bool contains(const QString & refSeqId) const;
+    // Bases start..end, 1-based inclusive in either order, reverse
+    // complemented for backward chains the same way the parser does
+    QByteArray slice(const QString & refSeqId, qint32 start, qint32 end, bool backward) const;
+
+private:
+    enum { MaxOpenStores = 64 };  // two files each
+
+    struct Entry {
+        qint64 offset = 0;
+        qint64 size = 0;
+        quint32 length = 0;
+    };
+
+    explicit GenomeStore(const QString & fileName);
+    bool openForAppend();  // under _mutex, nothing to do if open
+    bool load();
+    void close();
+
+    QFile _data;
+    QFile _index;
+    QMutex _mutex;
+    QHash<QString, Entry> _entries;
+    qint64 _dataSize = 0;
+    const uchar * _map = nullptr;
+
+    static QMutex _storesMutex;
+    static QMap<QString, QSharedPointer<GenomeStore> > _stores;
+    static QList<GenomeStore*> _openStores;  // least recently used first
+};
+
+#endif // GENOMESTORE_H
@@ -0,0 +1,134 @@
+#include "inputmanifest.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+bool InputManifest::load(QSharedPointer<Database> db)
+{
+    QMutexLocker lock(&_mutex);
+    _entries = db->inputManifest();
+    qDebug() << "Input manifest has " << _entries.size() << " files";
+    return true;
+}
+
+QString InputManifest::key(const QString &inputFileName)
+{
+    // Same as the journal: inputs of the same name may come from
+    // different directories
+    const QFileInfo info(inputFileName);
+    const QString canonical = info.canonicalFilePath();
+    return canonical.isEmpty() ? info.absoluteFilePath() : canonical;
+}
+
+QString InputManifest::contentHash(const QString &fileName)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QFile input(fileName);
+    if (!input.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    while (!input.atEnd()) {
+        hash.addData(input.read(1024 * 1024));
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+bool InputManifest::unchanged(const QString &inputFileName)
+{
+    const QString name = key(inputFileName);
+    const QFileInfo info(inputFileName);
+    QMutexLocker lock(&_mutex);
+    if (!_entries.contains(name) || _entries[name].size != info.size()) {
+        return false;
+    }
+    InputFileEntry entry = _entries[name];
+    const qint64 modified = info.lastModified().toTime_t();
+    if (entry.modified == modified) {
+        _skippedFiles ++;
+        return true;
+    }
+    lock.unlock();
+
+    const QString hash = contentHash(inputFileName);
+
+    lock.relock();
+    _hashedFiles ++;
+    entry.modified = modified;
+    if (hash != entry.contentHash) {
+        // Hashed already, fileStarted() takes it from here
+        entry.contentHash = hash;
+        _parsing[name] = entry;
+        return false;
+    }
+    // Only the time has changed: next run needs a stat only
+    _entries[name] = entry;
+    _unsaved.append(entry);
+    _skippedFiles ++;
+    return true;
+}
+
+void InputManifest::fileStarted(const QString &inputFileName)
+{
+    const QString name = key(inputFileName);
+    const QFileInfo info(inputFileName);
+    QMutexLocker lock(&_mutex);
+    InputFileEntry entry = _parsing.value(name);
+    lock.unlock();
+
+    if (entry.contentHash.isEmpty()) {
+        entry.contentHash = contentHash(inputFileName);
+    }
+    entry.fileName = name;
+    entry.size = info.size();
+    entry.modified = info.lastModified().toTime_t();
+    entry.sequencesCount = 0;
+    entry.lastGbkDate = QDate();
+
+    lock.relock();
+    _parsing[name] = entry;
+}
+
+void InputManifest::sequenceParsed(const QString &inputFileName, SequencePtr sequence)
+{
+    QMutexLocker lock(&_mutex);
+    InputFileEntry & entry = _parsing[key(inputFileName)];
+    entry.sequencesCount ++;
+    if (!entry.lastGbkDate.isValid() || entry.lastGbkDate < sequence->gbk_date) {
+        entry.lastGbkDate = sequence->gbk_date;
+    }
+}
+
+void InputManifest::fileStored(const QString &inputFileName)
+{
+    const QString name = key(inputFileName);
+    QMutexLocker lock(&_mutex);
+    if (!_parsing.contains(name)) {
+        return;
+    }
+    const InputFileEntry entry = _parsing.take(name);
+    _entries[name] = entry;
+    _unsaved.append(entry);
+    _storedFiles ++;
+}
+
+void InputManifest::flush(QSharedPointer<Database> db)
+{
+    QMutexLocker lock(&_mutex);
+    const QList<InputFileEntry> entries = _unsaved;
+    _unsaved.clear();
+    lock.unlock();
+    db->storeInputManifest(entries);
+}
+
+QString InputManifest::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Incremental: %1 files unchanged, %2 hashed to check, %3 loaded")
+            .arg(_skippedFiles)
+            .arg(_hashedFiles)
+            .arg(_storedFiles);
+}
@@ -0,0 +1,51 @@
+#ifndef INPUTMANIFEST_H
+#define INPUTMANIFEST_H
+
+#include "database.h"
+#include "structures.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+// Input files already loaded (--incremental), kept in input_manifest table
+// of the main database. A file whose size and modification time match its
+// row is skipped at the cost of a stat; the content is hashed only when
+// size matches but time does not, e.g. the same file downloaded again.
+// Within changed files sequences of the same version are not stored again.
+class InputManifest
+{
+public:
+    bool load(QSharedPointer<Database> db);
+
+    bool unchanged(const QString & inputFileName);
+
+    // Called by parser threads while reading a changed file
+    void fileStarted(const QString & inputFileName);
+    void sequenceParsed(const QString & inputFileName, SequencePtr sequence);
+
+    // Called by LoadJournal once all the sequences of the file are stored
+    void fileStored(const QString & inputFileName);
+
+    // Write rows of files stored since the previous call
+    void flush(QSharedPointer<Database> db);
+
+    QString report() const;
+
+    static QString contentHash(const QString & fileName);
+
+private:
+    static QString key(const QString & inputFileName);
+
+    mutable QMutex _mutex;
+    QHash<QString, InputFileEntry> _entries;
+    QHash<QString, InputFileEntry> _parsing;
+    QList<InputFileEntry> _unsaved;
+    quint32 _skippedFiles = 0;
+    quint32 _hashedFiles = 0;
+    quint32 _storedFiles = 0;
+};
+
+#endif // INPUTMANIFEST_H
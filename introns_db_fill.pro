@@ -23,7 +23,23 @@ SOURCES += main.cpp \
     database.cpp \
     gzipreader.cpp \
     iniparser.cpp \
-    logger.cpp
+    logger.cpp \
+    backend.cpp \
+    statementcache.cpp \
+    writerpool.cpp \
+    connectionpool.cpp \
+    shardmap.cpp \
+    origincodec.cpp \
+    genomestore.cpp \
+    fastastore.cpp \
+    translationexporter.cpp \
+    featureexporter.cpp \
+    parsecache.cpp \
+    loadjournal.cpp \
+    inputmanifest.cpp \
+    filescheduler.cpp \
+    parallelfor.cpp \
+    memorybudget.cpp
 
 HEADERS += \
     gbkparser.h \
@@ -31,12 +47,34 @@ HEADERS += \
     database.h \
     gzipreader.h \
     iniparser.h \
-    logger.h
+    logger.h \
+    backend.h \
+    statementcache.h \
+    writerpool.h \
+    dimensioncache.h \
+    connectionpool.h \
+    shardmap.h \
+    origincodec.h \
+    genomestore.h \
+    fastastore.h \
+    translationexporter.h \
+    featureexporter.h \
+    sequencesink.h \
+    parsecache.h \
+    loadjournal.h \
+    inputmanifest.h \
+    filescheduler.h \
+    parallelfor.h \
+    memorybudget.h
 
-RESOURCES +=
+RESOURCES += \
+    schema.qrc
 
 DISTFILES += \
     create_database.sql \
+    create_database_partitioned.sql \
+    create_database_compact.sql \
+    create_database_sqlite.sql \
     README.md
 
 isEmpty(PREFIX): PREFIX = /usr/local
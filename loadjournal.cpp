@@ -0,0 +1,154 @@
+#include "loadjournal.h"
+#include "inputmanifest.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QTextStream>
+
+bool LoadJournal::open(const QString &fileName, bool resume)
+{
+    QMutexLocker lock(&_mutex);
+    _file.setFileName(fileName);
+    if (resume && _file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&_file);
+        in.setCodec("UTF-8");
+        while (!in.atEnd()) {
+            // The last line may be cut if the previous run was killed
+            const QStringList fields = in.readLine().split('\t');
+            if (3 == fields.size() && "sequence" == fields[0]) {
+                _storedSequences[fields[1]].insert(fields[2]);
+                _resumedSequences ++;
+            }
+            else if (2 == fields.size() && "file" == fields[0]) {
+                _doneFiles.insert(fields[1]);
+            }
+        }
+        _file.close();
+        qDebug() << QString("Resuming: %1 files and %2 sequences already loaded")
+                    .arg(_doneFiles.size()).arg(_resumedSequences);
+    }
+    else if (resume) {
+        qWarning() << "No journal '" << fileName << "' to resume from, loading everything";
+    }
+    const QIODevice::OpenMode mode = resume
+            ? QIODevice::WriteOnly | QIODevice::Append
+            : QIODevice::WriteOnly | QIODevice::Truncate;
+    if (!_file.open(mode)) {
+        qWarning() << "Can't open journal '" << fileName << "'";
+        return false;
+    }
+    return true;
+}
+
+void LoadJournal::close()
+{
+    QMutexLocker lock(&_mutex);
+    _file.close();
+}
+
+void LoadJournal::setManifest(InputManifest *manifest)
+{
+    QMutexLocker lock(&_mutex);
+    _manifest = manifest;
+}
+
+QString LoadJournal::key(const QString &inputFileName)
+{
+    // Inputs of the same name may come from different directories
+    const QFileInfo info(inputFileName);
+    const QString canonical = info.canonicalFilePath();
+    return canonical.isEmpty() ? info.absoluteFilePath() : canonical;
+}
+
+bool LoadJournal::fileDone(const QString &inputFileName) const
+{
+    QMutexLocker lock(&_mutex);
+    return _doneFiles.contains(key(inputFileName));
+}
+
+QSet<QString> LoadJournal::storedSequences(const QString &inputFileName) const
+{
+    QMutexLocker lock(&_mutex);
+    return _storedSequences.value(key(inputFileName));
+}
+
+void LoadJournal::fileStarted(const QString &inputFileName)
+{
+    QMutexLocker lock(&_mutex);
+    _files[key(inputFileName)] = FileState();
+}
+
+void LoadJournal::sequenceQueued(const QString &inputFileName)
+{
+    QMutexLocker lock(&_mutex);
+    _files[key(inputFileName)].pending ++;
+}
+
+void LoadJournal::fileParsed(const QString &inputFileName, bool complete)
+{
+    QMutexLocker lock(&_mutex);
+    const QString name = key(inputFileName);
+    FileState & state = _files[name];
+    state.parsed = true;
+    state.complete = complete;
+    if (0 == state.pending) {
+        fileFinished(name, state);
+    }
+}
+
+void LoadJournal::enqueue(SequencePtr sequence)
+{
+    const QString name = key(sequence->inputFilePath);
+    QMutexLocker lock(&_mutex);
+    if (sequence->id) {
+        writeLine(QString("sequence\t%1\t%2").arg(name).arg(sequence->refSeqId));
+        _journaledSequences ++;
+    }
+    if (!_files.contains(name)) {
+        return;
+    }
+    FileState & state = _files[name];
+    state.pending --;
+    if (!sequence->id) {
+        state.failed ++;
+    }
+    if (state.parsed && 0 == state.pending) {
+        fileFinished(name, state);
+    }
+}
+
+void LoadJournal::fileFinished(const QString &key, const FileState &state)
+{
+    // Files with sequences not stored are read again on resume
+    if (state.complete && 0 == state.failed) {
+        writeLine(QString("file\t%1").arg(key));
+        _journaledFiles ++;
+        if (_manifest) {
+            _manifest->fileStored(key);
+        }
+    }
+    _files.remove(key);
+}
+
+void LoadJournal::writeLine(const QString &line)
+{
+    if (!_file.isOpen()) {
+        return;
+    }
+    const QByteArray data = (line + '\n').toUtf8();
+    // Flushed line by line: the journal must survive the process
+    if (_file.write(data) != data.size() || !_file.flush()) {
+        qWarning() << "Can't write journal '" << _file.fileName() << "' (possible out of space)";
+    }
+}
+
+QString LoadJournal::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Journal: %1 files and %2 sequences stored, %3 sequences resumed")
+            .arg(_journaledFiles)
+            .arg(_journaledSequences)
+            .arg(_resumedSequences);
+}
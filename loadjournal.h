@@ -0,0 +1,74 @@
+#ifndef LOADJOURNAL_H
+#define LOADJOURNAL_H
+
+#include "sequencesink.h"
+#include "structures.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+class InputManifest;
+
+// Progress of a run kept in a text file (--journal), so a run killed after
+// hours of loading goes on from where it stopped (--resume). Lines are
+//
+//   sequence <TAB> input file <TAB> RefSeq id   - stored by a writer
+//   file <TAB> input file                        - all its sequences stored
+//
+// appended and flushed as soon as the database has the data. Input files
+// are named by canonical absolute path, so files of the same name in
+// different directories are told apart.
+class LoadJournal
+        : public SequenceSink
+{
+public:
+    // Without resume the journal starts empty, otherwise lines of previous
+    // runs are loaded and new ones are appended
+    bool open(const QString & fileName, bool resume);
+    void close();
+
+    // --incremental: completely stored files go to the manifest
+    void setManifest(InputManifest * manifest);
+
+    // State of previous runs
+    bool fileDone(const QString & inputFileName) const;
+    QSet<QString> storedSequences(const QString & inputFileName) const;
+
+    // Called by parser threads around and while reading a file. A file is
+    // done when it was parsed to the end and writers stored everything.
+    void fileStarted(const QString & inputFileName);
+    void sequenceQueued(const QString & inputFileName);
+    void fileParsed(const QString & inputFileName, bool complete);
+
+    // Called by writers once a sequence is committed
+    void enqueue(SequencePtr sequence) override;
+
+    QString report() const;
+
+private:
+    struct FileState {
+        int pending = 0;
+        int failed = 0;
+        bool parsed = false;
+        bool complete = false;
+    };
+
+    static QString key(const QString & inputFileName);
+    void fileFinished(const QString & key, const FileState & state);
+    void writeLine(const QString & line);
+
+    mutable QMutex _mutex;
+    QFile _file;
+    InputManifest * _manifest = nullptr;
+    QSet<QString> _doneFiles;
+    QHash<QString, QSet<QString> > _storedSequences;
+    QHash<QString, FileState> _files;
+    quint64 _resumedSequences = 0;
+    quint64 _journaledSequences = 0;
+    quint64 _journaledFiles = 0;
+};
+
+#endif // LOADJOURNAL_H
@@ -1,31 +1,74 @@
+#include "connectionpool.h"
 #include "database.h"
+#include "featureexporter.h"
+#include "filescheduler.h"
+#include "fastastore.h"
 #include "iniparser.h"
+#include "inputmanifest.h"
+#include "memorybudget.h"
 #include "gbkparser.h"
+#include "genomestore.h"
 #include "gzipreader.h"
+#include "loadjournal.h"
 #include "logger.h"
+#include "origincodec.h"
+#include "parsecache.h"
+#include "shardmap.h"
+#include "translationexporter.h"
+#include "writerpool.h"
 #include "string"
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
 #include <QSemaphore>
 #include <QSharedPointer>
 #include <QString>
+#include <QTextStream>
 #include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <csignal>
 // #include <QSqlQuery>
 
 struct Arguments {
+    QString databaseBackend;  // --backend=...
     QString databaseHost;  // --host=...
     QString databaseUser;  // --user=...
     QString databasePass;  // --pass=...
     QString databaseName;  // --db=...
+    QString loadMode;  // --load-mode=...
+    bool deferIndexes = false;  // --defer-indexes
+    QString shardMapFile;  // --shard-map=...
+    QString shardSchema;  // --shard-schema=...
+    QString originCodec;  // --origin-codec=...
+    QString decode;  // --decode=TABLE:ID[,ID...]
+    QString extract;  // --extract=TABLE:ID[,ID...] or --extract=ORGANISM/REFSEQ:START-END
 
     QString sequencesDir;  // --seqdir=...
+    QString sequenceStore;  // --seqstore=...
+    bool coordinatesOnly = false;  // --coordinates-only
     QString translationsDir;  // --transdir=...
-
-    quint16 maxThreads = 1;  // --threads=...
-
-    QStringList sourceFileNames;    // positional parameters
+    FeatureExportOptions featureExport;  // --export-...
+    QString parseCacheDir;  // --parse-cache=...
+    QString journalFile = "introns_db_fill.journal";  // --journal=...
+    bool resume = false;  // --resume
+    bool incremental = false;  // --incremental
+
+    quint16 parseThreads = 1;  // --parse-threads=... or --threads=...
+    quint16 dbThreads = 0;  // --db-threads=...
+    quint16 geneThreads = 0;  // --gene-threads=...
+    qint64 maxMemory = 0;  // --max-memory=..., bytes
+    quint16 dbConnections = 0;  // --db-connections=...
+    QStringList sessionStatements;  // --session-sql=... (repeatable)
+
+    QStringList sourceFileNames;    // positional parameters: files, directories, wildcards, @LIST
     QString extraDataFile;  // --use-data=...
     QString dataFolder;
 
@@ -38,7 +81,10 @@ Arguments parseArguments()
     Arguments result;
     const QStringList args = qApp->arguments().mid(1);
     Q_FOREACH (const QString & arg, args) {
-        if (arg.startsWith("--host=")) {
+        if (arg.startsWith("--backend=")) {
+            result.databaseBackend = arg.mid(10).toLower();
+        }
+        else if (arg.startsWith("--host=")) {
             result.databaseHost = arg.mid(7);
         }
         else if (arg.startsWith("--user=")) {
@@ -50,14 +96,92 @@ Arguments parseArguments()
         else if (arg.startsWith("--db=")) {
             result.databaseName = arg.mid(5);
         }
+        else if (arg.startsWith("--load-mode=")) {
+            result.loadMode = arg.mid(12).toLower();
+        }
+        else if ("--defer-indexes" == arg) {
+            result.deferIndexes = true;
+        }
+        else if (arg.startsWith("--shard-map=")) {
+            result.shardMapFile = arg.mid(12);
+        }
+        else if (arg.startsWith("--shard-schema=")) {
+            result.shardSchema = arg.mid(15);
+        }
+        else if (arg.startsWith("--origin-codec=")) {
+            result.originCodec = arg.mid(15).toLower();
+        }
+        else if (arg.startsWith("--decode=")) {
+            result.decode = arg.mid(9);
+        }
+        else if (arg.startsWith("--extract=")) {
+            result.extract = arg.mid(10);
+        }
         else if (arg.startsWith("--seqdir=")) {
             result.sequencesDir = arg.mid(9);
         }
+        else if (arg.startsWith("--seqstore=")) {
+            result.sequenceStore = arg.mid(11).toLower();
+        }
+        else if ("--coordinates-only" == arg) {
+            result.coordinatesOnly = true;
+        }
         else if (arg.startsWith("--transdir=")) {
             result.translationsDir = arg.mid(11);
         }
+        else if (arg.startsWith("--export-introns=")) {
+            result.featureExport.intronsFileName = arg.mid(17);
+        }
+        else if (arg.startsWith("--export-exons=")) {
+            result.featureExport.exonsFileName = arg.mid(15);
+        }
+        else if ("--export-main-only" == arg) {
+            result.featureExport.mainIsoformOnly = true;
+        }
+        else if ("--export-no-errors" == arg) {
+            result.featureExport.noErrors = true;
+        }
+        else if (arg.startsWith("--export-min-length=")) {
+            result.featureExport.minLength = arg.mid(20).toUInt();
+        }
+        else if (arg.startsWith("--export-max-length=")) {
+            result.featureExport.maxLength = arg.mid(20).toUInt();
+        }
+        else if (arg.startsWith("--parse-cache=")) {
+            result.parseCacheDir = arg.mid(14);
+        }
+        else if (arg.startsWith("--journal=")) {
+            result.journalFile = arg.mid(10);
+        }
+        else if ("--resume" == arg) {
+            result.resume = true;
+        }
+        else if ("--incremental" == arg) {
+            result.incremental = true;
+        }
         else if (arg.startsWith("--threads=")) {
-            result.maxThreads = arg.mid(10).toUShort();
+            result.parseThreads = arg.mid(10).toUShort();
+        }
+        else if (arg.startsWith("--parse-threads=")) {
+            result.parseThreads = arg.mid(16).toUShort();
+        }
+        else if (arg.startsWith("--db-threads=")) {
+            result.dbThreads = arg.mid(13).toUShort();
+        }
+        else if (arg.startsWith("--gene-threads=")) {
+            result.geneThreads = arg.mid(15).toUShort();
+        }
+        else if (arg.startsWith("--max-memory=")) {
+            result.maxMemory = MemoryBudget::parseSize(arg.mid(13));
+            if (0 == result.maxMemory) {
+                qWarning() << "Wrong memory size " << arg.mid(13) << ". Memory is not limited.";
+            }
+        }
+        else if (arg.startsWith("--db-connections=")) {
+            result.dbConnections = arg.mid(17).toUShort();
+        }
+        else if (arg.startsWith("--session-sql=")) {
+            result.sessionStatements.append(arg.mid(14));
         }
         else if (arg.startsWith("--use-data=")) {
             result.extraDataFile = arg.mid(11);
@@ -68,64 +192,258 @@ Arguments parseArguments()
         else if (!arg.startsWith("-")) {
             QString tmp_arg = result.extraDataFile;
             result.dataFolder = tmp_arg.remove(QRegExp(".bio")) + "/*";
-            tmp_arg = arg;
-            QString file_name = tmp_arg.remove(QRegExp(".gz"));
-            result.sourceFileNames.push_back(file_name);
+            // Expanded and checked for decompressed copies by FileScheduler
+            result.sourceFileNames.push_back(arg);
         }
     }
 
-    if (result.databaseHost.isEmpty()) {
+    result.sourceFileNames = FileScheduler::discover(result.sourceFileNames);
+
+    if (result.databaseBackend.isEmpty()) {
+        result.databaseBackend = "mysql";
+    }
+    if (result.databaseHost.isEmpty() && "mysql" == result.databaseBackend) {
         qWarning() << "DB host name not specified. Using 'localhost'.";
         result.databaseHost = "localhost";
     }
+    if (result.databaseName.isEmpty() && "sqlite" == result.databaseBackend) {
+        qWarning() << "DB file name not specified. Using 'introns.sqlite'.";
+        result.databaseName = "introns.sqlite";
+    }
     if (result.databaseName.isEmpty()) {
         qWarning() << "DB name not specified. Using 'introns'.";
         result.databaseName = "introns";
     }
-    if (result.databaseUser.isEmpty()) {
+    if (result.loadMode.isEmpty()) {
+        result.loadMode = "reload";
+    }
+    else if ("fresh" != result.loadMode && "reload" != result.loadMode
+             && "organism" != result.loadMode && "delta" != result.loadMode) {
+        qWarning() << "Unknown load mode " << result.loadMode << ". Using 'reload'.";
+        result.loadMode = "reload";
+    }
+    OriginCodec::Method originCodec;
+    if (!OriginCodec::methodFromName(result.originCodec, &originCodec)) {
+        qWarning() << "Unknown origin codec " << result.originCodec << ". Using 'text'.";
+        result.originCodec = "text";
+    }
+    if (result.databaseUser.isEmpty() && "mysql" == result.databaseBackend) {
         qWarning() << "DB user name not specified. Using 'root'.";
         result.databaseUser = "root";
     }
     if (result.sequencesDir.isEmpty()) {
         qWarning() << "Directory for storing sequneces not specified. Origins will not be stored!";
     }
+    if (result.sequenceStore.isEmpty()) {
+        result.sequenceStore = result.coordinatesOnly ? "packed" : "raw";
+    }
+    else if ("raw" != result.sequenceStore && "packed" != result.sequenceStore
+             && "fasta" != result.sequenceStore && "bgzf" != result.sequenceStore) {
+        qWarning() << "Unknown sequence store " << result.sequenceStore << ". Using 'raw'.";
+        result.sequenceStore = "raw";
+    }
+    if (result.coordinatesOnly && (result.sequencesDir.isEmpty() || "packed" != result.sequenceStore)) {
+        qWarning() << "Coordinates-only mode needs --seqdir and --seqstore=packed. Origins will be stored in tables.";
+        result.coordinatesOnly = false;
+    }
     if (result.translationsDir.isEmpty()) {
         qWarning() << "Directory for storing translations not specified. Translations will not be stored!";
     }
     if (result.loggerFileName.isEmpty()) {
         qWarning() << "Log file name not specified. Errors will be printed at STDERR.";
     }
-    if (0 == result.maxThreads) {
-        result.maxThreads = qMin(QThread::idealThreadCount(), result.sourceFileNames.size());
-        qWarning() << "Threads count not specified. " << result.maxThreads << " cores will be utilized.";
+    if (0 == result.parseThreads) {
+        result.parseThreads = qMin(QThread::idealThreadCount(), result.sourceFileNames.size());
+        qWarning() << "Threads count not specified. " << result.parseThreads << " cores will be utilized.";
+    }
+    if (result.incremental && ("fresh" == result.loadMode || "organism" == result.loadMode)) {
+        qWarning() << "Incremental load replaces changed sequences only, using reload mode";
+        result.loadMode = "reload";
+    }
+    if (0 == result.dbThreads) {
+        // Sharded load has a writer pool per shard
+        result.dbThreads = result.shardMapFile.isEmpty() ? result.parseThreads : 1;
+    }
+    if (!result.shardMapFile.isEmpty() && result.shardSchema.isEmpty()
+            && "mysql" == result.databaseBackend) {
+        if (QFile("iterative_create_database.sql").exists()) {
+            result.shardSchema = "iterative_create_database.sql";
+        }
+        else {
+            qWarning() << "Shard schema script not specified. Empty shard databases will not be filled!";
+        }
+    }
+    // Every parser and writer holds a connection, plus one for the main thread.
+    // Sharded load: a parser holds one connection to --db and at most one
+    // to the shard of the organism being parsed, each shard has its pool
+    const quint16 connectionsNeeded = result.parseThreads + result.dbThreads + 1;
+    if (0 == result.dbConnections) {
+        result.dbConnections = connectionsNeeded;
+    }
+    else if (result.dbConnections < connectionsNeeded) {
+        qWarning() << "Connection pool size " << result.dbConnections
+                   << " is less than " << connectionsNeeded << " threads using database. "
+                   << "Some of them will wait for a free connection.";
     }
     
     qDebug() << result.sourceFileNames;
     return result;
 }
 
+DatabaseOptions databaseOptions(const Arguments & args)
+{
+    DatabaseOptions result;
+    result.backend = args.databaseBackend;
+    result.host = args.databaseHost;
+    result.userName = args.databaseUser;
+    result.password = args.databasePass;
+    result.dbName = args.databaseName;
+    result.loadMode = args.loadMode;
+    result.poolSize = args.dbConnections;
+    result.deferIndexes = args.deferIndexes;
+    result.sessionStatements = args.sessionStatements;
+    result.originCodec = args.originCodec;
+    result.sequencesStoreDir = args.sequencesDir;
+    result.sequenceStore = args.sequenceStore;
+    result.coordinatesOnly = args.coordinatesOnly;
+    return result;
+}
+
+
+// Set by SIGINT or SIGTERM: parsers stop at the next sequence, what is
+// queued is stored and the journal is left ready for --resume
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int signalNumber)
+{
+    stopRequested = 1;
+    // Second signal terminates the process at once
+    std::signal(signalNumber, SIG_DFL);
+}
+
+
+// Global view of a run: files parsed and sequences handed to every
+// shard's writers, printed periodically
+class ProgressMonitor
+        : public QThread
+{
+public:
+    explicit ProgressMonitor(const ShardMap & shards, const QList<WriterPool*> & writers, int files);
+    void fileDone();
+    void stop();
+private:
+    enum { ReportMsecs = 10000 };
+    void run() override;
+    void report();
+    const ShardMap & _shards;
+    const QList<WriterPool*> & _writers;
+    const int _files;
+    QMutex _mutex;
+    QWaitCondition _stopped;
+    bool _stop = false;
+    int _filesDone = 0;
+};
+
+ProgressMonitor::ProgressMonitor(const ShardMap &shards, const QList<WriterPool *> &writers, int files)
+    : QThread()
+    , _shards(shards)
+    , _writers(writers)
+    , _files(files)
+{
+}
+
+void ProgressMonitor::fileDone()
+{
+    QMutexLocker lock(&_mutex);
+    _filesDone ++;
+}
+
+void ProgressMonitor::stop()
+{
+    QMutexLocker lock(&_mutex);
+    _stop = true;
+    _stopped.wakeAll();
+}
+
+void ProgressMonitor::run()
+{
+    QMutexLocker lock(&_mutex);
+    while (!_stop) {
+        _stopped.wait(&_mutex, ReportMsecs);
+        lock.unlock();
+        report();
+        lock.relock();
+    }
+}
+
+void ProgressMonitor::report()
+{
+    QMutexLocker lock(&_mutex);
+    const int filesDone = _filesDone;
+    lock.unlock();
+
+    quint64 total = 0;
+    int queued = 0;
+    QStringList perShard;
+    for (int i=0; i<_writers.size(); ++i) {
+        const quint64 sequences = _writers[i]->stats().sequences;
+        const int depth = _writers[i]->depth();
+        total += sequences;
+        queued += depth;
+        if (_writers.size() > 1 && sequences > 0) {
+            perShard << QString("%1 %2 (%3 queued)").arg(_shards.name(i)).arg(sequences).arg(depth);
+        }
+    }
+    QString line = QString("Progress: %1/%2 files, %3 sequences, %4 queued")
+            .arg(filesDone).arg(_files).arg(total).arg(queued);
+    if (!perShard.isEmpty()) {
+        line += "; " + perShard.join(", ");
+    }
+    qDebug() << line;
+}
+
 
 class Worker
         : public QThread
 {
 public:
-    explicit Worker(const Arguments & args, int from, int to);
+    explicit Worker(const Arguments & args, const ShardMap & shards,
+                    const QList<WriterPool*> & writers, ProgressMonitor * progress,
+                    LoadJournal * journal, InputManifest * manifest,
+                    FileScheduler * scheduler, int workerIndex, MemoryBudget * memoryBudget);
     void launch();
 private:
     void processOneFile();
+    bool enqueue(SequencePtr seq, QSharedPointer<Database> db,
+                 QSharedPointer<IniParser> supplParser, const QString & inputFileName);
     void run() override;
     const Arguments & _args;
-    int _index = -1;
-    const int _from;
-    const int _to;
+    const ShardMap & _shards;
+    const QList<WriterPool*> & _writers;
+    ProgressMonitor * _progress;
+    LoadJournal * _journal;
+    InputManifest * _manifest;
+    FileScheduler * _scheduler;
+    const int _workerIndex;
+    MemoryBudget * _memoryBudget;
+    QString _fileName;  // being processed
     QSemaphore _semaphore;
 };
 
-Worker::Worker(const Arguments &args, int from, int to)
+Worker::Worker(const Arguments &args, const ShardMap &shards,
+               const QList<WriterPool *> &writers, ProgressMonitor *progress,
+               LoadJournal *journal, InputManifest *manifest,
+               FileScheduler *scheduler, int workerIndex, MemoryBudget *memoryBudget)
     : QThread()
     , _args(args)
-    , _from(from)
-    , _to(to)
+    , _shards(shards)
+    , _writers(writers)
+    , _progress(progress)
+    , _journal(journal)
+    , _manifest(manifest)
+    , _scheduler(scheduler)
+    , _workerIndex(workerIndex)
+    , _memoryBudget(memoryBudget)
 {
 }
 
@@ -135,11 +453,23 @@ void Worker::run()
     _semaphore.acquire();
     //std::string decompress_command = "gzip -d " + _args.dataFolder.toStdString();
     //system (decompress_command.c_str());
-    for (_index = _from; _index < _to; ++_index) {
-        const QString &fileName = _args.sourceFileNames.at(_index);
+    while (!stopRequested && _scheduler->next(_workerIndex, &_fileName)) {
+        const QString &fileName = _fileName;
+        if (_journal->fileDone(fileName)) {
+            qDebug() << "File " << fileName << " is already loaded, skipped";
+            _progress->fileDone();
+            continue;
+        }
+        // Before the file is opened, so unchanged files cost a stat
+        if (_manifest && _manifest->unchanged(fileName)) {
+            qDebug() << "File " << fileName << " is unchanged, skipped";
+            _progress->fileDone();
+            continue;
+        }
         qDebug() << "Start processing file " << fileName
                  << " by worker " << QThread::currentThreadId();
         processOneFile();
+        _progress->fileDone();
         qDebug() << "Done processing file " << fileName
                  << " by worker " << QThread::currentThreadId();
     }
@@ -155,7 +485,75 @@ void Worker::launch()
 
 void Worker::processOneFile()
 {
-    const QString inputFileName = _args.sourceFileNames.at(_index);
+    const QString inputFileName = _fileName;
+    QSharedPointer<IniParser> supplParser(new IniParser);
+    QString supplFileName = _args.extraDataFile;
+    if (supplFileName.isEmpty()) {
+        supplFileName =
+            QFileInfo(inputFileName).absoluteDir()
+            .absoluteFilePath(
+                QFileInfo(inputFileName).baseName() + ".ini"
+                );
+    }
+    QString overrideOrganismName;
+    if (!supplFileName.isEmpty() && QFile(supplFileName).exists()) {
+        supplParser->setSourceFileName(supplFileName);
+        overrideOrganismName = supplParser->value("organisms", "name").toString();
+    }
+
+    // Sequences stored by an interrupted run
+    const QSet<QString> storedSequences = _journal->storedSequences(inputFileName);
+
+    QString cacheFileName;
+    if (!_args.parseCacheDir.isEmpty()) {
+        cacheFileName = ParseCache::fileName(_args.parseCacheDir, inputFileName, overrideOrganismName);
+    }
+    ShardRouter router(_shards);
+    if (!cacheFileName.isEmpty() && QFile::exists(cacheFileName)) {
+        ParseCacheReader reader;
+        if (reader.open(cacheFileName)) {
+            QSharedPointer<Database> db = Database::open(_shards.options(0));
+            if (!db) {
+                qWarning() << "Can't open database for file " << inputFileName << ". Skipped!";
+                return;
+            }
+            qDebug() << "using parse cache " << cacheFileName;
+            reader.setDatabase(db);
+            if (_shards.size() > 1) {
+                router.setDefaultDatabase(db);
+                reader.setRouter(&router);
+            }
+            reader.setMemoryBudget(_memoryBudget);
+            if (_manifest) {
+                _manifest->fileStarted(inputFileName);
+            }
+            _journal->fileStarted(inputFileName);
+            bool complete = true;
+            while (!reader.atEnd()) {
+                if (stopRequested) {
+                    complete = false;
+                    break;
+                }
+                SequencePtr seq = reader.readSequence();
+                if (!seq || storedSequences.contains(seq->refSeqId)) {
+                    continue;
+                }
+                if (!enqueue(seq, reader.database(), supplParser, inputFileName)) {
+                    complete = false;
+                    break;
+                }
+            }
+            if (reader.routingFailed()) {
+                complete = false;
+            }
+            _journal->fileParsed(inputFileName, complete);
+            if (_manifest) {
+                _manifest->flush(db);
+            }
+            return;
+        }
+    }
+
     QIODevice * inputSource = nullptr;
     QFile * inputFile = new QFile(inputFileName);
     GZipReader * gzipReader = nullptr;
@@ -172,51 +570,69 @@ void Worker::processOneFile()
         qWarning() << "Can't open file " << inputFileName << ". Skipped!";
     }
 
+    QSharedPointer<Database> db;
     if (inputSource) {
+        db = Database::open(_shards.options(0));
+        if (!db) {
+            qWarning() << "Can't open database for file " << inputFileName << ". Skipped!";
+        }
+    }
+
+    if (inputSource && db) {
         qDebug() << "ok";
         QSharedPointer<GbkParser> parser(new GbkParser);
-        QSharedPointer<IniParser> supplParser(new IniParser);
-        QSharedPointer<Database> db(Database::open(
-                                        _args.databaseHost,
-                                        _args.databaseUser,
-                                        _args.databasePass,
-                                        _args.databaseName,
-                                        _args.sequencesDir,
-                                        _args.translationsDir
-                                        ));
         qDebug() << "database opened";
         parser->setDatabase(db);
+        if (_shards.size() > 1) {
+            router.setDefaultDatabase(db);
+            parser->setRouter(&router);
+        }
         parser->setSource(inputSource, inputFileName);
-        QString supplFileName = _args.extraDataFile;
-        if (supplFileName.isEmpty()) {
-            supplFileName =
-                QFileInfo(inputFileName).absoluteDir()
-                .absoluteFilePath(
-                    QFileInfo(inputFileName).baseName() + ".ini"
-                    );
-        }
-        if (!supplFileName.isEmpty() && QFile(supplFileName).exists()) {
-            supplParser->setSourceFileName(supplFileName);
-            supplParser->setDatabase(db);
-            parser->setOverrideOrganismName(
-                        supplParser->value("organisms", "name").toString()
-                        );
+        if (!overrideOrganismName.isNull()) {
+            parser->setOverrideOrganismName(overrideOrganismName);
+        }
+        parser->setSkippedRefSeqIds(storedSequences);
+        parser->setMemoryBudget(_memoryBudget);
+        ParseCacheWriter cacheWriter;
+        // Cache must have every sequence of the input
+        if (!cacheFileName.isEmpty() && storedSequences.isEmpty()) {
+            cacheWriter.open(cacheFileName);
         }
         qDebug() << "start parsing";
+        if (_manifest) {
+            _manifest->fileStarted(inputFileName);
+        }
+        _journal->fileStarted(inputFileName);
+        bool complete = true;
         while (!parser->atEnd()) {
+            if (stopRequested) {
+                qWarning() << "Interrupted while processing " << inputFileName;
+                complete = false;
+                break;
+            }
             SequencePtr seq = parser->readSequence();
             if (!seq) {
                 continue;
             }
-            supplParser->updateOrganism(seq->organism);
-            // qDebug() << "updateOrganism";
-            supplParser->updateOrganismTaxonomy(seq->organism);
-            db->storeOrigin(seq);
-            db->addSequence(seq);
-            if (seq->organism) {
-                db->updateOrganism(seq->organism);
+            // Saved before writers set database ids and drop origins
+            cacheWriter.write(seq);
+            if (!enqueue(seq, parser->database(), supplParser, inputFileName)) {
+                complete = false;
+                break;
             }
         }
+        if (parser->routingFailed()) {
+            qWarning() << "Some sequences of " << inputFileName << " were not stored";
+            complete = false;
+        }
+        if (complete) {
+            cacheWriter.commit();
+        }
+        _journal->fileParsed(inputFileName, complete);
+        if (_manifest) {
+            // Files stored by now, this one is usually still in writers queues
+            _manifest->flush(db);
+        }
     }
 
     if (gzipReader) {
@@ -229,7 +645,132 @@ void Worker::processOneFile()
     }
 }
 
+bool Worker::enqueue(SequencePtr seq, QSharedPointer<Database> db,
+                     QSharedPointer<IniParser> supplParser, const QString &inputFileName)
+{
+    if (_manifest) {
+        _manifest->sequenceParsed(inputFileName, seq);
+        if (db->sequenceUnchanged(seq)) {
+            return true;
+        }
+    }
+    supplParser->updateOrganism(seq->organism);
+    // Taxonomy ids belong to the organism's shard
+    supplParser->setDatabase(db);
+    supplParser->updateOrganismTaxonomy(seq->organism);
+    // Counted before a writer can take it
+    seq->inputFilePath = inputFileName;
+    _journal->sequenceQueued(inputFileName);
+    if (!_writers[seq->shard]->enqueue(seq)) {
+        qWarning() << "No database writers available, stop processing " << inputFileName;
+        return false;
+    }
+    return true;
+}
+
+
+// --decode=TABLE:ID[,ID...]: print stored origins in FASTA format
+int decodeOrigins(const Arguments & args)
+{
+    const QString table = args.decode.section(':', 0, 0);
+    const QStringList ids = args.decode.section(':', 1).split(',', QString::SkipEmptyParts);
+    DatabaseOptions options = databaseOptions(args);
+    options.loadMode = "fresh";  // nothing is written, skip existing sequences lookup
+    QSharedPointer<Database> db = Database::open(options);
+    if (!db) {
+        return 1;
+    }
+    QTextStream out(stdout);
+    int result = 0;
+    Q_FOREACH(const QString & id, ids) {
+        const QByteArray origin = db->storedOrigin(table, id.toInt());
+        if (origin.isEmpty()) {
+            result = 1;
+            continue;
+        }
+        out << ">" << table << ":" << id << "\n"
+            << Database::format60(QString::fromLatin1(origin)) << "\n";
+    }
+    return result;
+}
+
+// --extract=TABLE:ID[,ID...] or --extract=ORGANISM/REFSEQ:START-END[,...]:
+// slice origins from the packed sequence store in FASTA format
+int extractOrigins(const Arguments & args)
+{
+    const QDir storeDir(args.sequencesDir);
+    QSharedPointer<Database> db;
+    QHash<QString, QSharedPointer<GenomeStore> > stores;
+
+    QList<QPair<QString,OriginLocation> > locations;  // FASTA header, location
+    const QString table = args.extract.section(':', 0, 0);
+    if (!table.contains('/')) {
+        DatabaseOptions options = databaseOptions(args);
+        options.loadMode = "fresh";  // nothing is written, skip existing sequences lookup
+        db = Database::open(options);
+        if (!db) {
+            return 1;
+        }
+        Q_FOREACH(const QString & id, args.extract.section(':', 1).split(',', QString::SkipEmptyParts)) {
+            OriginLocation location;
+            if (db->originLocation(table, id.toInt(), &location)) {
+                locations.append(qMakePair(table + ":" + id, location));
+            }
+        }
+    }
+    else {
+        Q_FOREACH(const QString & item, args.extract.split(',', QString::SkipEmptyParts)) {
+            QRegExp rx("(.+)/(.+):(\\d+)-(\\d+)");
+            if (!rx.exactMatch(item)) {
+                qWarning() << "Expected ORGANISM/REFSEQ:START-END instead of " << item;
+                continue;
+            }
+            OriginLocation location;
+            location.originFileName = GenomeStore::fileNameFor(rx.cap(1));
+            location.refSeqId = rx.cap(2);
+            location.start = rx.cap(3).toInt();
+            location.end = rx.cap(4).toInt();
+            // Reversed bounds ask for the other strand
+            location.backward = location.start > location.end;
+            locations.append(qMakePair(item, location));
+        }
+    }
 
+    QTextStream out(stdout);
+    int result = locations.isEmpty() ? 1 : 0;
+    QElapsedTimer timer;
+    qint64 sliceNsecs = 0;
+    for (int i=0; i<locations.size(); ++i) {
+        const OriginLocation & location = locations[i].second;
+        if (!location.originFileName.endsWith(".pack")) {
+            qWarning() << locations[i].first << " sequence " << location.refSeqId
+                       << " is not in a packed store, load it with --seqstore=packed";
+            result = 1;
+            continue;
+        }
+        if (!stores.contains(location.originFileName)) {
+            stores[location.originFileName] =
+                    GenomeStore::openForReading(storeDir.absoluteFilePath(location.originFileName));
+        }
+        QSharedPointer<GenomeStore> store = stores[location.originFileName];
+        timer.start();
+        const QByteArray origin = store
+                ? store->slice(location.refSeqId, location.start, location.end, location.backward)
+                : QByteArray();
+        sliceNsecs += timer.nsecsElapsed();
+        if (origin.isEmpty()) {
+            result = 1;
+            continue;
+        }
+        out << ">" << locations[i].first << "\n"
+            << Database::format60(QString::fromLatin1(origin)) << "\n";
+    }
+    out.flush();
+    qDebug() << QString("Extracted %1 slices, %2 us each")
+                .arg(locations.size())
+                .arg(locations.isEmpty() ? 0.0 : sliceNsecs / 1000.0 / locations.size(), 0, 'f', 1);
+    return result;
+}
 
 int main(int argc, char *argv[])
 {
@@ -263,18 +804,92 @@ int main(int argc, char *argv[])
     const Arguments args = parseArguments();
     Logger::init(args.loggerFileName);
 
-    const quint32 filesPerWorker = args.sourceFileNames.size() / args.maxThreads;
+    if (!args.decode.isEmpty()) {
+        return decodeOrigins(args);
+    }
+    if (!args.extract.isEmpty()) {
+        return extractOrigins(args);
+    }
+
+    ShardMap shards(databaseOptions(args));
+    if (!args.shardMapFile.isEmpty()) {
+        if (!shards.load(args.shardMapFile, args.shardSchema)) {
+            return 1;
+        }
+        shards.createDatabases();
+    }
 
+    // Declared before writers and exporters: outlives every sequence
+    QSharedPointer<MemoryBudget> memoryBudget;
+    if (args.maxMemory) {
+        memoryBudget = QSharedPointer<MemoryBudget>(new MemoryBudget(args.maxMemory));
+    }
 
-    QList<Worker*> pool;
+    LoadJournal journal;
+    if (!journal.open(args.journalFile, args.resume)) {
+        return 1;
+    }
+    QSharedPointer<InputManifest> manifest;
+    if (args.incremental) {
+        manifest = QSharedPointer<InputManifest>(new InputManifest);
+        QSharedPointer<Database> db = Database::open(shards.options(0));
+        if (!db || !manifest->load(db)) {
+            return 1;
+        }
+        journal.setManifest(manifest.data());
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    QSharedPointer<TranslationExporter> translations;
+    if (!args.translationsDir.isEmpty()) {
+        translations = QSharedPointer<TranslationExporter>(
+                    new TranslationExporter(args.translationsDir, 16 * args.dbThreads * shards.size()));
+        translations->start();
+    }
 
-    for (quint16 threadNo = 0; threadNo < args.maxThreads; ++threadNo) {
-        int start = threadNo * filesPerWorker;
-        int end = start + filesPerWorker;
-        if (args.maxThreads-1 == threadNo) {
-            end = args.sourceFileNames.size();
+    QSharedPointer<FeatureExporter> featureExport;
+    if (args.featureExport.enabled()) {
+        featureExport = QSharedPointer<FeatureExporter>(
+                    new FeatureExporter(args.featureExport, 16 * args.dbThreads * shards.size()));
+        if (!featureExport->open()) {
+            return 1;
         }
-        Worker * worker = new Worker(args, start, end);
+        featureExport->start();
+    }
+
+    QList<SequenceSink*> sinks;
+    sinks.append(&journal);
+    if (translations) {
+        sinks.append(translations.data());
+    }
+    if (featureExport) {
+        sinks.append(featureExport.data());
+    }
+
+    QList<WriterPool*> writers;
+    for (int shard = 0; shard < shards.size(); ++shard) {
+        Database::prepareBulkLoad(shards.options(shard));
+        writers.append(new WriterPool(shards.options(shard), args.dbThreads, 4 * args.dbThreads, sinks));
+    }
+    Q_FOREACH(WriterPool * shardWriters, writers) {
+        shardWriters->start();
+    }
+
+    ProgressMonitor progress(shards, writers, args.sourceFileNames.size());
+    progress.start();
+
+    if (args.geneThreads) {
+        // Shared by parsers finishing genes of big records, see GbkParser::finishGenes
+        QThreadPool::globalInstance()->setMaxThreadCount(args.geneThreads);
+    }
+
+    FileScheduler scheduler(args.sourceFileNames, args.parseThreads);
+    QList<Worker*> pool;
+
+    for (quint16 threadNo = 0; threadNo < args.parseThreads; ++threadNo) {
+        Worker * worker = new Worker(args, shards, writers, &progress, &journal, manifest.data(),
+                                     &scheduler, threadNo, memoryBudget.data());
         worker->start();
         pool.append(worker);
     }
@@ -288,5 +903,57 @@ int main(int argc, char *argv[])
         delete worker;
     }
 
+    Q_FOREACH(WriterPool * shardWriters, writers) {
+        shardWriters->finish();
+    }
+    progress.stop();
+    progress.wait();
+    for (int shard = 0; shard < shards.size(); ++shard) {
+        qDebug() << QString("%1: %2").arg(shards.name(shard)).arg(writers[shard]->report());
+        delete writers[shard];
+    }
+    writers.clear();
+    if (translations) {
+        translations->finish();
+        qDebug() << translations->report();
+    }
+    if (featureExport) {
+        featureExport->finish();
+        qDebug() << featureExport->report();
+    }
+    journal.close();
+    qDebug() << scheduler.report();
+    qDebug() << journal.report();
+    if (manifest) {
+        QSharedPointer<Database> db = Database::open(shards.options(0));
+        if (db) {
+            manifest->flush(db);
+        }
+        qDebug() << manifest->report();
+    }
+
+    for (int shard = 0; shard < shards.size(); ++shard) {
+        Database::finishBulkLoad(shards.options(shard));
+    }
+    GenomeStore::closeAll();
+    FastaStore::closeAll();
+    ConnectionPool::closeAll();
+    qDebug() << ConnectionPool::totalReport();
+    qDebug() << StatementCache::totalStatsReport();
+    if ("text" != args.originCodec && !args.originCodec.isEmpty()) {
+        qDebug() << Database::originStatsReport();
+    }
+    if ("delta" == args.loadMode) {
+        qDebug() << Database::deltaStatsReport();
+    }
+    if (memoryBudget) {
+        qDebug() << memoryBudget->report();
+    }
+    qDebug() << QString("Peak RSS: %1 MB").arg(MemoryBudget::peakRss() / 1048576);
+    if (stopRequested) {
+        qWarning() << "Interrupted, run again with --resume to load the rest";
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,103 @@
+#include "memorybudget.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QRegExp>
+
+MemoryReservation::MemoryReservation(MemoryBudget *budget, qint64 bytes)
+    : _budget(budget)
+    , _bytes(bytes)
+{
+}
+
+MemoryReservation::~MemoryReservation()
+{
+    _budget->release(_bytes);
+}
+
+MemoryBudget::MemoryBudget(qint64 bytes)
+    : _budget(bytes)
+{
+}
+
+MemoryReservationPtr MemoryBudget::reserve(qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    if (_inFlight > 0 && _inFlight + bytes > _budget) {
+        QElapsedTimer timer;
+        timer.start();
+        while (_inFlight > 0 && _inFlight + bytes > _budget) {
+            _released.wait(&_mutex);
+        }
+        _throttled ++;
+        _throttleNsecs += timer.nsecsElapsed();
+    }
+    _inFlight += bytes;
+    _peakInFlight = qMax(_peakInFlight, _inFlight);
+    return MemoryReservationPtr(new MemoryReservation(this, bytes));
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    _inFlight -= bytes;
+    _released.wakeAll();
+}
+
+qint64 MemoryBudget::estimate(quint32 locusLength)
+{
+    // Origin itself plus exon and intron origins, which cover most of the
+    // genes of a record, plus the origin lines being read
+    return 3 * qint64(locusLength) + 64 * 1024;
+}
+
+qint64 MemoryBudget::parseSize(const QString &value)
+{
+    QRegExp rx("(\\d+)([KMG]?)B?", Qt::CaseInsensitive);
+    if (!rx.exactMatch(value.trimmed())) {
+        return 0;
+    }
+    qint64 result = rx.cap(1).toLongLong();
+    const QString unit = rx.cap(2).toUpper();
+    if ("K" == unit) {
+        result <<= 10;
+    }
+    else if ("M" == unit) {
+        result <<= 20;
+    }
+    else if ("G" == unit) {
+        result <<= 30;
+    }
+    return result;
+}
+
+qint64 MemoryBudget::peakRss()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return 0;
+    }
+    // VmHWM:    123456 kB
+    Q_FOREVER {
+        const QByteArray line = status.readLine();
+        if (line.isEmpty()) {
+            break;
+        }
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+    return 0;
+}
+
+QString MemoryBudget::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Memory budget: %1 MB, peak %2 MB in flight, "
+                   "parsers throttled %3 times for %4 s")
+            .arg(_budget / 1048576)
+            .arg(_peakInFlight / 1048576)
+            .arg(_throttled)
+            .arg(_throttleNsecs / 1e9, 0, 'f', 1);
+}
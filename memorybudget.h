@@ -0,0 +1,65 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QWaitCondition>
+
+class MemoryBudget;
+
+// Share of the budget held by a record in flight, given back when the
+// last reference is dropped, i.e. when writers and exporters are done
+// with the sequence (see Sequence::memory)
+class MemoryReservation
+{
+public:
+    MemoryReservation(MemoryBudget * budget, qint64 bytes);
+    ~MemoryReservation();
+private:
+    Q_DISABLE_COPY(MemoryReservation)
+    MemoryBudget * _budget;
+    const qint64 _bytes;
+};
+
+typedef QSharedPointer<MemoryReservation> MemoryReservationPtr;
+
+// --max-memory: a parser reserves an estimate of a record's size at its
+// LOCUS line and waits while the records being parsed, queued for writers
+// and held by exporters would not fit into the budget. So parsers are
+// throttled when writers fall behind instead of filling the memory.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(qint64 bytes);
+
+    // Blocks until the bytes fit. A record larger than the whole budget
+    // is let in once nothing else is in flight.
+    MemoryReservationPtr reserve(qint64 bytes);
+
+    // Bytes in flight for a record of locusLength bases: origin, exon and
+    // intron copies of it and the rest of the parse result
+    static qint64 estimate(quint32 locusLength);
+
+    // "16G", "512M", "4096K" or bytes; 0 if not valid
+    static qint64 parseSize(const QString & value);
+
+    // Peak resident set size of the process (VmHWM), 0 where unknown
+    static qint64 peakRss();
+
+    QString report() const;
+
+private:
+    friend class MemoryReservation;
+    void release(qint64 bytes);
+
+    mutable QMutex _mutex;
+    QWaitCondition _released;
+    const qint64 _budget;
+    qint64 _inFlight = 0;
+    qint64 _peakInFlight = 0;
+    quint64 _throttled = 0;
+    qint64 _throttleNsecs = 0;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,245 @@
+#include "origincodec.h"
+
+#include <zlib.h>
+
+#include <QDebug>
+#include <QList>
+
+namespace {
+
+void appendUInt32(QByteArray & out, quint32 value)
+{
+    for (int i=0; i<4; ++i) {
+        out.append(char((value >> (8*i)) & 0xFF));
+    }
+}
+
+quint32 readUInt32(const char * in, qint64 offset)
+{
+    quint32 result = 0;
+    for (int i=0; i<4; ++i) {
+        result |= quint32(quint8(in[offset + i])) << (8*i);
+    }
+    return result;
+}
+
+int baseCode(char c)
+{
+    switch (c) {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+    }
+}
+
+const char Bases[] = "ACGT";
+
+struct Exception {
+    quint32 start;
+    quint32 length;
+    char base;
+};
+
+}
+
+bool OriginCodec::methodFromName(const QString &name, Method *method)
+{
+    const QString key = name.toLower();
+    if (key.isEmpty() || "text" == key) {
+        *method = Text;
+    }
+    else if ("packed" == key) {
+        *method = Packed;
+    }
+    else if ("zlib" == key) {
+        *method = Zlib;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+QByteArray OriginCodec::encode(const QByteArray &origin, Method method)
+{
+    switch (method) {
+    case Packed: return pack(origin);
+    case Zlib: return compress(origin);
+    default: return origin;
+    }
+}
+
+QByteArray OriginCodec::decode(const QByteArray &value)
+{
+    if (value.isEmpty()) {
+        return value;
+    }
+    switch (value[0]) {
+    case 'P': return unpack(value);
+    case 'Z': return uncompress(value);
+    default: return value;  // stored as text, 'P' and 'Z' are not IUPAC codes
+    }
+}
+
+QByteArray OriginCodec::pack(const QByteArray &origin)
+{
+    const int length = origin.size();
+    QList<Exception> exceptions;
+    QByteArray packed((length + 3) / 4, '\0');
+    for (int i=0; i<length; ++i) {
+        const char c = origin[i];
+        const int code = baseCode(c);
+        if (code < 0) {
+            if (!exceptions.isEmpty()
+                    && exceptions.last().base == c
+                    && exceptions.last().start + exceptions.last().length == quint32(i)) {
+                exceptions.last().length ++;
+            }
+            else {
+                Exception e = { quint32(i), 1, c };
+                exceptions.append(e);
+            }
+            continue;
+        }
+        packed[i / 4] = char(quint8(packed[i / 4]) | (code << (2 * (3 - i % 4))));
+    }
+
+    QByteArray result;
+    result.reserve(9 + 9 * exceptions.size() + packed.size());
+    result.append('P');
+    appendUInt32(result, length);
+    appendUInt32(result, exceptions.size());
+    Q_FOREACH(const Exception & e, exceptions) {
+        appendUInt32(result, e.start);
+        appendUInt32(result, e.length);
+        result.append(e.base);
+    }
+    result.append(packed);
+    return result;
+}
+
+QByteArray OriginCodec::unpack(const QByteArray &value)
+{
+    if (value.size() < 9) {
+        qWarning() << "Packed origin is truncated";
+        return QByteArray();
+    }
+    const quint32 length = readUInt32(value.constData(), 1);
+    const quint32 exceptionsCount = readUInt32(value.constData(), 5);
+    const int packedStart = 9 + 9 * exceptionsCount;
+    if (value.size() < packedStart + int((length + 3) / 4)) {
+        qWarning() << "Packed origin is truncated";
+        return QByteArray();
+    }
+
+    QByteArray result(length, 'A');
+    const char * packed = value.constData() + packedStart;
+    for (quint32 i=0; i<length; ++i) {
+        result[i] = Bases[(quint8(packed[i / 4]) >> (2 * (3 - i % 4))) & 3];
+    }
+    for (quint32 e=0; e<exceptionsCount; ++e) {
+        const int offset = 9 + 9 * e;
+        const quint32 start = readUInt32(value.constData(), offset);
+        const quint32 runLength = readUInt32(value.constData(), offset + 4);
+        const char base = value[offset + 8];
+        for (quint32 i=start; i<start + runLength && i<length; ++i) {
+            result[i] = base;
+        }
+    }
+    return result;
+}
+
+QByteArray OriginCodec::unpackRange(const char *value, qint64 size, quint32 start, quint32 length)
+{
+    if (size < 9 || 'P' != value[0]) {
+        return QByteArray();
+    }
+    const quint32 total = readUInt32(value, 1);
+    const quint32 exceptionsCount = readUInt32(value, 5);
+    if (start >= total) {
+        return QByteArray();
+    }
+    length = qMin(length, total - start);
+    const qint64 packedStart = 9 + 9 * qint64(exceptionsCount);
+    if (size < packedStart + (total + 3) / 4) {
+        qWarning() << "Packed origin is truncated";
+        return QByteArray();
+    }
+
+    QByteArray result(length, 'A');
+    const char * packed = value + packedStart;
+    for (quint32 i=0; i<length; ++i) {
+        const quint32 position = start + i;
+        result[i] = Bases[(quint8(packed[position / 4]) >> (2 * (3 - position % 4))) & 3];
+    }
+
+    // Runs are sorted and do not overlap: find the first one ending after start
+    quint32 low = 0;
+    quint32 high = exceptionsCount;
+    while (low < high) {
+        const quint32 middle = (low + high) / 2;
+        const qint64 offset = 9 + 9 * qint64(middle);
+        if (readUInt32(value, offset) + readUInt32(value, offset + 4) <= start) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    for (quint32 e=low; e<exceptionsCount; ++e) {
+        const qint64 offset = 9 + 9 * qint64(e);
+        const quint32 runStart = readUInt32(value, offset);
+        if (runStart >= start + length) {
+            break;
+        }
+        const quint32 runEnd = qMin(runStart + readUInt32(value, offset + 4), start + length);
+        const char base = value[offset + 8];
+        for (quint32 i=qMax(runStart, start); i<runEnd; ++i) {
+            result[i - start] = base;
+        }
+    }
+    return result;
+}
+
+QByteArray OriginCodec::compress(const QByteArray &origin)
+{
+    if (origin.isEmpty()) {
+        return QByteArray(1, 'Z');  // COMPRESS('') is ''
+    }
+    uLongf compressedSize = compressBound(origin.size());
+    QByteArray result(5 + compressedSize, '\0');
+    result[0] = 'Z';
+    for (int i=0; i<4; ++i) {
+        result[1 + i] = char((quint32(origin.size()) >> (8*i)) & 0xFF);
+    }
+    const int rc = ::compress2(reinterpret_cast<Bytef*>(result.data() + 5), &compressedSize,
+                               reinterpret_cast<const Bytef*>(origin.constData()), origin.size(),
+                               Z_DEFAULT_COMPRESSION);
+    if (Z_OK != rc) {
+        qWarning() << "zlib compress failed: " << rc;
+        return origin;
+    }
+    result.resize(5 + compressedSize);
+    return result;
+}
+
+QByteArray OriginCodec::uncompress(const QByteArray &value)
+{
+    if (value.size() < 5) {
+        return QByteArray();
+    }
+    // MySQL COMPRESS() format: little endian length, then zlib stream
+    uLongf length = readUInt32(value.constData(), 1);
+    QByteArray result(length, '\0');
+    const int rc = ::uncompress(reinterpret_cast<Bytef*>(result.data()), &length,
+                                reinterpret_cast<const Bytef*>(value.constData() + 5),
+                                value.size() - 5);
+    if (Z_OK != rc) {
+        qWarning() << "zlib uncompress failed: " << rc;
+        return QByteArray();
+    }
+    result.resize(length);
+    return result;
+}
@@ -0,0 +1,39 @@
+#ifndef ORIGINCODEC_H
+#define ORIGINCODEC_H
+
+#include <QByteArray>
+#include <QString>
+
+// Binary encodings of exon and intron origins for BLOB columns.
+// The first byte tells the method, so decode() needs nothing else and
+// also accepts plain text values stored without encoding:
+//
+//   'P' 2-bit packed: quint32 length, quint32 exceptions count, exceptions
+//       (quint32 start, quint32 run length, quint8 base), then 4 bases per
+//       byte, A=0 C=1 G=2 T=3, first base in the high bits. Exceptions are
+//       runs of anything but ACGT (mostly N), all integers little endian.
+//   'Z' zlib: the rest is in MySQL COMPRESS() format, so the server can
+//       decode it too: UNCOMPRESS(SUBSTRING(origin, 2))
+class OriginCodec
+{
+public:
+    enum Method { Text, Packed, Zlib };
+
+    // "text", "packed" or "zlib"; false if the name is unknown
+    static bool methodFromName(const QString & name, Method * method);
+
+    static QByteArray encode(const QByteArray & origin, Method method);
+    static QByteArray decode(const QByteArray & value);
+
+    // Bases [start, start + length) of a packed value, without decoding
+    // the rest of it; value may point into a memory mapped file
+    static QByteArray unpackRange(const char * value, qint64 size, quint32 start, quint32 length);
+
+private:
+    static QByteArray pack(const QByteArray & origin);
+    static QByteArray unpack(const QByteArray & value);
+    static QByteArray compress(const QByteArray & origin);
+    static QByteArray uncompress(const QByteArray & value);
+};
+
+#endif // ORIGINCODEC_H
@@ -0,0 +1,87 @@
+#include "parallelfor.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+namespace {
+
+// Shared by the caller and its tasks: tasks started after the caller
+// returned find no chunks left and must still have it to look at
+struct ParallelForState {
+    ParallelForState(int count, int chunkSize, const std::function<void(int)> & body)
+        : body(body)
+        , count(count)
+        , chunkSize(chunkSize)
+        , chunks((count + chunkSize - 1) / chunkSize)
+    {
+    }
+
+    // False when all the chunks are taken
+    bool runChunk()
+    {
+        const int chunk = nextChunk.fetchAndAddOrdered(1);
+        if (chunk >= chunks) {
+            return false;
+        }
+        const int end = qMin(count, (chunk + 1) * chunkSize);
+        for (int i=chunk * chunkSize; i<end; ++i) {
+            body(i);
+        }
+        QMutexLocker lock(&mutex);
+        if (++doneChunks == chunks) {
+            done.wakeAll();
+        }
+        return true;
+    }
+
+    const std::function<void(int)> body;
+    const int count;
+    const int chunkSize;
+    const int chunks;
+    QAtomicInt nextChunk;
+    QMutex mutex;
+    QWaitCondition done;
+    int doneChunks = 0;
+};
+
+class ChunkRunner
+        : public QRunnable
+{
+public:
+    explicit ChunkRunner(QSharedPointer<ParallelForState> state) : _state(state) {}
+    void run() override
+    {
+        while (_state->runChunk()) {}
+    }
+private:
+    QSharedPointer<ParallelForState> _state;
+};
+
+}
+
+void parallelFor(int count, int chunkSize, const std::function<void(int)> &body)
+{
+    QThreadPool * pool = QThreadPool::globalInstance();
+    const int chunks = (count + qMax(1, chunkSize) - 1) / qMax(1, chunkSize);
+    const int helpers = qMin(chunks, pool->maxThreadCount()) - 1;
+    if (helpers < 1) {
+        for (int i=0; i<count; ++i) {
+            body(i);
+        }
+        return;
+    }
+    QSharedPointer<ParallelForState> state(new ParallelForState(count, qMax(1, chunkSize), body));
+    for (int i=0; i<helpers; ++i) {
+        pool->start(new ChunkRunner(state));
+    }
+    while (state->runChunk()) {}
+    QMutexLocker lock(&state->mutex);
+    while (state->doneChunks < state->chunks) {
+        state->done.wait(&state->mutex);
+    }
+}
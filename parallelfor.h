@@ -0,0 +1,14 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <functional>
+
+// Calls body(i) for every i in [0, count), chunkSize indexes per task of
+// the global QThreadPool. The calling thread takes chunks too, so a pool
+// busy with other parsers' work only makes it slower, and counts against
+// QThreadPool::maxThreadCount(). Returns when every call is done; less
+// than two chunks or a pool of one thread run in the calling thread.
+// Each index must only touch its own data.
+void parallelFor(int count, int chunkSize, const std::function<void(int)> & body);
+
+#endif // PARALLELFOR_H
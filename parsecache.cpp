@@ -0,0 +1,412 @@
+#include "parsecache.h"
+#include "database.h"
+#include "gbkparser.h"
+#include "memorybudget.h"
+#include "shardmap.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+
+namespace {
+
+enum Tag { EndTag = 0, SequenceTag = 1 };
+
+void writeCounters(QDataStream & out, const OrganismCounters & c)
+{
+    out << c.unknownSequencesCount << c.totalSequencesLength << c.bGenesCount << c.rGenesCount
+        << c.cdsCount << c.rnaCount << c.unknownProtGenesCount << c.unknownProtCdsCount
+        << c.exonsCount << c.intronsCount;
+}
+
+void readCounters(QDataStream & in, OrganismCounters & c)
+{
+    in >> c.unknownSequencesCount >> c.totalSequencesLength >> c.bGenesCount >> c.rGenesCount
+       >> c.cdsCount >> c.rnaCount >> c.unknownProtGenesCount >> c.unknownProtCdsCount
+       >> c.exonsCount >> c.intronsCount;
+}
+
+void writeExon(QDataStream & out, const Exon & exon)
+{
+    out << exon.real_exon_id << exon.start << exon.end << quint8(exon.type)
+        << exon.startPhase << exon.endPhase << exon.lengthPhase
+        << exon.index << exon.revIndex << exon.startCodon << exon.endCodon
+        << exon.fromMainIsoform << exon.stash << exon.errorInIsoform << exon.warningNInSequence;
+}
+
+void readExon(QDataStream & in, Exon & exon)
+{
+    quint8 type = 0;
+    in >> exon.real_exon_id >> exon.start >> exon.end >> type
+       >> exon.startPhase >> exon.endPhase >> exon.lengthPhase
+       >> exon.index >> exon.revIndex >> exon.startCodon >> exon.endCodon
+       >> exon.fromMainIsoform >> exon.stash >> exon.errorInIsoform >> exon.warningNInSequence;
+    exon.type = Exon::Type(type);
+}
+
+void writeIntron(QDataStream & out, const Intron & intron, const QList<ExonPtr> & exons)
+{
+    out << qint32(exons.indexOf(intron.prevExon.toStrongRef()))
+        << qint32(exons.indexOf(intron.nextExon.toStrongRef()))
+        << intron.startDinucleotide << intron.endDinucleotide
+        << intron.start << intron.end << intron.index << intron.revIndex
+        << intron.lengthPhase << intron.phase << intron.fromMainIsoform
+        << intron.warningInStartDinucleotide << intron.warningInEndDinucleotide
+        << intron.warningNInSequence << intron.errorMain << intron.errorInIsoform
+        << intron.intronTypeId;
+}
+
+void readIntron(QDataStream & in, IntronPtr intron, const QList<ExonPtr> & exons)
+{
+    qint32 prevExon = -1;
+    qint32 nextExon = -1;
+    in >> prevExon >> nextExon
+       >> intron->startDinucleotide >> intron->endDinucleotide
+       >> intron->start >> intron->end >> intron->index >> intron->revIndex
+       >> intron->lengthPhase >> intron->phase >> intron->fromMainIsoform
+       >> intron->warningInStartDinucleotide >> intron->warningInEndDinucleotide
+       >> intron->warningNInSequence >> intron->errorMain >> intron->errorInIsoform
+       >> intron->intronTypeId;
+    if (0 <= prevExon && prevExon < exons.size()) {
+        intron->prevExon = exons[prevExon];
+        exons[prevExon]->nextIntron = intron;
+    }
+    if (0 <= nextExon && nextExon < exons.size()) {
+        intron->nextExon = exons[nextExon];
+        exons[nextExon]->prevIntron = intron;
+    }
+}
+
+void writeIsoform(QDataStream & out, const Isoform & isoform)
+{
+    out << quint8(isoform.type) << isoform.proteinXref << isoform.proteinId
+        << isoform.product << isoform.note
+        << isoform.cdsStart << isoform.cdsEnd << isoform.mrnaStart << isoform.mrnaEnd
+        << isoform.exonsCdsCount << isoform.exonsMrnaCount << isoform.exonsLength
+        << isoform.startCodon << isoform.endCodon
+        << isoform.errorInLength << isoform.warningInIntron << isoform.warningInCodingExon
+        << isoform.errorMain << isoform.errorComment << isoform.isMaximumByIntrons
+        << isoform.hasCDS << isoform.translation;
+    out << quint32(isoform.exons.size());
+    Q_FOREACH(ExonPtr exon, isoform.exons) {
+        writeExon(out, *exon);
+    }
+    out << quint32(isoform.introns.size());
+    Q_FOREACH(IntronPtr intron, isoform.introns) {
+        writeIntron(out, *intron, isoform.exons);
+    }
+}
+
+void readIsoform(QDataStream & in, IsoformPtr isoform, GenePtr gene, SequencePtr sequence)
+{
+    quint8 type = 0;
+    in >> type >> isoform->proteinXref >> isoform->proteinId
+       >> isoform->product >> isoform->note
+       >> isoform->cdsStart >> isoform->cdsEnd >> isoform->mrnaStart >> isoform->mrnaEnd
+       >> isoform->exonsCdsCount >> isoform->exonsMrnaCount >> isoform->exonsLength
+       >> isoform->startCodon >> isoform->endCodon
+       >> isoform->errorInLength >> isoform->warningInIntron >> isoform->warningInCodingExon
+       >> isoform->errorMain >> isoform->errorComment >> isoform->isMaximumByIntrons
+       >> isoform->hasCDS >> isoform->translation;
+    isoform->type = Isoform::Type(type);
+    isoform->gene = gene;
+    isoform->sequence = sequence;
+
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i=0; i<count && QDataStream::Ok == in.status(); ++i) {
+        ExonPtr exon(new Exon);
+        readExon(in, *exon);
+        exon->isoform = isoform;
+        exon->gene = gene;
+        exon->sequence = sequence;
+        exon->origin = GbkParser::featureOrigin(sequence->origin, exon->start, exon->end,
+                                                gene->backwardChain);
+        isoform->exons.append(exon);
+    }
+    in >> count;
+    for (quint32 i=0; i<count && QDataStream::Ok == in.status(); ++i) {
+        IntronPtr intron(new Intron);
+        readIntron(in, intron, isoform->exons);
+        intron->isoform = isoform;
+        intron->gene = gene;
+        intron->sequence = sequence;
+        intron->origin = GbkParser::featureOrigin(sequence->origin, intron->start, intron->end,
+                                                  gene->backwardChain);
+        isoform->introns.append(intron);
+    }
+}
+
+void writeGene(QDataStream & out, const Gene & gene)
+{
+    out << gene.name << gene.ncbiGeneId << gene.note
+        << gene.backwardChain << gene.isProteinButNotRna << gene.isPseudoGene
+        << gene.start << gene.end << gene.startCode << gene.endCode << gene.maxIntronsCount
+        << gene.hasCDS << gene.hasRNA;
+    out << quint32(gene.isoforms.size());
+    Q_FOREACH(IsoformPtr isoform, gene.isoforms) {
+        writeIsoform(out, *isoform);
+    }
+}
+
+void readGene(QDataStream & in, GenePtr gene, SequencePtr sequence)
+{
+    in >> gene->name >> gene->ncbiGeneId >> gene->note
+       >> gene->backwardChain >> gene->isProteinButNotRna >> gene->isPseudoGene
+       >> gene->start >> gene->end >> gene->startCode >> gene->endCode >> gene->maxIntronsCount
+       >> gene->hasCDS >> gene->hasRNA;
+    gene->sequence = sequence;
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i=0; i<count && QDataStream::Ok == in.status(); ++i) {
+        IsoformPtr isoform(new Isoform);
+        readIsoform(in, isoform, gene, sequence);
+        gene->isoforms.append(isoform);
+    }
+}
+
+}
+
+QString ParseCache::fileName(const QString &dirName, const QString &inputFileName,
+                             const QString &overrideOrganismName)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QFile input(inputFileName);
+    if (!input.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    while (!input.atEnd()) {
+        hash.addData(input.read(1024 * 1024));
+    }
+    input.close();
+    // Organism name from the .ini replaces the one in the input
+    hash.addData(overrideOrganismName.toUtf8());
+    return QDir(dirName).absoluteFilePath(QString::fromLatin1(hash.result().toHex()) + ".pcache");
+}
+
+
+ParseCacheWriter::~ParseCacheWriter()
+{
+    if (_file.isOpen()) {
+        // Not committed: input was not parsed completely
+        _file.close();
+        _file.remove();
+    }
+}
+
+bool ParseCacheWriter::open(const QString &fileName)
+{
+    _fileName = fileName;
+    QDir::root().mkpath(QFileInfo(fileName).absolutePath());
+    _file.setFileName(fileName + ".tmp");
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Can't create parse cache '" << _file.fileName() << "'";
+        return false;
+    }
+    _out.setDevice(&_file);
+    _out.setVersion(QDataStream::Qt_4_8);
+    _out << quint32(ParseCache::Magic) << quint32(ParseCache::FormatVersion);
+    return true;
+}
+
+bool ParseCacheWriter::isOpen() const
+{
+    return _file.isOpen();
+}
+
+void ParseCacheWriter::write(SequencePtr sequence)
+{
+    if (!_file.isOpen()) {
+        return;
+    }
+    // Organism fields are changed by other parsers and by statistics
+    // flushes under its mutex
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    const QString organismName = organism->name;
+    const QStringList taxonomyList = organism->taxonomyList;
+    const bool dbMitochondria = organism->dbMitochondria;
+    const QString taxonomyXref = organism->taxonomyXref;
+    organism->mutex.unlock();
+    ChromosomePtr chromosome = sequence->chromosome.toStrongRef();
+    QString chromosomeName;
+    if (chromosome) {
+        chromosome->mutex.lock();
+        chromosomeName = chromosome->name;
+        chromosome->mutex.unlock();
+    }
+
+    _out << quint8(SequenceTag)
+         << organismName << chromosomeName
+         << taxonomyList << dbMitochondria << taxonomyXref;
+    _out << quint32(sequence->orphanedCdses.size());
+    Q_FOREACH(const OrphanedCds & cds, sequence->orphanedCdses) {
+        _out << cds.lineStart << cds.lineEnd << cds.dbXref << cds.product;
+    }
+    _out << sequence->sourceFileName << sequence->refSeqId << sequence->version
+         << sequence->description << sequence->length << sequence->gbk_date
+         << sequence->origin;
+    writeCounters(_out, sequence->counters);
+    _out << quint32(sequence->genes.size());
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        writeGene(_out, *gene);
+    }
+}
+
+bool ParseCacheWriter::commit()
+{
+    if (!_file.isOpen()) {
+        return false;
+    }
+    _out << quint8(EndTag);
+    const bool ok = QDataStream::Ok == _out.status() && _file.flush();
+    _file.close();
+    if (!ok) {
+        qWarning() << "Can't write parse cache '" << _file.fileName() << "' (possible out of space)";
+        _file.remove();
+        return false;
+    }
+    QFile::remove(_fileName);
+    return _file.rename(_fileName);
+}
+
+
+ParseCacheReader::~ParseCacheReader()
+{
+    _buffer.close();
+    if (_map) {
+        _file.unmap(_map);
+    }
+    _file.close();
+}
+
+bool ParseCacheReader::open(const QString &fileName)
+{
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    _map = _file.size() > 0 ? _file.map(0, _file.size()) : nullptr;
+    if (_map) {
+        _data = QByteArray::fromRawData(reinterpret_cast<const char*>(_map), int(_file.size()));
+        _buffer.setBuffer(&_data);
+        _buffer.open(QIODevice::ReadOnly);
+        _in.setDevice(&_buffer);
+    }
+    else {
+        _in.setDevice(&_file);
+    }
+    _in.setVersion(QDataStream::Qt_4_8);
+    quint32 magic = 0;
+    quint32 version = 0;
+    _in >> magic >> version;
+    if (ParseCache::Magic != magic || ParseCache::FormatVersion != version) {
+        qWarning() << "Parse cache '" << fileName << "' has unknown format, ignored";
+        return false;
+    }
+    _atEnd = false;
+    return true;
+}
+
+void ParseCacheReader::setDatabase(QSharedPointer<Database> db)
+{
+    _db = db;
+}
+
+QSharedPointer<Database> ParseCacheReader::database() const
+{
+    return _db;
+}
+
+void ParseCacheReader::setRouter(ShardRouter *router)
+{
+    _router = router;
+}
+
+void ParseCacheReader::setMemoryBudget(MemoryBudget *budget)
+{
+    _memoryBudget = budget;
+}
+
+bool ParseCacheReader::routingFailed() const
+{
+    return _routingFailed;
+}
+
+bool ParseCacheReader::atEnd() const
+{
+    return _atEnd;
+}
+
+SequencePtr ParseCacheReader::readSequence()
+{
+    quint8 tag = EndTag;
+    _in >> tag;
+    if (SequenceTag != tag || QDataStream::Ok != _in.status()) {
+        _atEnd = true;
+        return SequencePtr();
+    }
+
+    SequencePtr seq(new Sequence);
+    QString organismName;
+    QString chromosomeName;
+    QStringList taxonomyList;
+    bool dbMitochondria = false;
+    QString taxonomyXref;
+    _in >> organismName >> chromosomeName >> taxonomyList >> dbMitochondria >> taxonomyXref;
+    quint32 count = 0;
+    _in >> count;
+    for (quint32 i=0; i<count && QDataStream::Ok == _in.status(); ++i) {
+        OrphanedCds cds;
+        _in >> cds.lineStart >> cds.lineEnd >> cds.dbXref >> cds.product;
+        seq->orphanedCdses.append(cds);
+    }
+    _in >> seq->sourceFileName >> seq->refSeqId >> seq->version
+        >> seq->description >> seq->length >> seq->gbk_date;
+    if (_memoryBudget && QDataStream::Ok == _in.status()) {
+        seq->memory = _memoryBudget->reserve(MemoryBudget::estimate(seq->length));
+    }
+    _in >> seq->origin;
+    readCounters(_in, seq->counters);
+    _in >> count;
+    for (quint32 i=0; i<count && QDataStream::Ok == _in.status(); ++i) {
+        GenePtr gene(new Gene);
+        readGene(_in, gene, seq);
+        seq->genes.append(gene);
+    }
+    if (QDataStream::Ok != _in.status()) {
+        qWarning() << "Parse cache '" << _file.fileName() << "' is truncated";
+        _atEnd = true;
+        return SequencePtr();
+    }
+
+    // What the parser does with the database on the way
+    if (_router) {
+        QSharedPointer<Database> shardDb = _router->database(organismName);
+        if (!shardDb) {
+            // Never stored into another shard instead
+            _routingFailed = true;
+            return SequencePtr();
+        }
+        _db = shardDb;
+        seq->shard = _router->currentShard();
+    }
+    OrganismPtr organism = _db->findOrCreateOrganism(organismName);
+    seq->organism = organism.toWeakRef();
+    organism->mutex.lock();
+    if (organism->taxonomyList.isEmpty()) {
+        organism->taxonomyList = taxonomyList;
+    }
+    organism->dbMitochondria = dbMitochondria;
+    organism->taxonomyXref = taxonomyXref;
+    organism->mutex.unlock();
+    if (!chromosomeName.isEmpty()) {
+        seq->chromosome = _db->findOrCreateChromosome(chromosomeName, organism);
+    }
+    Q_FOREACH(const OrphanedCds & cds, seq->orphanedCdses) {
+        _db->addOrphanedCDS(seq->sourceFileName, cds.lineStart, cds.lineEnd,
+                            seq->refSeqId, cds.dbXref, cds.product);
+    }
+    return seq;
+}
@@ -0,0 +1,87 @@
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include "structures.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QFile>
+#include <QSharedPointer>
+#include <QString>
+
+class Database;
+class MemoryBudget;
+class ShardRouter;
+
+// Parsed sequences of an input file saved with QDataStream, so a reload
+// after a schema change skips decompression and GbkParser entirely
+// (--parse-cache=DIR). One file per input, named by SHA-1 of the input
+// contents and of everything else the parse result depends on:
+//
+//   quint32 magic, quint32 format version, then per sequence
+//   quint8 1, organism and chromosome names, organism fields set by the
+//   parser, orphaned CDSes, sequence fields, origin, genes with isoforms,
+//   exons and introns (links between them as indexes); quint8 0 at the end.
+//
+// Exon and intron origins are not saved, they are sliced from the sequence
+// origin again. Files are written to a temporary name and renamed when the
+// input is parsed completely. Readers map the file instead of reading it.
+class ParseCache
+{
+public:
+    enum { Magic = 0x49444643, FormatVersion = 1 };
+
+    // Cache file name for an input file, reads the whole input to hash it
+    static QString fileName(const QString & dirName, const QString & inputFileName,
+                            const QString & overrideOrganismName);
+};
+
+
+class ParseCacheWriter
+{
+public:
+    ~ParseCacheWriter();
+    bool open(const QString & fileName);
+    bool isOpen() const;
+    // Must be called before the sequence is handed to database writers
+    void write(SequencePtr sequence);
+    // Input parsed completely: make the cache visible to later runs
+    bool commit();
+
+private:
+    QString _fileName;
+    QFile _file;
+    QDataStream _out;
+};
+
+
+// Same interface as GbkParser: sequences come with organism and
+// chromosome resolved and orphaned CDSes stored by the given database
+class ParseCacheReader
+{
+public:
+    ~ParseCacheReader();
+    bool open(const QString & fileName);
+    void setDatabase(QSharedPointer<Database> db);
+    QSharedPointer<Database> database() const;
+    void setRouter(ShardRouter * router);
+    void setMemoryBudget(MemoryBudget * budget);
+    // Some records were skipped, their shard database can't be opened
+    bool routingFailed() const;
+    bool atEnd() const;
+    SequencePtr readSequence();
+
+private:
+    QFile _file;
+    uchar * _map = nullptr;
+    QByteArray _data;
+    QBuffer _buffer;
+    QDataStream _in;
+    bool _atEnd = true;
+    QSharedPointer<Database> _db;
+    ShardRouter * _router = nullptr;
+    bool _routingFailed = false;
+    MemoryBudget * _memoryBudget = nullptr;
+};
+
+#endif // PARSECACHE_H
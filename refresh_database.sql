@@ -4,6 +4,7 @@ DELETE FROM exons;
 DELETE FROM real_exons;
 DELETE FROM isoforms;
 DELETE FROM orphaned_cdses;
+DELETE FROM input_manifest;
 DELETE FROM genes;
 DELETE FROM sequences;
 DELETE FROM chromosomes;
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef SEQUENCESINK_H
+#define SEQUENCESINK_H
+
+#include "structures.h"
+
+// Consumer of sequences already stored by writer threads, so all the
+// database ids are set. Called by several writer threads at once.
+class SequenceSink
+{
+public:
+    virtual ~SequenceSink() {}
+    virtual void enqueue(SequencePtr sequence) = 0;
+};
+
+#endif // SEQUENCESINK_H
@@ -0,0 +1,121 @@
+#include "shardmap.h"
+#include "backend.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSet>
+#include <QSettings>
+
+ShardMap::ShardMap(const DatabaseOptions &defaults)
+{
+    _shards << defaults;
+    _names << defaults.dbName;
+}
+
+bool ShardMap::load(const QString &fileName, const QString &schemaScript)
+{
+    if (!QFile(fileName).exists()) {
+        qWarning() << "Shard map " << fileName << " not found";
+        return false;
+    }
+    QSettings settings(fileName, QSettings::IniFormat);
+    const QStringList organisms = settings.childGroups();
+    for (int i=0; i<organisms.size(); ++i) {
+        const QString & organism = organisms[i];
+        settings.beginGroup(organism);
+        DatabaseOptions options = _shards.first();
+        options.dbName = settings.value("db", organism).toString();
+        options.host = settings.value("host", options.host).toString();
+        options.idOffset = settings.value("id_offset", qint64(i+1) * DefaultIdStep).toLongLong();
+        options.schemaScript = schemaScript;
+        settings.endGroup();
+
+        _byOrganism[normalized(organism)] = _shards.size();
+        _shards << options;
+        _names << organism;
+    }
+    qDebug() << "Shard map " << fileName << ": " << organisms.size() << " organisms";
+    return true;
+}
+
+int ShardMap::size() const
+{
+    return _shards.size();
+}
+
+const DatabaseOptions &ShardMap::options(int shard) const
+{
+    return _shards[shard];
+}
+
+QString ShardMap::name(int shard) const
+{
+    return _names[shard];
+}
+
+int ShardMap::shardFor(const QString &organismName) const
+{
+    return _byOrganism.value(normalized(organismName), 0);
+}
+
+bool ShardMap::createDatabases() const
+{
+    bool ok = true;
+    QSet<QString> created;
+    for (int i=1; i<_shards.size(); ++i) {
+        const DatabaseOptions & options = _shards[i];
+        if (created.contains(options.targetKey())) {
+            continue;
+        }
+        created.insert(options.targetKey());
+        QSharedPointer<Backend> backend = Backend::create(options.backend);
+        if (!backend || !backend->createDatabase(options)) {
+            qWarning() << "Can't create database " << options.dbName << " for " << _names[i];
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+QString ShardMap::normalized(const QString &organismName)
+{
+    return organismName.simplified().replace('_', ' ').toLower();
+}
+
+
+ShardRouter::ShardRouter(const ShardMap &map)
+    : _map(map)
+{
+}
+
+void ShardRouter::setDefaultDatabase(QSharedPointer<Database> db)
+{
+    _defaultDb = db;
+}
+
+QSharedPointer<Database> ShardRouter::database(const QString &organismName)
+{
+    const int shard = _map.shardFor(organismName);
+    if (shard != _current || !_db) {
+        // Dropping the previous shard's connection first
+        _db.clear();
+        QSharedPointer<Database> db = 0 == shard && _defaultDb
+                ? _defaultDb
+                : Database::open(_map.options(shard));
+        if (!db) {
+            qWarning() << "Can't open database " << _map.options(shard).dbName
+                       << " for organism " << organismName << ". Skipped!";
+            _db.clear();
+            _current = -1;
+            return db;
+        }
+        _db = db;
+        _current = shard;
+    }
+    return _db;
+}
+
+int ShardRouter::currentShard() const
+{
+    return qMax(0, _current);
+}
@@ -0,0 +1,74 @@
+#ifndef SHARDMAP_H
+#define SHARDMAP_H
+
+#include "database.h"
+
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+
+// Organism -> database routing for filling several databases in one run.
+// Shard 0 is the database given on the command line, it takes organisms
+// not listed in the map. The map is an ini file, one section per organism:
+//
+//   [Drosophila_melanogaster]
+//   db=Drosophila_melanogaster
+//   host=localhost
+//   id_offset=5000000
+//
+// Missing db is the section name, missing host is --host, missing
+// id_offset is (n+1)*5000000 for the n-th section in alphabetical order,
+// as generate_iterative_creations.py does.
+class ShardMap
+{
+public:
+    explicit ShardMap(const DatabaseOptions & defaults);
+
+    // schemaScript is a template like iterative_create_database.sql
+    bool load(const QString & fileName, const QString & schemaScript);
+
+    int size() const;
+    const DatabaseOptions & options(int shard) const;
+    QString name(int shard) const;
+    int shardFor(const QString & organismName) const;
+
+    // Create missing databases, their tables are created on first connect
+    bool createDatabases() const;
+
+private:
+    enum { DefaultIdStep = 5000000 };
+
+    // "Homo sapiens" and "Homo_sapiens" are the same organism
+    static QString normalized(const QString & organismName);
+
+    QList<DatabaseOptions> _shards;
+    QStringList _names;
+    QHash<QString, int> _byOrganism;
+};
+
+// Parser side of routing: holds a connection to the shard of the organism
+// being parsed and switches it when the organism changes. Not thread safe,
+// one router per parser.
+class ShardRouter
+{
+public:
+    explicit ShardRouter(const ShardMap & map);
+
+    // Parser's own connection to shard 0, used instead of opening another
+    void setDefaultDatabase(QSharedPointer<Database> db);
+
+    // Returns null if the shard database can't be opened, the sequence
+    // must be skipped then: it is never routed to another shard
+    QSharedPointer<Database> database(const QString & organismName);
+    int currentShard() const;
+
+private:
+    const ShardMap & _map;
+    int _current = -1;
+    QSharedPointer<Database> _db;
+    QSharedPointer<Database> _defaultDb;
+};
+
+#endif // SHARDMAP_H
@@ -0,0 +1,81 @@
+#include "statementcache.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QSqlError>
+
+QMutex StatementCache::_totalMutex;
+StatementCache::Stats StatementCache::_total;
+
+StatementCache::StatementCache(QSqlDatabase *db)
+    : _db(db)
+{
+}
+
+StatementCache::~StatementCache()
+{
+    clear();
+}
+
+QSqlQuery & StatementCache::query(int id, const char *sql)
+{
+    if (id >= _queries.size()) {
+        _queries.resize(id + 1);
+    }
+    QSqlQuery * query = _queries[id];
+    if (query) {
+        _stats.hits ++;
+        return *query;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    query = new QSqlQuery("", *_db);
+    if (!query->prepare(sql)) {
+        qWarning() << query->lastError();
+        qWarning() << query->lastError().text();
+        qWarning() << sql;
+    }
+    _stats.prepareNsecs += timer.nsecsElapsed();
+    _stats.prepares ++;
+    _queries[id] = query;
+    return *query;
+}
+
+void StatementCache::clear()
+{
+    for (int i=0; i<_queries.size(); ++i) {
+        delete _queries[i];
+    }
+    _queries.clear();
+
+    QMutexLocker lock(&_totalMutex);
+    _total.hits += _stats.hits - _reported.hits;
+    _total.prepares += _stats.prepares - _reported.prepares;
+    _total.prepareNsecs += _stats.prepareNsecs - _reported.prepareNsecs;
+    _reported = _stats;
+}
+
+StatementCache::Stats StatementCache::stats() const
+{
+    return _stats;
+}
+
+StatementCache::Stats StatementCache::totalStats()
+{
+    QMutexLocker lock(&_totalMutex);
+    return _total;
+}
+
+QString StatementCache::totalStatsReport()
+{
+    const Stats total = totalStats();
+    const quint64 calls = total.hits + total.prepares;
+    return QString("Statement cache: %1 executions, %2 hits (%3%), %4 prepares, %5 ms preparing")
+            .arg(calls)
+            .arg(total.hits)
+            .arg(calls ? 100.0 * total.hits / calls : 0.0, 0, 'f', 1)
+            .arg(total.prepares)
+            .arg(total.prepareNsecs / 1000000);
+}
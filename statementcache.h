@@ -0,0 +1,46 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QVector>
+
+// Prepared statements owned by one connection, keyed by statement id.
+// Each statement is prepared once (one server round trip for QMYSQL)
+// and then only re-bound and executed.
+class StatementCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 prepares = 0;
+        qint64 prepareNsecs = 0;
+    };
+
+    explicit StatementCache(QSqlDatabase * db);
+    ~StatementCache();
+
+    QSqlQuery & query(int id, const char * sql);
+
+    // Drop all the statements, must be called before connection is closed
+    void clear();
+
+    Stats stats() const;
+    static Stats totalStats();
+    static QString totalStatsReport();
+
+private:
+    Q_DISABLE_COPY(StatementCache)
+
+    static QMutex _totalMutex;
+    static Stats _total;
+
+    QSqlDatabase * _db;
+    QVector<QSqlQuery*> _queries;
+    Stats _stats;
+    Stats _reported;
+};
+
+#endif // STATEMENTCACHE_H
@@ -25,6 +25,8 @@ struct Exon;
 struct Intron;
 struct RealExon;
 
+class MemoryReservation;
+
 struct Range {
     quint32 start;
     quint32 end;
@@ -146,6 +148,53 @@ struct Organism
 
 
 
+// Organism statistics collected without locking by a single thread
+// (per sequence while parsing, per connection while storing) and
+// merged into Organism under its mutex when statistics are flushed
+struct OrganismCounters
+{
+    quint32         unknownSequencesCount = 0;
+    quint64         totalSequencesLength = 0;
+    quint32         bGenesCount = 0;
+    quint32         rGenesCount = 0;
+    quint32         cdsCount = 0;
+    quint32         rnaCount = 0;
+    quint32         unknownProtGenesCount = 0;
+    quint32         unknownProtCdsCount = 0;
+    quint32         exonsCount = 0;
+    quint32         intronsCount = 0;
+
+    inline OrganismCounters & operator+=(const OrganismCounters & other) {
+        unknownSequencesCount += other.unknownSequencesCount;
+        totalSequencesLength += other.totalSequencesLength;
+        bGenesCount += other.bGenesCount;
+        rGenesCount += other.rGenesCount;
+        cdsCount += other.cdsCount;
+        rnaCount += other.rnaCount;
+        unknownProtGenesCount += other.unknownProtGenesCount;
+        unknownProtCdsCount += other.unknownProtCdsCount;
+        exonsCount += other.exonsCount;
+        intronsCount += other.intronsCount;
+        return *this;
+    }
+
+    // Caller must hold organism mutex
+    inline void mergeInto(Organism & organism) const {
+        organism.unknownSequencesCount += unknownSequencesCount;
+        organism.totalSequencesLength += totalSequencesLength;
+        organism.bGenesCount += bGenesCount;
+        organism.rGenesCount += rGenesCount;
+        organism.cdsCount += cdsCount;
+        organism.rnaCount += rnaCount;
+        organism.unknownProtGenesCount += unknownProtGenesCount;
+        organism.unknownProtCdsCount += unknownProtCdsCount;
+        organism.exonsCount += exonsCount;
+        organism.intronsCount += intronsCount;
+    }
+};
+
+
+
 struct Chromosome {
     qint32          id = 0;
     QMutex          mutex;
@@ -156,9 +205,20 @@ struct Chromosome {
 
 
 
+// CDS without gene or mRNA, stored to orphaned_cdses while parsing
+struct OrphanedCds {
+    quint32         lineStart = 0;
+    quint32         lineEnd = 0;
+    QString         dbXref;
+    QString         product;
+};
+
+
+
 struct Sequence {
     qint32          id = 0;
     QString         sourceFileName;
+    QString         inputFilePath;  // as passed to the parser, LoadJournal key
     QString         refSeqId;
     QString         version;
     QString         description;
@@ -170,6 +230,11 @@ struct Sequence {
     QDate           gbk_date;
 
     QList<GenePtr>  genes;
+
+    OrganismCounters counters;  // filled by parser, no locking needed
+    int             shard = 0;  // ShardMap index, set by parser
+    QList<OrphanedCds> orphanedCdses;  // already stored by parser, kept for parse cache
+    QSharedPointer<MemoryReservation> memory;  // --max-memory share, see MemoryBudget
 };
 
 
@@ -193,6 +258,8 @@ struct Gene {
     QList<IsoformPtr> isoforms;
     bool            hasCDS = false;
     bool            hasRNA = false;
+    bool            unchanged = false;  // delta load: stored rows kept, children ids not known
+    QString         fingerprint;  // delta load: Database::geneFingerprint(), computed once
 };
 
 
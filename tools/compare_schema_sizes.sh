@@ -0,0 +1,44 @@
+#!/bin/sh
+# Loads the same GBK files into create_database.sql and
+# create_database_compact.sql schemas and prints table sizes of both.
+#
+# Usage: tools/compare_schema_sizes.sh FILE.gbk [FILE.gbk ...]
+# Environment: MYSQL_USER (root), MYSQL_PASS, MYSQL_HOST (localhost),
+#              FILL (./introns_db_fill), PLAIN_DB, COMPACT_DB
+
+set -e
+
+TOOLS=$(dirname "$0")
+ROOT="$TOOLS/.."
+MYSQL_USER=${MYSQL_USER:-root}
+MYSQL_HOST=${MYSQL_HOST:-localhost}
+FILL=${FILL:-./introns_db_fill}
+PLAIN_DB=${PLAIN_DB:-introns_size_plain}
+COMPACT_DB=${COMPACT_DB:-introns_size_compact}
+
+if [ $# -eq 0 ]; then
+    sed -n '2,8p' "$0"
+    exit 1
+fi
+
+mysql_run() {
+    mysql --user="$MYSQL_USER" --password="$MYSQL_PASS" --host="$MYSQL_HOST" "$@"
+}
+
+load() {
+    db=$1
+    schema=$2
+    shift 2
+    mysql_run -e "CREATE DATABASE IF NOT EXISTS $db"
+    sed "s/^USE test/USE $db;/" "$schema" | mysql_run --database="$db"
+    "$FILL" --backend=mysql --host="$MYSQL_HOST" --user="$MYSQL_USER" \
+        --pass="$MYSQL_PASS" --db="$db" --load-mode=fresh "$@"
+}
+
+load "$PLAIN_DB" "$ROOT/create_database.sql" "$@"
+load "$COMPACT_DB" "$ROOT/create_database_compact.sql" "$@"
+
+echo "== $PLAIN_DB (create_database.sql)"
+mysql_run --table --database="$PLAIN_DB" < "$TOOLS/table_sizes.sql"
+echo "== $COMPACT_DB (create_database_compact.sql)"
+mysql_run --table --database="$COMPACT_DB" < "$TOOLS/table_sizes.sql"
@@ -0,0 +1,124 @@
+// Contention benchmark for organism statistics counters.
+//
+// All threads feed one organism (the case of a genome split into many
+// chromosome files). Compares bumping Organism fields under its mutex,
+// as the parser used to do, with thread-local OrganismCounters merged
+// once per "sequence".
+//
+// Usage: counters_bench [THREADS [FEATURES_PER_THREAD [FEATURES_PER_SEQUENCE]]]
+
+#include "../structures.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QList>
+#include <QStringList>
+#include <QThread>
+
+namespace {
+
+class LockedCounter
+        : public QThread
+{
+public:
+    LockedCounter(Organism * organism, int features)
+        : _organism(organism), _features(features) {}
+private:
+    void run() override
+    {
+        for (int i=0; i<_features; ++i) {
+            _organism->mutex.lock();
+            _organism->cdsCount ++;
+            if (0 == i % 8) {
+                _organism->unknownProtCdsCount ++;
+            }
+            _organism->mutex.unlock();
+        }
+    }
+    Organism * _organism;
+    const int _features;
+};
+
+class LocalCounter
+        : public QThread
+{
+public:
+    LocalCounter(Organism * organism, int features, int perSequence)
+        : _organism(organism), _features(features), _perSequence(perSequence) {}
+private:
+    void run() override
+    {
+        OrganismCounters counters;
+        for (int i=0; i<_features; ++i) {
+            counters.cdsCount ++;
+            if (0 == i % 8) {
+                counters.unknownProtCdsCount ++;
+            }
+            if (0 == (i + 1) % _perSequence) {
+                _organism->mutex.lock();
+                counters.mergeInto(*_organism);
+                _organism->mutex.unlock();
+                counters = OrganismCounters();
+            }
+        }
+        _organism->mutex.lock();
+        counters.mergeInto(*_organism);
+        _organism->mutex.unlock();
+    }
+    Organism * _organism;
+    const int _features;
+    const int _perSequence;
+};
+
+template <class Thread>
+qint64 runThreads(QList<Thread*> threads)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Q_FOREACH(Thread * thread, threads) {
+        thread->start();
+    }
+    Q_FOREACH(Thread * thread, threads) {
+        thread->wait();
+        delete thread;
+    }
+    return timer.elapsed();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    const QStringList args = a.arguments();
+    const int threads = args.size() > 1 ? args[1].toInt() : 32;
+    const int features = args.size() > 2 ? args[2].toInt() : 1000000;
+    const int perSequence = args.size() > 3 ? qMax(1, args[3].toInt()) : 1000;
+
+    Organism locked;
+    QList<LockedCounter*> lockedThreads;
+    for (int i=0; i<threads; ++i) {
+        lockedThreads.append(new LockedCounter(&locked, features));
+    }
+    const qint64 lockedMsecs = runThreads(lockedThreads);
+
+    Organism local;
+    QList<LocalCounter*> localThreads;
+    for (int i=0; i<threads; ++i) {
+        localThreads.append(new LocalCounter(&local, features, perSequence));
+    }
+    const qint64 localMsecs = runThreads(localThreads);
+
+    if (locked.cdsCount != local.cdsCount
+            || locked.unknownProtCdsCount != local.unknownProtCdsCount) {
+        qWarning() << "Counters mismatch: " << locked.cdsCount << " vs " << local.cdsCount;
+        return 1;
+    }
+
+    qDebug() << threads << " threads x " << features << " features on one organism";
+    qDebug() << "organism mutex per feature: " << lockedMsecs << " ms";
+    qDebug() << "thread-local counters, merged every " << perSequence
+             << " features: " << localMsecs << " ms";
+    return 0;
+}
@@ -0,0 +1,16 @@
+/* Row count and on-disk size of the big tables of the current database.
+   Run after ANALYZE TABLE, InnoDB statistics are estimates otherwise:
+     mysql --database=introns < tools/table_sizes.sql */
+
+ANALYZE TABLE sequences, genes, isoforms, real_exons, exons, introns;
+
+SELECT table_name,
+       table_rows,
+       avg_row_length,
+       ROUND(data_length / 1048576, 1) AS data_mb,
+       ROUND(index_length / 1048576, 1) AS index_mb,
+       ROUND((data_length + index_length) / 1048576, 1) AS total_mb
+FROM information_schema.tables
+WHERE table_schema = DATABASE()
+  AND table_name IN ('sequences', 'genes', 'isoforms', 'real_exons', 'exons', 'introns')
+ORDER BY data_length + index_length DESC;
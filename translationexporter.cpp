@@ -0,0 +1,107 @@
+#include "translationexporter.h"
+#include "fastastore.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QRegExp>
+
+TranslationExporter::TranslationExporter(const QString &dirName, int capacity)
+    : QThread()
+    , _dir(QDir(dirName).absolutePath())
+    , _capacity(qMax(1, capacity))
+{
+    QDir::root().mkpath(_dir.absolutePath());
+}
+
+void TranslationExporter::enqueue(SequencePtr sequence)
+{
+    Batch batch;
+    OrganismPtr organism = sequence->organism.toStrongRef();
+    organism->mutex.lock();
+    batch.organismName = organism->name;
+    organism->mutex.unlock();
+
+    Q_FOREACH(GenePtr gene, sequence->genes) {
+        if (gene->unchanged) {
+            continue;
+        }
+        Q_FOREACH(IsoformPtr isoform, gene->isoforms) {
+            if (isoform->translation.isEmpty()) {
+                continue;
+            }
+            Translation translation;
+            translation.name = !isoform->proteinId.isEmpty() ? isoform->proteinId
+                    : !isoform->proteinXref.isEmpty() ? isoform->proteinXref
+                    : QString("isoforms_%1").arg(isoform->id);
+            translation.name.replace(QRegExp("\\s+"), "_");
+            translation.description = QString("%1 (genes id: %2)").arg(gene->name).arg(gene->id);
+            translation.sequence = isoform->translation.toLatin1();
+            batch.translations.append(translation);
+        }
+    }
+    if (batch.translations.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker lock(&_mutex);
+    if (_queue.size() >= _capacity && !_closed) {
+        QElapsedTimer timer;
+        timer.start();
+        while (_queue.size() >= _capacity && !_closed) {
+            _notFull.wait(&_mutex);
+        }
+        _producerWaitNsecs += timer.nsecsElapsed();
+    }
+    _queue.enqueue(batch);
+    _notEmpty.wakeOne();
+}
+
+void TranslationExporter::finish()
+{
+    QMutexLocker lock(&_mutex);
+    _closed = true;
+    _notEmpty.wakeAll();
+    lock.unlock();
+    wait();
+}
+
+void TranslationExporter::run()
+{
+    QElapsedTimer timer;
+    QMutexLocker lock(&_mutex);
+    for (;;) {
+        while (_queue.isEmpty() && !_closed) {
+            _notEmpty.wait(&_mutex);
+        }
+        if (_queue.isEmpty()) {
+            break;
+        }
+        const Batch batch = _queue.dequeue();
+        _notFull.wakeOne();
+        lock.unlock();
+
+        timer.start();
+        QSharedPointer<FastaStore> store = FastaStore::forFile(
+                    _dir.absoluteFilePath(FastaStore::baseNameFor(batch.organismName) + ".faa"), false);
+        Q_FOREACH(const Translation & translation, batch.translations) {
+            if (!store || store->append(translation.name, translation.sequence, translation.description) < 0) {
+                qWarning() << "Protein translation " << translation.name << " will not be stored!";
+            }
+        }
+        const qint64 elapsed = timer.nsecsElapsed();
+
+        lock.relock();
+        _translations += batch.translations.size();
+        _writeNsecs += elapsed;
+    }
+}
+
+QString TranslationExporter::report() const
+{
+    QMutexLocker lock(&_mutex);
+    return QString("Translations: %1 written in %2 ms, writers blocked %3 ms")
+            .arg(_translations)
+            .arg(_writeNsecs / 1000000)
+            .arg(_producerWaitNsecs / 1000000);
+}
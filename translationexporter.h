@@ -0,0 +1,60 @@
+#ifndef TRANSLATIONEXPORTER_H
+#define TRANSLATIONEXPORTER_H
+
+#include "sequencesink.h"
+#include "structures.h"
+
+#include <QDir>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+// Protein translations of stored sequences (--transdir), one multi-FASTA
+// file with .fai index per organism: <organism>.faa. Writer threads hand
+// over translations of a sequence once it is stored (gene ids are known
+// by then) and go on; formatting and disk writes are done by this thread.
+class TranslationExporter
+        : public QThread
+        , public SequenceSink
+{
+public:
+    TranslationExporter(const QString & dirName, int capacity);
+
+    // Takes translations of all the isoforms. Blocks while the queue is full.
+    void enqueue(SequencePtr sequence) override;
+
+    // No more input: write what is queued and stop the thread
+    void finish();
+
+    QString report() const;
+
+private:
+    struct Translation {
+        QString name;  // protein_id, unique within organism
+        QString description;
+        QByteArray sequence;
+    };
+    struct Batch {
+        QString organismName;
+        QList<Translation> translations;
+    };
+
+    void run() override;
+
+    const QDir _dir;
+    const int _capacity;
+    mutable QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<Batch> _queue;
+    bool _closed = false;
+
+    quint64 _translations = 0;
+    qint64 _producerWaitNsecs = 0;
+    qint64 _writeNsecs = 0;
+};
+
+#endif // TRANSLATIONEXPORTER_H
@@ -0,0 +1,170 @@
+#include "writerpool.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+WriterPool::WriterPool(const DatabaseOptions &options, int writers, int capacity,
+                       const QList<SequenceSink *> &sinks)
+    : _options(options)
+    , _capacity(qMax(1, capacity))
+    , _sinks(sinks)
+{
+    for (int i=0; i<qMax(1, writers); ++i) {
+        _writers.append(new Writer(this));
+    }
+}
+
+WriterPool::~WriterPool()
+{
+    finish();
+}
+
+void WriterPool::start()
+{
+    QMutexLocker lock(&_mutex);
+    _liveWriters = _writers.size();
+    lock.unlock();
+    Q_FOREACH(Writer * writer, _writers) {
+        writer->start();
+    }
+}
+
+bool WriterPool::enqueue(SequencePtr sequence)
+{
+    QMutexLocker lock(&_mutex);
+    if (_queue.size() >= _capacity && _liveWriters > 0) {
+        QElapsedTimer timer;
+        timer.start();
+        while (_queue.size() >= _capacity && _liveWriters > 0) {
+            _notFull.wait(&_mutex);
+        }
+        _stats.producerWaitNsecs += timer.nsecsElapsed();
+    }
+    if (0 == _liveWriters) {
+        return false;
+    }
+    _queue.enqueue(sequence);
+    _stats.sequences ++;
+    _stats.maxDepth = qMax(_stats.maxDepth, _queue.size());
+    _stats.depthSum += _queue.size();
+    _notEmpty.wakeOne();
+    return true;
+}
+
+SequencePtr WriterPool::dequeue()
+{
+    QMutexLocker lock(&_mutex);
+    if (_queue.isEmpty() && !_closed) {
+        QElapsedTimer timer;
+        timer.start();
+        while (_queue.isEmpty() && !_closed) {
+            _notEmpty.wait(&_mutex);
+        }
+        _stats.writerIdleNsecs += timer.nsecsElapsed();
+    }
+    SequencePtr result;
+    if (!_queue.isEmpty()) {
+        result = _queue.dequeue();
+        _notFull.wakeOne();
+    }
+    return result;
+}
+
+void WriterPool::writerFinished()
+{
+    QMutexLocker lock(&_mutex);
+    _liveWriters --;
+    if (0 == _liveWriters && !_queue.isEmpty()) {
+        qWarning() << "No database writers left, " << _queue.size() << " sequences dropped!";
+        _queue.clear();
+    }
+    _notFull.wakeAll();
+}
+
+void WriterPool::finish()
+{
+    QMutexLocker lock(&_mutex);
+    _closed = true;
+    _notEmpty.wakeAll();
+    lock.unlock();
+    Q_FOREACH(Writer * writer, _writers) {
+        writer->wait();
+        delete writer;
+    }
+    _writers.clear();
+}
+
+int WriterPool::depth() const
+{
+    QMutexLocker lock(&_mutex);
+    return _queue.size();
+}
+
+WriterPool::Stats WriterPool::stats() const
+{
+    QMutexLocker lock(&_mutex);
+    return _stats;
+}
+
+QString WriterPool::report() const
+{
+    const Stats s = stats();
+    return QString("Writer queue: %1 sequences, depth avg %2 / max %3 of %4, "
+                   "parsers blocked %5 ms, writers idle %6 ms")
+            .arg(s.sequences)
+            .arg(s.sequences ? double(s.depthSum) / s.sequences : 0.0, 0, 'f', 1)
+            .arg(s.maxDepth)
+            .arg(_capacity)
+            .arg(s.producerWaitNsecs / 1000000)
+            .arg(s.writerIdleNsecs / 1000000);
+}
+
+
+WriterPool::Writer::Writer(WriterPool *pool)
+    : QThread()
+    , _pool(pool)
+{
+}
+
+void WriterPool::Writer::run()
+{
+    qDebug() << "Created writer thread " << QThread::currentThreadId();
+    QSharedPointer<Database> db = Database::open(_pool->_options);
+    if (!db) {
+        qWarning() << "Can't open database in writer thread " << QThread::currentThreadId();
+    }
+    else {
+        db->beginBulkLoadSession();
+    }
+    QElapsedTimer sinceFlush;
+    sinceFlush.start();
+    while (db) {
+        SequencePtr seq = _pool->dequeue();
+        if (!seq) {
+            break;
+        }
+        // Organism/chromosome statistics are stored periodically and when
+        // the writer finishes (~Database), not after every sequence:
+        // consecutive sequences come from files of different parsers
+        if (sinceFlush.hasExpired(StatisticsFlushMsecs)) {
+            db->flushStatistics();
+            sinceFlush.restart();
+        }
+        if (db->storeOrigin(seq)) {
+            db->addSequence(seq);
+        }
+        else {
+            // Failed for the journal, left for --resume
+            seq->id = 0;
+        }
+        // The sequence and deletes of rows it replaces are committed by
+        // now, so the journal never lists a sequence with stale rows left
+        Q_FOREACH(SequenceSink * sink, _pool->_sinks) {
+            sink->enqueue(seq);
+        }
+    }
+    db.clear();
+    _pool->writerFinished();
+    qDebug() << "Finished writer thread " << QThread::currentThreadId();
+}
@@ -0,0 +1,79 @@
+#ifndef WRITERPOOL_H
+#define WRITERPOOL_H
+
+#include "database.h"
+#include "structures.h"
+#include "sequencesink.h"
+
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+// Bounded queue of parsed sequences drained by a fixed set of writer
+// threads, each with its own database connection. Parser threads only
+// hand over finished SequencePtr graphs and go on reading the next record.
+class WriterPool
+{
+public:
+    struct Stats {
+        quint64 sequences = 0;
+        int maxDepth = 0;
+        quint64 depthSum = 0;        // sampled at every enqueue
+        qint64 producerWaitNsecs = 0; // parsers blocked on full queue
+        qint64 writerIdleNsecs = 0;  // writers waiting on empty queue
+    };
+
+    // Stored sequences go on to sinks, e.g. exporters
+    WriterPool(const DatabaseOptions & options, int writers, int capacity,
+               const QList<SequenceSink*> & sinks = QList<SequenceSink*>());
+    ~WriterPool();
+
+    void start();
+
+    // Blocks while the queue is full. Returns false if there are no
+    // writers left to take the sequence.
+    bool enqueue(SequencePtr sequence);
+
+    // No more input: let the writers drain the queue and wait for them
+    void finish();
+
+    int depth() const;
+    Stats stats() const;
+    QString report() const;
+
+private:
+    Q_DISABLE_COPY(WriterPool)
+
+    class Writer
+            : public QThread
+    {
+    public:
+        explicit Writer(WriterPool * pool);
+    private:
+        void run() override;
+        WriterPool * _pool;
+    };
+
+    enum { StatisticsFlushMsecs = 30000 };
+
+    SequencePtr dequeue();
+    void writerFinished();
+
+    const DatabaseOptions _options;
+    const int _capacity;
+    const QList<SequenceSink*> _sinks;
+    QList<Writer*> _writers;
+
+    mutable QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<SequencePtr> _queue;
+    bool _closed = false;
+    int _liveWriters = 0;
+    Stats _stats;
+};
+
+#endif // WRITERPOOL_H